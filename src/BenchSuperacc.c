@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <random>
+
+#include "reloj.h"
+
+#include "exblas/accumulate.h"
+
+// ================================================================================
+// Microbenchmark of the superaccumulator core: accumulation of doubles,
+// normalization and rounding, against the former implementation (inline asm
+// xadd, serial carry loop, rounding through NearSum) kept below for reference.
+
+namespace legacy {
+
+using namespace exblas;
+
+inline static int64_t xadd(int64_t & memref, int64_t x, unsigned char & of)
+{
+    int64_t oldword = x;
+    asm volatile ("xadd %1, %0\n"
+        "seto %2"
+     : "+m" (memref), "+r" (oldword), "=q" (of) : : "cc", "memory");
+    return oldword;
+}
+
+static inline void AccumulateWord( int64_t *accumulator, int i, int64_t x) {
+    unsigned char overflow;
+    int64_t carry = x;
+    int64_t carrybit;
+    int64_t oldword = xadd(accumulator[i], x, overflow);
+    while(unlikely(overflow)) {
+        carry = (oldword + carry) >> DIGITS;
+        bool s = oldword > 0;
+        carrybit = (s ? 1ll << KRX : -1ll << KRX);
+        xadd(accumulator[i], (int64_t) -(carry << DIGITS), overflow);
+        carry += carrybit;
+        ++i;
+        if (i >= BIN_COUNT)
+            return;
+        oldword = xadd(accumulator[i], carry, overflow);
+    }
+}
+
+static inline void Accumulate( int64_t* accumulator, double x) {
+    if (x == 0)
+        return;
+    int e = cpu::exponent(x);
+    int exp_word = e / DIGITS;
+    int iup = exp_word + F_WORDS;
+    double xscaled = cpu::myldexp(x, -DIGITS * exp_word);
+    for (int i = iup; xscaled != 0; --i) {
+        double xrounded = cpu::myrint(xscaled);
+        int64_t xint = cpu::myllrint(xscaled);
+        AccumulateWord(accumulator, i, xint);
+        xscaled -= xrounded;
+        xscaled *= DELTASCALE;
+    }
+}
+
+static inline bool Normalize( int64_t *accumulator, int& imin, int& imax) {
+    int64_t carry_in = accumulator[imin] >> DIGITS;
+    accumulator[imin] -= carry_in << DIGITS;
+    int i;
+    for (i = imin + 1; i < BIN_COUNT; ++i) {
+        accumulator[i] += carry_in;
+        int64_t carry_out = accumulator[i] >> DIGITS;
+        accumulator[i] -= (carry_out << DIGITS);
+        carry_in = carry_out;
+    }
+    imax = i - 1;
+    accumulator[imax] += carry_in << DIGITS;
+    return carry_in < 0;
+}
+
+static inline double Round( int64_t * accumulator) {
+    int imin = IMIN;
+    int imax = IMAX;
+    bool negative = Normalize(accumulator, imin, imax);
+    int i;
+    for(i = imax; accumulator[i] == 0 && i >= imin; --i) {
+    }
+    if (negative) {
+        for(; (accumulator[i] & ((1ll << DIGITS) - 1)) == ((1ll << DIGITS) - 1) && i >= imin; --i) {
+        }
+    }
+    if (i < 0) {
+        return 0.0;
+    }
+    imax = i;
+    int ii;
+    for(ii = imin; accumulator[ii] == 0 && ii <= imax; ++ii) {
+    }
+    if (negative) {
+        for(; (accumulator[ii] & ((1ll << DIGITS) - 1)) == ((1ll << DIGITS) - 1) && ii <= imax; ++ii) {
+        }
+    }
+    imin = ii;
+    double arr[imax-imin+1];
+    int64_t hiword = negative ? ((1ll << DIGITS) - 1) - accumulator[i] : accumulator[i];
+    double rounded = (double)hiword;
+    double hi = ldexp(rounded, (i - F_WORDS) * DIGITS);
+    int j = 0;
+    arr[j] = hi;
+    i--;
+    for(int ii = i; ii >= imin; --ii) {
+        ++j;
+        hiword = negative ? ((1ll << DIGITS) - 1) - accumulator[ii] : accumulator[ii];
+        rounded = (double)hiword;
+        hi = ldexp(rounded, (ii - F_WORDS) * DIGITS);
+        arr[j] = hi;
+    }
+    hi = NearSum(imax-imin+1, &arr[0], 1);
+    return negative ? -hi : hi;
+}
+
+}//namespace legacy
+
+/*********************************************************************************/
+
+// Checks at the bottom of the superaccumulator, whose last bit is 2^-1040:
+// the sums are exact down to it, smaller values (subnormals too) are rounded
+// to it one by one, and nothing is written below word IMIN. Returns the
+// number of failed checks.
+static int CheckBottomEdge () {
+    const int guard = 4;
+    const double ulp = ldexp(1.0, -exblas::DIGITS * exblas::F_WORDS);
+    std::vector<int64_t> buf(exblas::BIN_COUNT + 2*guard);
+    int64_t *acc = &buf[guard];
+    int failed = 0;
+
+    struct { const char *name; std::vector<double> x; double sum; } cases[] = {
+        // exact: every bit is at or above the last one
+        {"last bit", {ulp}, ulp},
+        {"normal and last bit", {ldexp(1.0, -1022), 3*ulp, -ldexp(1.0, -1022)}, 3*ulp},
+        {"smallest exact double", {ldexp(1.0 + ldexp(1.0, -52), -988), -ldexp(1.0, -988)}, ldexp(1.0, -1040)},
+        // rounded to the nearest multiple of the last bit, value by value
+        {"bits below the last one", {ulp + ldexp(1.0, -1060)}, ulp},
+        {"smallest subnormal", {ldexp(1.0, -1074), ldexp(1.0, -1074)}, 0.0},
+        {"subnormal above half the last bit", {ldexp(3.0, -1042), -ldexp(3.0, -1042)}, 0.0},
+        {"subnormal with a carry", {ldexp(1.0, -1023) + ldexp(1.0, -1060), -ldexp(1.0, -1023)}, 0.0},
+    };
+    for (auto &c : cases) {
+        std::fill(buf.begin(), buf.end(), 0);
+        for (double x : c.x)
+            exblas::cpu::Accumulate (acc, x);
+        bool clean = true;
+        for (int i = 0; i < guard; i++)
+            clean = clean && buf[i] == 0 && buf[guard + exblas::BIN_COUNT + i] == 0;
+        double r = exblas::cpu::Round (acc);
+        if (!clean || r != c.sum) {
+            printf ("Bottom edge, %s: %a instead of %a%s\n", c.name, r, c.sum, clean ? "" : ", written out of bounds");
+            failed++;
+        }
+    }
+
+    // the same tiny values in any order give the same sum
+    std::mt19937_64 gen(1040);
+    std::vector<double> tiny(1000);
+    for (auto &x : tiny)
+        x = ldexp((double) (int64_t) (gen() % 2000001) - 1000000.0, -1070 + (int) (gen() % 40));
+    std::vector<int64_t> fwd(exblas::BIN_COUNT, 0), bwd(exblas::BIN_COUNT, 0);
+    for (int i = 0; i < (int) tiny.size(); i++) {
+        exblas::cpu::Accumulate (&fwd[0], tiny[i]);
+        exblas::cpu::Accumulate (&bwd[0], tiny[tiny.size() - 1 - i]);
+    }
+    double rf = exblas::cpu::Round (&fwd[0]), rb = exblas::cpu::Round (&bwd[0]);
+    if (memcmp (&rf, &rb, sizeof(double)) != 0) {
+        printf ("Bottom edge, order of tiny values: %a and %a\n", rf, rb);
+        failed++;
+    }
+    return failed;
+}
+
+int main (int argc, char **argv) {
+    int n = (argc > 1) ? atoi(argv[1]) : 1000000;       // doubles per superaccumulator
+    int nacc = (argc > 2) ? atoi(argv[2]) : 1000;       // superaccumulators to round
+    double t1, t2, ucpu, t_acc[2], t_round[2];
+    int errors = 0;
+
+    // doubles of both signs over a wide exponent range, with cancellations
+    std::mt19937_64 gen(2021);
+    std::uniform_real_distribution<double> unif(-1.0, 1.0);
+    std::vector<double> x(n);
+    for (int i = 0; i < n; i++)
+        x[i] = ldexp(unif(gen), (int) (gen() % 160) - 80);
+
+    // accumulation of all the doubles
+    std::vector<int64_t> acc_new(exblas::BIN_COUNT, 0), acc_old(exblas::BIN_COUNT, 0);
+    reloj (&t1, &ucpu);
+    for (int i = 0; i < n; i++)
+        legacy::Accumulate (&acc_old[0], x[i]);
+    reloj (&t2, &ucpu); t_acc[0] = t2 - t1;
+    reloj (&t1, &ucpu);
+    for (int i = 0; i < n; i++)
+        exblas::cpu::Accumulate (&acc_new[0], x[i]);
+    reloj (&t2, &ucpu); t_acc[1] = t2 - t1;
+    errors += (legacy::Round (&acc_old[0]) != exblas::cpu::Round (&acc_new[0]));
+
+    // normalization and rounding of unnormalized superaccumulators, each one
+    // made of a few random doubles; the set fits in cache and is rounded reps times
+    int reps = 100;
+    std::vector<int64_t> accs(nacc * exblas::BIN_COUNT, 0), copy(nacc * exblas::BIN_COUNT);
+    std::vector<double> r_old(nacc), r_new(nacc);
+    for (int k = 0; k < nacc; k++)
+        for (int i = 0; i < 8; i++)
+            exblas::cpu::Accumulate (&accs[k*exblas::BIN_COUNT], x[(8*k+i) % n] * ((i & 1) ? -1.0 : 1.0e-3));
+    reloj (&t1, &ucpu);
+    for (int rep = 0; rep < reps; rep++) {
+        copy = accs;
+        for (int k = 0; k < nacc; k++)
+            r_old[k] = legacy::Round (&copy[k*exblas::BIN_COUNT]);
+    }
+    reloj (&t2, &ucpu); t_round[0] = t2 - t1;
+    reloj (&t1, &ucpu);
+    for (int rep = 0; rep < reps; rep++) {
+        copy = accs;
+        for (int k = 0; k < nacc; k++)
+            r_new[k] = exblas::cpu::Round (&copy[k*exblas::BIN_COUNT]);
+    }
+    reloj (&t2, &ucpu); t_round[1] = t2 - t1;
+    for (int k = 0; k < nacc; k++)
+        errors += (memcmp (&r_old[k], &r_new[k], sizeof(double)) != 0);
+
+    printf ("                       legacy         new   speedup\n");
+    printf ("Accumulate (%8d) %10.4f  %10.4f  %8.2f\n", n, t_acc[0], t_acc[1], t_acc[0] / t_acc[1]);
+    printf ("Round      (%8d) %10.4f  %10.4f  %8.2f\n", nacc * reps, t_round[0], t_round[1], t_round[0] / t_round[1]);
+    // the former rounding is not always correct (e.g. large top words), so
+    // differences are reported rather than treated as failures
+    printf ("Different results: %d\n", errors);
+
+    int edge = CheckBottomEdge ();
+    printf ("Bottom edge checks failed: %d\n", edge);
+
+    return (edge == 0) ? 0 : 1;
+}
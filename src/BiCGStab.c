@@ -7,6 +7,7 @@
 #include <mpi.h>
 #include <hb_io.h>
 #include <vector>
+#include <algorithm>
 
 #include "reloj.h"
 #include "ScalarVectors.h"
@@ -15,15 +16,74 @@
 #include "matrix.h"
 #include "common.h"
 
-#include "exblas/exdot.h"
+#include "MatrixPowers.h"
+#include "DotBackend.h"
+
+#include "exblas/exdot_tuned.h"
 
 // ================================================================================
 
 #define DIRECT_ERROR 0
 #define PRECOND 1
 #define VECTOR_OUTPUT 0
+// rows of the SpMV summed exactly and rounded once (independent of the storage order)
+#ifndef EXACT_SPMV
+#define EXACT_SPMV 0
+#endif
+
+// values of the matrix (and of the preconditioner) stored as floats by the solver,
+// and widened to double on load; vectors and dots stay in double
+#ifndef FLOAT_MATRIX
+#define FLOAT_MATRIX 0
+#endif
+#ifndef FLOAT_DIAG
+#define FLOAT_DIAG 0
+#endif
+
+#if EXACT_SPMV
+#define SPMV ProdSparseMatrixVectorByRows_Exact
+#define SPMV_F ProdSparseMatrixFVectorByRows_Exact
+#else
+#define SPMV ProdSparseMatrixVectorByRows
+#define SPMV_F ProdSparseMatrixFVectorByRows
+#endif
+
+// product by the matrix of the solver
+#if FLOAT_MATRIX
+#define SPMV_SOLVER SPMV_F
+#else
+#define SPMV_SOLVER SPMV
+#endif
+
+// dots of the solver when no dot=<backend> argument is given (see DotBackend.h)
+#ifndef DOT_BACKEND
+#define DOT_BACKEND "superacc"
+#endif
+
+// solver when no solver=<name> argument is given (see solvers below)
+#ifndef SOLVER
+#define SOLVER "bicgstab"
+#endif
+
+// iterations of every block of the s-step solver when no s=<steps> argument is given
+#ifndef SSTEP
+#define SSTEP 2
+#endif
+static int sstep = SSTEP;
+
+// Right-hand sides of the block solver, k=<rhs> argument
+#ifndef NRHS
+#define NRHS 4
+#endif
+static int nrhs = NRHS;
+
+// Degree of the minimal residual polynomial of BiCGStab(l), l=<ell> argument
+#ifndef ELL
+#define ELL 2
+#endif
+static int ell = ELL;
 
-void BiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, int myId) {
+void BiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, int myId, DotBackend *dots) {
     int size = mat.dim2, sizeR = mat.dim1; 
     int IONE = 1; 
     double DONE = 1.0, DMONE = -1.0, DZERO = 0.0;
@@ -32,10 +92,27 @@ void BiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, i
     double *s = NULL, *q = NULL, *r = NULL, *p = NULL, *r0 = NULL, *y = NULL, *p_hat = NULL, *q_hat = NULL;
     double *aux = NULL;
     double t1, t2, t3, t4;
-    double reduce[2];
+    double reduce[DOT_SLOTS];
+    int req, req_alpha, req_pair, req_tol;
+    // sums reduced with the tolerance: rho, <r, r> and the direct error
+#if DIRECT_ERROR
+    int tol_sums = 2 + dots->Nrm2Slots ();
+#else
+    int tol_sums = 2;
+#endif
+    AllgathervPlan gather_p, gather_q;
 #if PRECOND
     int i, *posd = NULL;
     double *diags = NULL;
+#if FLOAT_DIAG
+    float *diagsF = NULL;
+#endif
+#endif
+#if FLOAT_MATRIX
+    SparseMatrixF matS;
+    CreateSparseMatrixF (mat, &matS);
+#else
+    SparseMatrix matS = mat;
 #endif
 
     MPI_Comm_size(MPI_COMM_WORLD, &nProcs);
@@ -63,6 +140,10 @@ void BiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, i
 #pragma omp parallel for
     for (i=0; i<n_dist; i++) 
         diags[i] = DONE / diags[i];
+#if FLOAT_DIAG
+    CreateFloats (&diagsF, n_dist);
+    CopyDoublesToFloats (diags, diagsF, n_dist);
+#endif
 #endif
     CreateDoubles (&aux, n); 
 
@@ -79,49 +160,43 @@ void BiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, i
     iter = 0;
     MPI_Allgatherv (x, sizeR, MPI_DOUBLE, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
     InitDoubles (s, sizeR, DZERO, DZERO);
-    ProdSparseMatrixVectorByRows (mat, 0, aux, s);            			// s = A * x
-    dcopy (&n_dist, b, &IONE, r, &IONE);                                // r = b
-    daxpy (&n_dist, &DMONE, s, &IONE, r, &IONE);                        // r -= s
+    SPMV_SOLVER (matS, 0, aux, s);                              			// s = A * x
 
-    dcopy (&n_dist, r, &IONE, p, &IONE);                                // p = r
-    dcopy (&n_dist, r, &IONE, r0, &IONE);                               // r0 = r
-
-    // compute tolerance and <r0,r0>
-    std::vector<int64_t> h_superacc(2 * exblas::BIN_COUNT);
-    std::vector<int64_t> h_superacc_tol(exblas::BIN_COUNT);
-    int imin=exblas::IMIN, imax=exblas::IMAX;
-    exblas::cpu::exdot (n_dist, r, r, &h_superacc[0]);
-    // ReproAllReduce -- Begin
-    exblas::cpu::Normalize(&h_superacc[0], imin, imax);
-    if (myId == 0) {
-        MPI_Reduce (MPI_IN_PLACE, &h_superacc[0], exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-    } else {
-        MPI_Reduce (&h_superacc[0], NULL, exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-    }
-    if (myId == 0) {
-        rho = exblas::cpu::Round( &h_superacc[0] );
+    // r = b - s and <r0,r0> in one pass, to compute the tolerance
+    {
+        const double *dot_w[1] = {r};
+        dots->AxpyDots (n_dist, DMONE, s, b, r, 1, dot_w, 0);
     }
-    MPI_Bcast(&rho, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    // ReproAllReduce -- End
-    tol0 = sqrt (rho);
-    tol = tol0;
-
 #if DIRECT_ERROR
-    // compute direct error
+    // direct error ||x_exact - x||, reduced with <r0,r0>
     double direct_err;
     dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);                    // res_err = x_exact
     daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);                  // res_err -= x
+    dots->Nrm2 (n_dist, res_err, 1);
+#endif // DIRECT_ERROR
+    req = dots->ReduceBegin (tol_sums - 1);
 
-    // compute inf norm
-    direct_err = norm_inf(n_dist, res_err);
-    MPI_Allreduce(MPI_IN_PLACE, &direct_err, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    dcopy (&n_dist, r, &IONE, p, &IONE);                                // p = r
+    dcopy (&n_dist, r, &IONE, r0, &IONE);                               // r0 = r
 
-    //    // compute euclidean norm
-    //    direct_err = ddot (&n_dist, res_err, &IONE, res_err, &IONE);            // direct_err = res_err' * res_err
-    //    MPI_Allreduce(MPI_IN_PLACE, &direct_err, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-    //    direct_err = sqrt(direct_err);
+    dots->ReduceEnd (req, reduce);
+    rho = reduce[0];
+    tol0 = sqrt (rho);
+    tol = tol0;
+#if DIRECT_ERROR
+    direct_err = dots->Nrm2Round (&reduce[1]);
 #endif // DIRECT_ERROR
 
+    // the communications of the iterations always use the same buffers, set them up once
+#if !PRECOND
+    p_hat = p; q_hat = q;
+#endif
+    AllgathervInit (p_hat, sizeR, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_p);
+    AllgathervInit (q_hat, sizeR, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_q);
+    req_alpha = dots->ReduceInit (1);
+    req_pair = dots->ReduceInit (2);
+    req_tol = dots->ReduceInit (tol_sums);
+
     MPI_Barrier(MPI_COMM_WORLD);
     if (myId == 0) 
         reloj (&t1, &t2);
@@ -129,13 +204,17 @@ void BiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, i
     while ((iter < maxiter) && (tol > umbral)) {
 
 #if PRECOND
+#if FLOAT_DIAG
+        VvecDoublesF (DONE, diagsF, p, DZERO, p_hat, n_dist);            // p_hat = D^-1 * p
+#else
         VvecDoubles (DONE, diags, p, DZERO, p_hat, n_dist);              // p_hat = D^-1 * p
+#endif
 #else
         p_hat = p;
 #endif
-        MPI_Allgatherv (p_hat, sizeR, MPI_DOUBLE, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+        AllgathervStart (&gather_p); AllgathervWait (&gather_p);
         InitDoubles (s, sizeR, DZERO, DZERO);
-        ProdSparseMatrixVectorByRows (mat, 0, aux, s);            	     // s = A * p
+        SPMV_SOLVER (matS, 0, aux, s);                              	     // s = A * p
 
         if (myId == 0) 
 #if DIRECT_ERROR
@@ -144,125 +223,81 @@ void BiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, i
         printf ("%d \t %a \n", iter, tol);
 #endif // DIRECT_ERROR
 
-        exblas::cpu::exdot (n_dist, r0, s, &h_superacc[0]);             // alpha = <r_0, r_iter> / <r_0, s>
-        // ReproAllReduce -- Begin
-        exblas::cpu::Normalize(&h_superacc[0], imin, imax);
-        if (myId == 0) {
-            MPI_Reduce (MPI_IN_PLACE, &h_superacc[0], exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-        } else {
-            MPI_Reduce (&h_superacc[0], NULL, exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-        }
-        if (myId == 0) {
-            alpha = exblas::cpu::Round( &h_superacc[0] );
-        }
-        MPI_Bcast(&alpha, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        // ReproAllReduce -- End
-        alpha = rho / alpha;
+        dots->Dot (n_dist, r0, s, 0);                                   // alpha = <r_0, r_iter> / <r_0, s>
+        dots->ReduceStart (req_alpha);
 
+#if !PRECOND
         dcopy (&n_dist, r, &IONE, q, &IONE);                            // q = r
-        tmp = -alpha;
-        daxpy (&n_dist, &tmp, s, &IONE, q, &IONE);                      // q = r - alpha * s;
+#endif
+
+        dots->ReduceEnd (req_alpha, &alpha);
+        alpha = rho / alpha;
 
+        tmp = -alpha;
         // second spmv
 #if PRECOND
-        VvecDoubles (DONE, diags, q, DZERO, q_hat, n_dist);             // q_hat = D^-1 * q
+#if FLOAT_DIAG
+        AxpyVvecDoublesF (tmp, s, r, q, DONE, diagsF, DZERO, q_hat, n_dist); // q = r - alpha * s; q_hat = D^-1 * q
+#else
+        AxpyVvecDoubles (tmp, s, r, q, DONE, diags, DZERO, q_hat, n_dist); // q = r - alpha * s; q_hat = D^-1 * q
+#endif
 #else
+        daxpy (&n_dist, &tmp, s, &IONE, q, &IONE);                      // q = r - alpha * s;
         q_hat = q;
 #endif
-        MPI_Allgatherv (q_hat, sizeR, MPI_DOUBLE, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+        AllgathervStart (&gather_q); AllgathervWait (&gather_q);
         InitDoubles (y, sizeR, DZERO, DZERO);
-        ProdSparseMatrixVectorByRows (mat, 0, aux, y);            		// y = A * q
+        SPMV_SOLVER (matS, 0, aux, y);                              		// y = A * q
 
         // omega = <q, y> / <y, y>
-        exblas::cpu::exdot (n_dist, q, y, &h_superacc[0]);
-        exblas::cpu::exdot (n_dist, y, y, &h_superacc_tol[0]);
-        // ReproAllReduce -- Begin
-        exblas::cpu::Normalize(&h_superacc[0], imin, imax);
-        exblas::cpu::Normalize(&h_superacc_tol[0], imin, imax);
-        // merge two superaccs into one for reduction
-        for (int i = 0; i < exblas::BIN_COUNT; i++) {
-            h_superacc[exblas::BIN_COUNT + i] = h_superacc_tol[i]; 
-        } 
-        if (myId == 0) {
-            MPI_Reduce (MPI_IN_PLACE, &h_superacc[0], 2*exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-        } else {
-            MPI_Reduce (&h_superacc[0], NULL, 2*exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        {
+            const double *dot_x[2] = {q, y}, *dot_y[2] = {y, y};
+            dots->Dots (n_dist, 2, dot_x, dot_y, 0);
         }
-        if (myId == 0) {
-            // split them back
-            for (int i = 0; i < exblas::BIN_COUNT; i++) {
-                h_superacc_tol[i] = h_superacc[exblas::BIN_COUNT + i]; 
-            } 
-            reduce[0] = exblas::cpu::Round( &h_superacc[0] );
-            reduce[1] = exblas::cpu::Round( &h_superacc_tol[0] );
-        }
-        MPI_Bcast(reduce, 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        // ReproAllReduce -- End
+        dots->ReduceStart (req_pair);
+
+        // overlap the reduction with the work that does not depend on omega
+        daxpy (&n_dist, &alpha, p_hat, &IONE, x, &IONE);                // x += alpha * p_hat
+
+        dots->ReduceEnd (req_pair, reduce);
         omega = reduce[0] / reduce[1];
 
         // x+1 = x + alpha * p + omega * q
-        daxpy (&n_dist, &alpha, p_hat, &IONE, x, &IONE); 
         daxpy (&n_dist, &omega, q_hat, &IONE, x, &IONE); 
 
-        // r+1 = q - omega * y
-        dcopy (&n_dist, q, &IONE, r, &IONE);                            // r = q
-        tmp = -omega;
-        daxpy (&n_dist, &tmp, y, &IONE, r, &IONE);                      // r = q - omega * y;
-        
-        // rho = <r0, r+1> and tolerance
+        // r+1 = q - omega * y, with rho = <r0, r+1> and tolerance in the same pass
         // cannot just use <r0, r> as the stopping criteria since it slows the convergence compared to <r, r>
-        exblas::cpu::exdot (n_dist, r0, r, &h_superacc[0]);
-        exblas::cpu::exdot (n_dist, r, r, &h_superacc_tol[0]);
-        // ReproAllReduce -- Begin
-        exblas::cpu::Normalize(&h_superacc[0], imin, imax);
-        exblas::cpu::Normalize(&h_superacc_tol[0], imin, imax);
-        // merge two superaccs into one for reduction
-        for (int i = 0; i < exblas::BIN_COUNT; i++) {
-            h_superacc[exblas::BIN_COUNT + i] = h_superacc_tol[i]; 
-        } 
-        if (myId == 0) {
-            MPI_Reduce (MPI_IN_PLACE, &h_superacc[0], 2*exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-        } else {
-            MPI_Reduce (&h_superacc[0], NULL, 2*exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-        }
-        if (myId == 0) {
-            // split them back
-            for (int i = 0; i < exblas::BIN_COUNT; i++) {
-                h_superacc_tol[i] = h_superacc[exblas::BIN_COUNT + i]; 
-            } 
-            reduce[0] = exblas::cpu::Round( &h_superacc[0] );
-            reduce[1] = exblas::cpu::Round( &h_superacc_tol[0] );
+        tmp = -omega;
+        {
+            const double *dot_w[2] = {r0, r};
+            dots->AxpyDots (n_dist, tmp, y, q, r, 2, dot_w, 0);
         }
-        MPI_Bcast(reduce, 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        // ReproAllReduce -- End
+#if DIRECT_ERROR
+        // x is final, its direct error goes in the same message
+        dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);               // res_err = x_exact
+        daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);             // res_err -= x
+        dots->Nrm2 (n_dist, res_err, 2);
+#endif // DIRECT_ERROR
+        dots->ReduceStart (req_tol);
+
+        // p+1 = r+1 + beta * (p - omega * s), the part before beta is known
+        tmp = -omega; 
+        daxpy (&n_dist, &tmp, s, &IONE, p, &IONE);                     // p -= omega * s
+
+        dots->ReduceEnd (req_tol, reduce);
         tmp = reduce[0];
         tol = sqrt (reduce[1]) / tol0;
+#if DIRECT_ERROR
+        direct_err = dots->Nrm2Round (&reduce[2]);
+#endif // DIRECT_ERROR
 
         // beta = (alpha / omega) * <r0, r+1> / <r0, r>
         beta = (alpha / omega) * (tmp / rho);
         rho = tmp;
        
-        // p+1 = r+1 + beta * (p - omega * s)
-        tmp = -omega; 
-        daxpy (&n_dist, &tmp, s, &IONE, p, &IONE);                     // p -= omega * s
         dscal (&n_dist, &beta, p, &IONE);                              // p = beta * p
         daxpy (&n_dist, &DONE, r, &IONE, p, &IONE);                    // p += r
 
-#if DIRECT_ERROR
-        // compute direct error
-        dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);               // res_err = x_exact
-        daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);             // res_err -= x
-
-        // compute inf norm
-        direct_err = norm_inf(n_dist, res_err);
-        MPI_Allreduce(MPI_IN_PLACE, &direct_err, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
-
-        //        // compute euclidean norm
-        //        direct_err = ddot (&n_dist, res_err, &IONE, res_err, &IONE);
-        //        MPI_Allreduce(MPI_IN_PLACE, &direct_err, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-        //        direct_err = sqrt(direct_err);
-#endif // DIRECT_ERROR
-
         iter++;
     }
 
@@ -287,144 +322,1730 @@ void BiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, i
         printf ("Tol: %a \n", tol);
         printf ("Time_loop: %20.10e\n", (t3-t1));
         printf ("Time_iter: %20.10e\n", (t3-t1)/iter);
+        printf ("Dot: %s \n", dots->Name ());
+        printf ("Time_dot: %20.10e\n", dots->time_dot);
+        printf ("Time_reduce: %20.10e\n", dots->time_reduce);
     }
 
+    AllgathervFree (&gather_p); AllgathervFree (&gather_q);
+    dots->ReduceFree (req_alpha); dots->ReduceFree (req_pair); dots->ReduceFree (req_tol);
+
     RemoveDoubles (&aux); RemoveDoubles (&s); RemoveDoubles (&q); 
     RemoveDoubles (&r); RemoveDoubles (&p); RemoveDoubles (&r0); RemoveDoubles (&y);
 #if PRECOND
     RemoveDoubles (&diags); RemoveInts (&posd);
     RemoveDoubles(&p_hat); RemoveDoubles (&q_hat); 
+#if FLOAT_DIAG
+    RemoveFloats (&diagsF);
+#endif
+#endif
+#if FLOAT_MATRIX
+    RemoveSparseMatrixF (&matS);
 #endif
 }
 
 /*********************************************************************************/
 
-int main (int argc, char **argv) {
-    int dim; 
-    double *sol1 = NULL, *sol2 = NULL;
-    int index = 0, indexL = 0;
-    SparseMatrix mat  = {0, 0, NULL, NULL, NULL}, sym = {0, 0, NULL, NULL, NULL};
+// Pipelined BiCGStab (p-BiCGStab of Cools and Vanroose). Auxiliary vectors
+// carry the products by A of the search directions, so every reduction is
+// started before a product by the matrix and completed after it: two
+// reductions per iteration, each one hidden behind an SpMV, instead of three
+// that wait. Each right preconditioned vector v_hat = D^-1 * v of the paper is
+// applied with the Jacobi diagonal in the loops that update v, only p_hat
+// keeps its own recurrence. The dots are the same reproducible ones, the
+// residual is given by recurrences, so the iterations differ from BiCGStab.
+void PipeBiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, int myId, DotBackend *dots) {
+    int size = mat.dim2, sizeR = mat.dim1; 
+    double DONE = 1.0, DZERO = 0.0;
+    int i, n, n_dist, iter, maxiter, nProcs;
+    double beta, tol, tol0, alpha, umbral, rho, omega;
+    double *r = NULL, *r0 = NULL, *w = NULL, *w_hat = NULL, *t = NULL, *p_hat = NULL;
+    double *s = NULL, *z = NULL, *z_hat = NULL, *v = NULL, *q = NULL, *y = NULL;
+    double *aux = NULL, *diags = NULL;
+    double t1, t2, t3, t4;
+    double reduce[DOT_SLOTS];
+    int req, req_pair, req_sums;
+    // sums reduced after the update of x: <r0, r>, <r0, w>, <r0, s>, <r0, z>,
+    // <r, r> and the direct error
+#if DIRECT_ERROR
+    int num_sums = 5 + dots->Nrm2Slots ();
+#else
+    int num_sums = 5;
+#endif
+    AllgathervPlan gather_z, gather_w;
+#if PRECOND
+    int *posd = NULL;
+#endif
+#if FLOAT_DIAG
+    float *dinv = NULL;
+#else
+    double *dinv = NULL;
+#endif
+#if FLOAT_MATRIX
+    SparseMatrixF matS;
+    CreateSparseMatrixF (mat, &matS);
+#else
+    SparseMatrix matS = mat;
+#endif
 
-    int root = 0, myId, nProcs;
-    int dimL, dspL, *vdimL = NULL, *vdspL = NULL;
-    SparseMatrix matL = {0, 0, NULL, NULL, NULL};
-    double *sol1L = NULL, *sol2L = NULL;
+    MPI_Comm_size(MPI_COMM_WORLD, &nProcs);
+    n = size; n_dist = sizeR; maxiter = 16 * size; umbral = 1.0e-8;
+    CreateDoubles (&r, n_dist);
+    CreateDoubles (&r0, n_dist);
+    CreateDoubles (&w, n_dist);
+    CreateDoubles (&w_hat, n_dist);
+    CreateDoubles (&t, n_dist);
+    CreateDoubles (&p_hat, n_dist);
+    CreateDoubles (&s, n_dist);
+    CreateDoubles (&z, n_dist);
+    CreateDoubles (&z_hat, n_dist);
+    CreateDoubles (&v, n_dist);
+    CreateDoubles (&q, n_dist);
+    CreateDoubles (&y, n_dist);
+#if DIRECT_ERROR
+    // init exact solution
+    int IONE = 1;
+    double DMONE = -1.0, *res_err = NULL, *x_exact = NULL, direct_err;
+    CreateDoubles (&x_exact, n_dist);
+    CreateDoubles (&res_err, n_dist);
+    InitDoubles (x_exact, n_dist, DONE, DZERO);
+#endif // DIRECT_ERROR 
+
+    // inverse of the Jacobi diagonal, ones without preconditioner
+    CreateDoubles (&diags, n_dist);
+#if PRECOND
+    CreateInts (&posd, n_dist);
+    GetDiagonalSparseMatrix2 (mat, dspls[myId], diags, posd);
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++) 
+        diags[i] = DONE / diags[i];
+#else
+    InitDoubles (diags, n_dist, DONE, DZERO);
+#endif
+#if FLOAT_DIAG
+    CreateFloats (&dinv, n_dist);
+    CopyDoublesToFloats (diags, dinv, n_dist);
+#else
+    dinv = diags;
+#endif
+    CreateDoubles (&aux, n); 
 
-    int mat_from_file, nodes, size_param, stencil_points;
+    AllgathervInit (z_hat, sizeR, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_z);
+    AllgathervInit (w_hat, sizeR, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_w);
 
-    if (argc == 3) {
-        mat_from_file = atoi(argv[2]);
-    } else {
-        mat_from_file = atoi(argv[2]);
-        nodes = atoi(argv[3]);
-        size_param = atoi(argv[4]);
-        stencil_points = atoi(argv[5]);
+    iter = 0;
+    MPI_Allgatherv (x, sizeR, MPI_DOUBLE, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+    InitDoubles (s, sizeR, DZERO, DZERO);
+    SPMV_SOLVER (matS, 0, aux, s);                                      // s = A * x
+
+    // r = b - s, r0 = r and r_hat = D^-1 * r (in w_hat for the gather)
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++) {
+        r[i] = b[i] - s[i];
+        r0[i] = r[i];
+        w_hat[i] = dinv[i] * r[i];
     }
+    AllgathervStart (&gather_w); AllgathervWait (&gather_w);
+    InitDoubles (w, sizeR, DZERO, DZERO);
+    SPMV_SOLVER (matS, 0, aux, w);                                      // w = A * r_hat
 
-    /***************************************/
+    // rho = <r0, r0> and <r0, w>, hidden behind t = A * w_hat
+    {
+        const double *dot_x[2] = {r0, r0}, *dot_y[2] = {r, w};
+        dots->Dots (n_dist, 2, dot_x, dot_y, 0);
+    }
+#if DIRECT_ERROR
+    // direct error ||x_exact - x||, reduced with rho
+    dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);                    // res_err = x_exact
+    daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);                  // res_err -= x
+    dots->Nrm2 (n_dist, res_err, 2);
+    req = dots->ReduceBegin (2 + dots->Nrm2Slots ());
+#else
+    req = dots->ReduceBegin (2);
+#endif // DIRECT_ERROR
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++)
+        w_hat[i] = dinv[i] * w[i];                                      // w_hat = D^-1 * w
+    AllgathervStart (&gather_w); AllgathervWait (&gather_w);
+    InitDoubles (t, sizeR, DZERO, DZERO);
+    SPMV_SOLVER (matS, 0, aux, t);                                      // t = A * w_hat
 
-    MPI_Init (&argc, &argv);
+    dots->ReduceEnd (req, reduce);
+    rho = reduce[0];
+    alpha = rho / reduce[1];
+    tol0 = sqrt (rho);
+    tol = tol0;
+#if DIRECT_ERROR
+    direct_err = dots->Nrm2Round (&reduce[2]);
+#endif // DIRECT_ERROR
+    beta = DZERO; omega = DZERO;
+    InitDoubles (p_hat, n_dist, DZERO, DZERO);
+    InitDoubles (s, n_dist, DZERO, DZERO);
+    InitDoubles (z, n_dist, DZERO, DZERO);
+    InitDoubles (v, n_dist, DZERO, DZERO);
 
-    // Definition of the variables nProcs and myId
-    MPI_Comm_size(MPI_COMM_WORLD, &nProcs);
-    MPI_Comm_rank(MPI_COMM_WORLD, &myId);
-    root = nProcs-1;
-    root = 0;
+    req_pair = dots->ReduceInit (2);
+    req_sums = dots->ReduceInit (num_sums);
 
-    /***************************************/
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t1, &t2);
 
-    CreateInts (&vdimL, nProcs); CreateInts (&vdspL, nProcs); 
-    if(mat_from_file) {
-        if (myId == root) {
-            // Creating the matrix
-            ReadMatrixHB (argv[1], &sym);
-            TransposeSparseMatrices (sym, 0, &mat, 0);
-            dim = mat.dim1;
-        }
+    while ((iter < maxiter) && (tol > umbral)) {
 
-        // Distributing the matrix
-        dim = DistributeMatrix (mat, index, &matL, indexL, vdimL, vdspL, root, MPI_COMM_WORLD);
-        dimL = vdimL[myId]; dspL = vdspL[myId];
-    }
-    else {
-        dim = size_param * size_param * size_param;
-        int divL, rstL, i;
-        divL = (dim / nProcs); rstL = (dim % nProcs);
-        for (i=0; i<nProcs; i++) vdimL[i] = divL + (i < rstL);
-        vdspL[0] = 0; for (i=1; i<nProcs; i++) vdspL[i] = vdspL[i-1] + vdimL[i-1];
-        dimL = vdimL[myId]; dspL = vdspL[myId];
-        int band_width = size_param * (size_param + 1) + 1;
-        band_width = 100 * nodes;
-        long nnz_here = ((long) (stencil_points + 2 * band_width)) * dimL;
-        printf ("dimL: %d, nodes: %d, size_param: %d, band_width: %d, stencil_points: %d, nnz_here: %ld\n",
-                dimL, nodes, size_param, band_width, stencil_points, nnz_here);
-        allocate_matrix(dimL, dim, nnz_here, &matL);
-        generate_Poisson3D_filled(&matL, size_param, stencil_points, band_width, dspL, dimL, dim);
+        if (myId == 0) 
+#if DIRECT_ERROR
+            printf ("%d \t %a \t %a \n", iter, tol, direct_err);
+#else        
+        printf ("%d \t %a \n", iter, tol);
+#endif // DIRECT_ERROR
 
-        // To generate ill-conditioned matrices
-//        double factor = 1.0e6;
-//        ScaleFirstRowCol(matL, dspL, dimL, myId, root, factor);
-    }
-    MPI_Barrier(MPI_COMM_WORLD);
+        // p_hat = r_hat + beta * (p_hat - omega * s_hat)
+        // s = w + beta * (s - omega * z)
+        // z = t + beta * (z - omega * v), z_hat = D^-1 * z
+        // q = r - alpha * s
+        // y = w - alpha * z
+#pragma omp parallel for
+        for (i=0; i<n_dist; i++) {
+            double di = dinv[i];
+            p_hat[i] = di * r[i] + beta * (p_hat[i] - omega * (di * s[i]));
+            s[i] = w[i] + beta * (s[i] - omega * z[i]);
+            z[i] = t[i] + beta * (z[i] - omega * v[i]);
+            z_hat[i] = di * z[i];
+            q[i] = r[i] - alpha * s[i];
+            y[i] = w[i] - alpha * z[i];
+        }
 
-    // Creating the vectors
-    CreateDoubles (&sol1, dim);
-    CreateDoubles (&sol2, dim);
-    CreateDoubles (&sol1L, dimL);
-    CreateDoubles (&sol2L, dimL);
+        // omega = <q, y> / <y, y>, hidden behind v = A * z_hat
+        {
+            const double *dot_x[2] = {q, y}, *dot_y[2] = {y, y};
+            dots->Dots (n_dist, 2, dot_x, dot_y, 0);
+        }
+        dots->ReduceStart (req_pair);
 
-    InitDoubles (sol2, dim, 0.0, 0.0);
-    InitDoubles (sol1L, dimL, 0.0, 0.0);
-    InitDoubles (sol2L, dimL, 0.0, 0.0);
+        AllgathervStart (&gather_z); AllgathervWait (&gather_z);
+        InitDoubles (v, sizeR, DZERO, DZERO);
+        SPMV_SOLVER (matS, 0, aux, v);                                  // v = A * z_hat
 
-    /***************************************/
+        dots->ReduceEnd (req_pair, reduce);
+        omega = reduce[0] / reduce[1];
 
-    int IONE = 1;
-    double beta = 1.0 / sqrt(dim);
-    if(mat_from_file) {
-        // compute b = A * x_c, x_c = 1/sqrt(nbrows)
-        InitDoubles (sol1, dim, 1.0, 0.0);
-        ProdSparseMatrixVectorByRows (matL, 0, sol1, sol1L);            			// s = A * x
-        dscal (&dimL, &beta, sol1L, &IONE);                                         // s = beta * s
-    } else {
-        InitDoubles (sol1, dim, 0.0, 0.0);
+        // x += alpha * p_hat + omega * q_hat
+        // r = q - omega * y
+        // w = y - omega * (t - alpha * v), w_hat = D^-1 * w
+#pragma omp parallel for
+        for (i=0; i<n_dist; i++) {
+            double di = dinv[i];
+            x[i] += alpha * p_hat[i] + omega * (di * q[i]);
+            r[i] = q[i] - omega * y[i];
+            w[i] = y[i] - omega * (t[i] - alpha * v[i]);
+            w_hat[i] = di * w[i];
+        }
 
-        int k=0;
-        int *vptrM = matL.vptr;
-        for (int i=0; i < matL.dim1; i++) {
-            for(int j=vptrM[i]; j<vptrM[i+1]; j++) {
-                sol1L[k] += matL.vval[j];
-            }
+        // the sums of beta, alpha and the tolerance, hidden behind t = A * w_hat
+        // cannot just use <r0, r> as the stopping criteria since it slows the convergence compared to <r, r>
+        {
+            const double *dot_x[5] = {r0, r0, r0, r0, r}, *dot_y[5] = {r, w, s, z, r};
+            dots->Dots (n_dist, 5, dot_x, dot_y, 0);
         }
+#if DIRECT_ERROR
+        // x is final, its direct error goes in the same message
+        dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);               // res_err = x_exact
+        daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);             // res_err -= x
+        dots->Nrm2 (n_dist, res_err, 5);
+#endif // DIRECT_ERROR
+        dots->ReduceStart (req_sums);
+
+        AllgathervStart (&gather_w); AllgathervWait (&gather_w);
+        InitDoubles (t, sizeR, DZERO, DZERO);
+        SPMV_SOLVER (matS, 0, aux, t);                                  // t = A * w_hat
+
+        dots->ReduceEnd (req_sums, reduce);
+        tol = sqrt (reduce[4]) / tol0;
+#if DIRECT_ERROR
+        direct_err = dots->Nrm2Round (&reduce[5]);
+#endif // DIRECT_ERROR
+
+        // beta = (alpha / omega) * <r0, r+1> / <r0, r>
+        // alpha = <r0, r+1> / (<r0, w+1> + beta * <r0, s> - beta * omega * <r0, z>)
+        beta = (alpha / omega) * (reduce[0] / rho);
+        rho = reduce[0];
+        alpha = rho / (reduce[1] + beta * reduce[2] - beta * omega * reduce[3]);
+
+        iter++;
     }
 
-    MPI_Scatterv (sol2, vdimL, vdspL, MPI_DOUBLE, sol2L, dimL, MPI_DOUBLE, root, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t3, &t4);
+
+    if (myId == 0) {
+        printf ("Size: %d \n", n);
+        printf ("Iter: %d \n", iter);
+        printf ("Tol: %a \n", tol);
+        printf ("Time_loop: %20.10e\n", (t3-t1));
+        printf ("Time_iter: %20.10e\n", (t3-t1)/iter);
+        printf ("Dot: %s \n", dots->Name ());
+        printf ("Time_dot: %20.10e\n", dots->time_dot);
+        printf ("Time_reduce: %20.10e\n", dots->time_reduce);
+    }
 
-    BiCGStab (matL, sol2L, sol1L, vdimL, vdspL, myId);
+    AllgathervFree (&gather_z); AllgathervFree (&gather_w);
+    dots->ReduceFree (req_pair); dots->ReduceFree (req_sums);
 
-    // Error computation ||b-Ax||
-//    if(mat_from_file) {
-        MPI_Allgatherv (sol2L, dimL, MPI_DOUBLE, sol2, vdimL, vdspL, MPI_DOUBLE, MPI_COMM_WORLD);
-        InitDoubles (sol2L, dimL, 0, 0);
-        ProdSparseMatrixVectorByRows (matL, 0, sol2, sol2L);
-        double DMONE = -1.0;
-        daxpy (&dimL, &DMONE, sol2L, &IONE, sol1L, &IONE);          
-
-        // ReproAllReduce -- Begin
-        std::vector<int64_t> h_superacc(exblas::BIN_COUNT);
-        exblas::cpu::exdot (dimL, sol1L, sol1L, &h_superacc[0]);
-        int imin=exblas::IMIN, imax=exblas::IMAX;
-        exblas::cpu::Normalize(&h_superacc[0], imin, imax);
-        if (myId == 0) {
-            MPI_Reduce (MPI_IN_PLACE, &h_superacc[0], exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-        } else {
-            MPI_Reduce (&h_superacc[0], NULL, exblas::BIN_COUNT, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
-        }
-        if (myId == 0) {
-            beta = exblas::cpu::Round( &h_superacc[0] );
+    RemoveDoubles (&aux); RemoveDoubles (&r); RemoveDoubles (&r0); 
+    RemoveDoubles (&w); RemoveDoubles (&w_hat); RemoveDoubles (&t); RemoveDoubles (&p_hat);
+    RemoveDoubles (&s); RemoveDoubles (&z); RemoveDoubles (&z_hat); RemoveDoubles (&v);
+    RemoveDoubles (&q); RemoveDoubles (&y); RemoveDoubles (&diags);
+#if PRECOND
+    RemoveInts (&posd);
+#endif
+#if FLOAT_DIAG
+    RemoveFloats (&dinv);
+#endif
+#if DIRECT_ERROR
+    RemoveDoubles (&x_exact); RemoveDoubles (&res_err);
+#endif // DIRECT_ERROR
+#if FLOAT_MATRIX
+    RemoveSparseMatrixF (&matS);
+#endif
+}
+
+/*********************************************************************************/
+
+// T * v for the coefficients v of a vector in the monomial basis Y = [P, R]
+// of CABiCGStab (np columns of P then nr of R): the product by the matrix
+// shifts the coefficients of every block, the last ones must be zero
+static void ShiftBasis (int np, int nr, const double *v, double *tv) {
+    int i;
+    tv[0] = 0.0;
+    for (i=1; i<np; i++) tv[i] = v[i-1];
+    tv[np] = 0.0;
+    for (i=1; i<nr; i++) tv[np+i] = v[np+i-1];
+}
+
+// Dot product of the short vectors of coefficients, the same on every process
+static double CoefDot (int n, const double *u, const double *v) {
+    double sum = 0.0;
+    for (int i=0; i<n; i++) sum = fma (u[i], v[i], sum);
+    return sum;
+}
+
+// Communication-avoiding s-step BiCGStab (CA-BiCGStab of Carson, Knight and
+// Demmel). Every s iterations, a matrix powers kernel builds the monomial
+// bases of degree 2s of p and 2s-1 of r from one gather of both vectors, and
+// all the dots of the s iterations are taken from the Gram matrix of the basis
+// and r0, in one reduction; the iterations themselves only update the short
+// vectors of coefficients. The Jacobi preconditioner is folded into the
+// columns of the kernel, which keeps the matrix in double (FLOAT_MATRIX and
+// FLOAT_DIAG do not apply). The dots of the Gram matrix are the reproducible ones
+// of the backend, and the kernel gives the same products on any number of
+// processes, so the results stay reproducible. The tolerance inside a block
+// is the estimate rc^T G rc, which cancels as the residual drops; a block
+// ends early when it falls below the threshold (or is not positive), and
+// convergence is only decided on the true <r, r> of the next Gram matrix.
+// The monomial basis loses accuracy quickly as s grows: small values (2 to
+// 4) are the useful ones. Larger ones end most blocks early, and the r of
+// the recurrences drifts from b - A x (s = 8 on cd60 stops with a direct
+// error a hundred times that of s = 2).
+void CABiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, int myId, DotBackend *dots) {
+    int size = mat.dim2, sizeR = mat.dim1; 
+    double DONE = 1.0, DZERO = 0.0;
+    int i, j, k, n, n_dist, iter, maxiter, nProcs;
+    int s = sstep, np = 2 * s + 1, nr = 2 * s, ny = np + nr;
+    double beta, tol, tol0, alpha, umbral, omega, rho, tmp, est;
+    double *r = NULL, *r0 = NULL, *p = NULL, *Ybuf = NULL, *diags = NULL;
+    double *auxP = NULL, *auxR = NULL, *work = NULL;
+    double t1, t2, t3, t4;
+    AllgathervPlan gather_p, gather_r;
+    MatrixPowers mp;
+    // coefficients in the basis, Gram matrix G = Y^T Y and g = Y^T r0
+    std::vector<double> pc (ny), rc (ny), xc (ny), qc (ny), tp (ny), tq (ny), gtq (ny), G (ny * ny), g (ny);
+    std::vector<double *> Y (ny), vecs (np);
+    std::vector<const double *> W (ny + 1);
+    // the Gram matrix is reduced by blocks of 4 rows, on the columns from the block on
+    std::vector<int> block_slot;
+    int num_sums = 0;
+    for (i=0; i<ny; i+=4) {
+        block_slot.push_back (num_sums);
+        num_sums += std::min (4, ny - i) * (ny + 1 - i);
+    }
+#if DIRECT_ERROR
+    // the direct error of x at the start of every block of s iterations
+    int IONE = 1, err_slot = num_sums;
+    double DMONE = -1.0, *res_err = NULL, *x_exact = NULL, direct_err;
+    num_sums += dots->Nrm2Slots ();
+#endif // DIRECT_ERROR 
+    std::vector<double> sums (std::max (num_sums, DOT_SLOTS));
+    int *posd = NULL;
+
+    MPI_Comm_size(MPI_COMM_WORLD, &nProcs);
+    n = size; n_dist = sizeR; maxiter = 16 * size; umbral = 1.0e-8;
+    CreateDoubles (&r, n_dist);
+    CreateDoubles (&r0, n_dist);
+    CreateDoubles (&p, n_dist);
+    CreateDoubles (&Ybuf, ny * n_dist);
+#if DIRECT_ERROR
+    // init exact solution
+    CreateDoubles (&x_exact, n_dist);
+    CreateDoubles (&res_err, n_dist);
+    InitDoubles (x_exact, n_dist, DONE, DZERO);
+#endif // DIRECT_ERROR 
+    for (k=0; k<ny; k++) {
+        Y[k] = Ybuf + k * n_dist; W[k] = Y[k];
+    }
+    W[ny] = r0;
+    CreateDoubles (&auxP, n);
+    CreateDoubles (&auxR, n);
+    CreateDoubles (&work, (np - 1) * n);
+    vecs[0] = auxP;
+    for (k=1; k<np; k++)
+        vecs[k] = work + (k - 1) * n;
+
+    // kernel of depth 2s on A * D^-1, with the whole inverse diagonal
+    CreateMatrixPowers (mat, sizes, dspls, 2 * s, MPI_COMM_WORLD, &mp);
+    CreateDoubles (&diags, n_dist);
+#if PRECOND
+    CreateInts (&posd, n_dist);
+    GetDiagonalSparseMatrix2 (mat, dspls[myId], diags, posd);
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++) 
+        diags[i] = DONE / diags[i];
+    MPI_Allgatherv (diags, sizeR, MPI_DOUBLE, auxP, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+    ScaleMatrixPowers (&mp, auxP);
+#else
+    InitDoubles (diags, n_dist, DONE, DZERO);
+#endif
+    dots->Reserve (num_sums);
+
+    AllgathervInit (p, sizeR, auxP, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_p);
+    AllgathervInit (r, sizeR, auxR, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_r);
+
+    iter = 0;
+    MPI_Allgatherv (x, sizeR, MPI_DOUBLE, auxR, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+    InitDoubles (p, sizeR, DZERO, DZERO);
+    SPMV (mat, 0, auxR, p);                                             // p = A * x
+
+    // r = b - p and <r0,r0>, p = r0 = r
+    {
+        const double *dot_w[1] = {r};
+        dots->AxpyDots (n_dist, -DONE, p, b, r, 1, dot_w, 0);
+    }
+    dots->Reduce (1, &rho);
+    CopyDoubles (r, p, n_dist);
+    CopyDoubles (r, r0, n_dist);
+    tol0 = sqrt (rho);
+    tol = tol0;
+#if DIRECT_ERROR
+    direct_err = 0.0;
+#endif // DIRECT_ERROR
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t1, &t2);
+
+    while ((iter < maxiter) && (tol > umbral)) {
+
+        // Y = [p, A p, .., A^2s p, r, A r, .., A^2s-1 r], from one gather of p and r
+        AllgathervStart (&gather_p); AllgathervStart (&gather_r);
+        AllgathervWait (&gather_p); AllgathervWait (&gather_r);
+        vecs[0] = auxP;
+        ProdMatrixPowers (mp, np - 1, vecs.data(), SPMV);
+        for (k=0; k<np; k++)
+            CopyDoubles (vecs[k] + dspls[myId], Y[k], n_dist);
+        vecs[0] = auxR;
+        ProdMatrixPowers (mp, nr - 1, vecs.data(), SPMV);
+        for (k=0; k<nr; k++)
+            CopyDoubles (vecs[k] + dspls[myId], Y[np+k], n_dist);
+
+        // G = Y^T Y and g = Y^T r0 in one reduction, the lower blocks come from the upper ones
+        for (i=0; i<ny; i+=4)
+            dots->Gram (n_dist, std::min (4, ny - i), &W[i], ny + 1 - i, &W[i], block_slot[i/4]);
+#if DIRECT_ERROR
+        // direct error ||x_exact - x||, reduced with the Gram matrix
+        dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);               // res_err = x_exact
+        daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);             // res_err -= x
+        dots->Nrm2 (n_dist, res_err, err_slot);
+#endif // DIRECT_ERROR
+        dots->Reduce (num_sums, sums.data());
+        for (i=0; i<ny; i+=4) {
+            int kv = std::min (4, ny - i), kw = ny + 1 - i;
+            for (int ii=0; ii<kv; ii++)
+                for (j=0; j<kw; j++) {
+                    double val = sums[block_slot[i/4] + ii * kw + j];
+                    if (i + j == ny)
+                        g[i+ii] = val;
+                    else
+                        G[(i+ii)*ny+i+j] = G[(i+j)*ny+i+ii] = val;
+                }
+        }
+#if DIRECT_ERROR
+        direct_err = dots->Nrm2Round (&sums[err_slot]);
+#endif // DIRECT_ERROR
+
+        // the true tolerance, r is the column 2s+1 of the basis
+        tol = sqrt (G[np*ny+np]) / tol0;
+        if (tol <= umbral)
+            break;
+
+        // p = Y e_0, r = Y e_2s+1, x = x + D^-1 * Y xc
+        std::fill (pc.begin(), pc.end(), DZERO); pc[0] = DONE;
+        std::fill (rc.begin(), rc.end(), DZERO); rc[np] = DONE;
+        std::fill (xc.begin(), xc.end(), DZERO);
+        rho = CoefDot (ny, g.data(), rc.data());
+
+        for (j=0; (j<s) && (iter < maxiter); j++) {
+            if (myId == 0) 
+#if DIRECT_ERROR
+                printf ("%d \t %a \t %a \n", iter, tol, direct_err);
+#else        
+            printf ("%d \t %a \n", iter, tol);
+#endif // DIRECT_ERROR
+
+            // alpha = <r0, r> / <r0, A p>
+            ShiftBasis (np, nr, pc.data(), tp.data());
+            alpha = rho / CoefDot (ny, g.data(), tp.data());
+
+            // q = r - alpha * A p, omega = <q, A q> / <A q, A q>
+            for (i=0; i<ny; i++) qc[i] = rc[i] - alpha * tp[i];
+            ShiftBasis (np, nr, qc.data(), tq.data());
+            for (i=0; i<ny; i++) gtq[i] = CoefDot (ny, &G[i*ny], tq.data());
+            omega = CoefDot (ny, qc.data(), gtq.data()) / CoefDot (ny, tq.data(), gtq.data());
+
+            // x += alpha * p + omega * q, r = q - omega * A q
+            for (i=0; i<ny; i++) {
+                xc[i] += alpha * pc[i] + omega * qc[i];
+                rc[i] = qc[i] - omega * tq[i];
+            }
+
+            // beta = (alpha / omega) * <r0, r+1> / <r0, r>, p = r + beta * (p - omega * A p)
+            tmp = CoefDot (ny, g.data(), rc.data());
+            beta = (alpha / omega) * (tmp / rho);
+            rho = tmp;
+            for (i=0; i<ny; i++) pc[i] = rc[i] + beta * (pc[i] - omega * tp[i]);
+
+            // ||r||^2 estimated as rc^T G rc, below the threshold the next
+            // Gram matrix decides
+            for (i=0; i<ny; i++) gtq[i] = CoefDot (ny, &G[i*ny], rc.data());
+            est = CoefDot (ny, rc.data(), gtq.data());
+
+            iter++;
+            if (est <= umbral * umbral * tol0 * tol0)
+                break;
+            tol = sqrt (est) / tol0;
+        }
+
+        // back from the coefficients to the vectors
+#pragma omp parallel for private(k)
+        for (i=0; i<n_dist; i++) {
+            double xi = 0.0, ri = 0.0, pi = 0.0;
+            for (k=0; k<ny; k++) {
+                double yk = Y[k][i];
+                xi = fma (xc[k], yk, xi); ri = fma (rc[k], yk, ri); pi = fma (pc[k], yk, pi);
+            }
+            x[i] = fma (diags[i], xi, x[i]);
+            r[i] = ri; p[i] = pi;
+        }
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t3, &t4);
+
+    if (myId == 0) {
+        printf ("Size: %d \n", n);
+        printf ("Iter: %d \n", iter);
+        printf ("Tol: %a \n", tol);
+        printf ("Time_loop: %20.10e\n", (t3-t1));
+        printf ("Time_iter: %20.10e\n", (t3-t1)/iter);
+        printf ("Dot: %s \n", dots->Name ());
+        printf ("Time_dot: %20.10e\n", dots->time_dot);
+        printf ("Time_reduce: %20.10e\n", dots->time_reduce);
+    }
+
+    AllgathervFree (&gather_p); AllgathervFree (&gather_r);
+    RemoveMatrixPowers (&mp);
+
+    RemoveDoubles (&r); RemoveDoubles (&r0); RemoveDoubles (&p); RemoveDoubles (&Ybuf);
+    RemoveDoubles (&auxP); RemoveDoubles (&auxR); RemoveDoubles (&work); RemoveDoubles (&diags);
+#if PRECOND
+    RemoveInts (&posd);
+#endif
+#if DIRECT_ERROR
+    RemoveDoubles (&x_exact); RemoveDoubles (&res_err);
+#endif // DIRECT_ERROR
+}
+
+/*********************************************************************************/
+
+// Improved BiCGStab of Yang and Brent, with one global synchronization per
+// iteration. The products u = A r and q = A v, and f0 = A^T r0 computed once,
+// give all the scalars of BiCGStab from the dots of s and t, which are
+// reduced together with <r, r> in one message. The tolerance is that true
+// norm of the r at the start of the iteration, so the test is one reduction
+// late and x is only updated once it has failed. The
+// Jacobi preconditioner is applied on the right (the operator is A * D^-1),
+// f0 comes from the rows of A^T, built from the distributed matrix. The dots
+// are the reproducible ones of the backend, but the scalars come from
+// recurrences, so the iterations differ from BiCGStab.
+void IBiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, int myId, DotBackend *dots) {
+    int size = mat.dim2, sizeR = mat.dim1; 
+    double DONE = 1.0, DZERO = 0.0;
+    int i, n, n_dist, iter, maxiter, nProcs;
+    double beta, tol, tol0, alpha, umbral, rho, omega, sigma, tau, pi, tmp;
+    double *r = NULL, *r0 = NULL, *f0 = NULL, *u = NULL, *p = NULL, *v = NULL, *q = NULL;
+    double *s = NULL, *t = NULL, *aux = NULL, *diags = NULL;
+    double t1, t2, t3, t4;
+    int req, req_sums;
+    SparseMatrix matT;
+    AllgathervPlan gather_r, gather_v;
+    // <r0, s>, <r0, q>, <f0, s>, <f0, t>, <s, t>, <t, t>, <r, r> and the direct error
+#if DIRECT_ERROR
+    int num_sums = 7 + dots->Nrm2Slots ();
+#else
+    int num_sums = 7;
+#endif
+    std::vector<double> reduce (num_sums);
+#if PRECOND
+    int *posd = NULL;
+#endif
+#if FLOAT_DIAG
+    float *dinv = NULL;
+#else
+    double *dinv = NULL;
+#endif
+#if FLOAT_MATRIX
+    SparseMatrixF matS;
+    CreateSparseMatrixF (mat, &matS);
+#else
+    SparseMatrix matS = mat;
+#endif
+
+    MPI_Comm_size(MPI_COMM_WORLD, &nProcs);
+    n = size; n_dist = sizeR; maxiter = 16 * size; umbral = 1.0e-8;
+    CreateDoubles (&r, n_dist);
+    CreateDoubles (&r0, n_dist);
+    CreateDoubles (&f0, n_dist);
+    CreateDoubles (&u, n_dist);
+    CreateDoubles (&p, n_dist);
+    CreateDoubles (&v, n_dist);
+    CreateDoubles (&q, n_dist);
+    CreateDoubles (&s, n_dist);
+    CreateDoubles (&t, n_dist);
+#if DIRECT_ERROR
+    // init exact solution
+    int IONE = 1;
+    double DMONE = -1.0, *res_err = NULL, *x_exact = NULL, direct_err;
+    CreateDoubles (&x_exact, n_dist);
+    CreateDoubles (&res_err, n_dist);
+    InitDoubles (x_exact, n_dist, DONE, DZERO);
+#endif // DIRECT_ERROR 
+
+    // inverse of the Jacobi diagonal, ones without preconditioner
+    CreateDoubles (&diags, n_dist);
+#if PRECOND
+    CreateInts (&posd, n_dist);
+    GetDiagonalSparseMatrix2 (mat, dspls[myId], diags, posd);
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++) 
+        diags[i] = DONE / diags[i];
+#else
+    InitDoubles (diags, n_dist, DONE, DZERO);
+#endif
+#if FLOAT_DIAG
+    CreateFloats (&dinv, n_dist);
+    CopyDoublesToFloats (diags, dinv, n_dist);
+#else
+    dinv = diags;
+#endif
+    CreateDoubles (&aux, n); 
+    dots->Reserve (num_sums);
+
+    // the products by A * D^-1 are on s and t, as D^-1 * r and D^-1 * v
+    AllgathervInit (s, sizeR, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_r);
+    AllgathervInit (t, sizeR, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_v);
+
+    iter = 0;
+    MPI_Allgatherv (x, sizeR, MPI_DOUBLE, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+    InitDoubles (s, sizeR, DZERO, DZERO);
+    SPMV_SOLVER (matS, 0, aux, s);                                      // s = A * x
+
+    // r = b - s, r0 = r
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++) {
+        r[i] = b[i] - s[i];
+        r0[i] = r[i];
+        s[i] = dinv[i] * r[i];
+    }
+    AllgathervStart (&gather_r); AllgathervWait (&gather_r);
+    InitDoubles (u, sizeR, DZERO, DZERO);
+    SPMV_SOLVER (matS, 0, aux, u);                                      // u = A * D^-1 * r
+
+    // f0 = (A * D^-1)^T * r0 = D^-1 * A^T * r0
+    MPI_Allgatherv (r0, sizeR, MPI_DOUBLE, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+    // A^T is transposed from the double matrix and rounded as matS, which
+    // gives the transpose of matS, so f0 uses the same product as the others
+    TransposeDistributedMatrix (mat, sizes, dspls, &matT, MPI_COMM_WORLD);
+#if FLOAT_MATRIX
+    SparseMatrixF matTS;
+    CreateSparseMatrixF (matT, &matTS);
+#else
+    SparseMatrix matTS = matT;
+#endif
+    InitDoubles (f0, sizeR, DZERO, DZERO);
+    SPMV_SOLVER (matTS, 0, aux, f0);
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++)
+        f0[i] *= dinv[i];
+#if FLOAT_MATRIX
+    RemoveSparseMatrixF (&matTS);
+#endif
+    RemoveSparseMatrix (&matT);
+
+    // rho = <r0, r0> and sigma = <r0, u>
+    {
+        const double *dot_x[2] = {r0, r0}, *dot_y[2] = {r, u};
+        dots->Dots (n_dist, 2, dot_x, dot_y, 0);
+    }
+#if DIRECT_ERROR
+    // direct error ||x_exact - x||, reduced with rho
+    dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);                    // res_err = x_exact
+    daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);                  // res_err -= x
+    dots->Nrm2 (n_dist, res_err, 2);
+    req = dots->ReduceBegin (2 + dots->Nrm2Slots ());
+#else
+    req = dots->ReduceBegin (2);
+#endif // DIRECT_ERROR
+    InitDoubles (p, n_dist, DZERO, DZERO);
+    InitDoubles (v, n_dist, DZERO, DZERO);
+    InitDoubles (q, n_dist, DZERO, DZERO);
+    dots->ReduceEnd (req, reduce.data());
+    rho = reduce[0];
+    sigma = reduce[1];
+    tol0 = sqrt (rho);
+    tol = tol0;
+#if DIRECT_ERROR
+    direct_err = dots->Nrm2Round (&reduce[2]);
+#endif // DIRECT_ERROR
+    alpha = DZERO; beta = DZERO; omega = DZERO; tau = DZERO; pi = DZERO;
+
+    req_sums = dots->ReduceInit (num_sums);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t1, &t2);
+
+    while ((iter < maxiter) && (tol > umbral)) {
+
+        // p = r + beta * (p - omega * v)
+        // v = u + beta * (v - omega * q) = A * D^-1 * p
+        // tau = <r0, v> and alpha = rho / tau
+        tau = sigma + beta * (tau - omega * pi);
+        alpha = rho / tau;
+#pragma omp parallel for
+        for (i=0; i<n_dist; i++) {
+            p[i] = r[i] + beta * (p[i] - omega * v[i]);
+            v[i] = u[i] + beta * (v[i] - omega * q[i]);
+            t[i] = dinv[i] * v[i];
+        }
+        AllgathervStart (&gather_v); AllgathervWait (&gather_v);
+        InitDoubles (q, sizeR, DZERO, DZERO);
+        SPMV_SOLVER (matS, 0, aux, q);                                  // q = A * D^-1 * v
+
+        // s = r - alpha * v, t = A * D^-1 * s = u - alpha * q
+#pragma omp parallel for
+        for (i=0; i<n_dist; i++) {
+            s[i] = r[i] - alpha * v[i];
+            t[i] = u[i] - alpha * q[i];
+        }
+
+        // all the sums of the iteration and the norm of r in one reduction
+        {
+            const double *dot_x[7] = {r0, r0, f0, f0, s, t, r}, *dot_y[7] = {s, q, s, t, t, t, r};
+            dots->Dots (n_dist, 7, dot_x, dot_y, 0);
+        }
+#if DIRECT_ERROR
+        // direct error of the x of the previous iteration
+        dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);               // res_err = x_exact
+        daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);             // res_err -= x
+        dots->Nrm2 (n_dist, res_err, 7);
+#endif // DIRECT_ERROR
+        dots->ReduceStart (req_sums);
+        dots->ReduceEnd (req_sums, reduce.data());
+
+        // true tolerance of r, x is still the one of r
+        tol = sqrt (reduce[6]) / tol0;
+#if DIRECT_ERROR
+        direct_err = dots->Nrm2Round (&reduce[7]);
+#endif // DIRECT_ERROR
+        if (tol <= umbral)
+            break;
+        if (myId == 0) 
+#if DIRECT_ERROR
+            printf ("%d \t %a \t %a \n", iter, tol, direct_err);
+#else        
+            printf ("%d \t %a \n", iter, tol);
+#endif // DIRECT_ERROR
+
+        // omega = <s, t> / <t, t>
+        omega = reduce[4] / reduce[5];
+        pi = reduce[1];
+
+        // x += alpha * D^-1 * p + omega * D^-1 * s, r = s - omega * t, with the product u = A * D^-1 * r
+#pragma omp parallel for
+        for (i=0; i<n_dist; i++) {
+            x[i] += alpha * (dinv[i] * p[i]);
+            x[i] += omega * (dinv[i] * s[i]);
+            r[i] = s[i] - omega * t[i];
+            s[i] = dinv[i] * r[i];
+        }
+        AllgathervStart (&gather_r); AllgathervWait (&gather_r);
+        InitDoubles (u, sizeR, DZERO, DZERO);
+        SPMV_SOLVER (matS, 0, aux, u);                                  // u = A * D^-1 * r
+
+        // <r0, r+1> = <r0, s> - omega * (sigma - alpha * pi), since <r0, t> = <r0, u> - alpha * <r0, q>
+        // sigma = <r0, u+1> = <f0, r+1> = <f0, s> - omega * <f0, t>
+        tmp = reduce[0] - omega * (sigma - alpha * pi);
+        sigma = reduce[2] - omega * reduce[3];
+
+        // beta = (alpha / omega) * <r0, r+1> / <r0, r>
+        beta = (alpha / omega) * (tmp / rho);
+        rho = tmp;
+
+        iter++;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t3, &t4);
+
+    if (myId == 0) {
+        printf ("Size: %d \n", n);
+        printf ("Iter: %d \n", iter);
+        printf ("Tol: %a \n", tol);
+        printf ("Time_loop: %20.10e\n", (t3-t1));
+        printf ("Time_iter: %20.10e\n", (t3-t1)/iter);
+        printf ("Dot: %s \n", dots->Name ());
+        printf ("Time_dot: %20.10e\n", dots->time_dot);
+        printf ("Time_reduce: %20.10e\n", dots->time_reduce);
+    }
+
+    AllgathervFree (&gather_r); AllgathervFree (&gather_v);
+    dots->ReduceFree (req_sums);
+
+    RemoveDoubles (&aux); RemoveDoubles (&r); RemoveDoubles (&r0); RemoveDoubles (&f0);
+    RemoveDoubles (&u); RemoveDoubles (&p); RemoveDoubles (&v); RemoveDoubles (&q);
+    RemoveDoubles (&s); RemoveDoubles (&t); RemoveDoubles (&diags);
+#if PRECOND
+    RemoveInts (&posd);
+#endif
+#if FLOAT_DIAG
+    RemoveFloats (&dinv);
+#endif
+#if DIRECT_ERROR
+    RemoveDoubles (&x_exact); RemoveDoubles (&res_err);
+#endif // DIRECT_ERROR
+#if FLOAT_MATRIX
+    RemoveSparseMatrixF (&matS);
+#endif
+}
+
+/*********************************************************************************/
+
+#if DIRECT_ERROR
+// Local parts of the direct errors ||x_exact - x|| of the columns act[0..na)
+// of the row-major block x, in the slots from slot on (Nrm2Slots each). The
+// exact solution is ones for the first right-hand side, as in the other
+// solvers, and x_j(i) = (1 + j*i/n) / sqrt(n) for the others (see main).
+static void BlockDirectErrors (int n_dist, int k, int n, int first_row, const double *x, int na, const int *act,
+                               double *res_err, DotBackend *dots, int slot) {
+    double scale = 1.0 / sqrt (n);
+    int i, c, j;
+    for (c=0; c<na; c++) {
+        j = act[c];
+#pragma omp parallel for
+        for (i=0; i<n_dist; i++)
+            res_err[i] = ((j == 0) ? 1.0 : scale * (1.0 + (double) j * (first_row + i) / n)) - x[i*k+j];
+        dots->Nrm2 (n_dist, res_err, slot + c * dots->Nrm2Slots ());
+    }
+}
+#endif // DIRECT_ERROR
+
+// Block BiCGStab for k = nrhs right-hand sides at once: x and b are row-major
+// blocks of n_dist x k values (the k values of every row together). Every
+// right-hand side follows the recurrences of BiCGStab with its own scalars,
+// but the products by the matrix are products by the whole block
+// (ProdSparseMatrixBlockByRows), which read the matrix once for the k
+// vectors, and the dots of the k columns at each step go to one reduction.
+// The vectors of the iteration are stored by columns, so the dots work on
+// contiguous vectors; the preconditioned directions are written by rows for
+// the gather and the product. A column is no longer updated once it reaches
+// the tolerance, and the loop ends when all of them have: the directions,
+// the products and the reductions then only cover the na columns left, so
+// the persistent handles and gathers are rebuilt when na drops. The matrix is
+// always the double one (FLOAT_MATRIX and EXACT_SPMV do not apply). With
+// DIRECT_ERROR the largest direct error of the columns is printed with the
+// tolerance, see BlockDirectErrors.
+void BlockBiCGStab (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, int myId, DotBackend *dots) {
+    int size = mat.dim2, sizeR = mat.dim1, k = nrhs;
+    double DONE = 1.0, DZERO = 0.0;
+    int i, j, c, n, n_dist, iter, maxiter, nProcs, na, nk;
+    double tol, umbral;
+    double *r = NULL, *r0 = NULL, *p = NULL, *s = NULL, *q = NULL, *y = NULL;
+    double *p_hat = NULL, *q_hat = NULL, *prod = NULL;
+    double *aux = NULL, *diags = NULL;
+    double t1, t2, t3, t4;
+    int req, req_alpha, req_pair, req_tol;
+    AllgathervPlan gather_p, gather_q;
+#if PRECOND
+    int *posd = NULL;
+#endif
+#if FLOAT_DIAG
+    float *dinv = NULL;
+#else
+    double *dinv = NULL;
+#endif
+    // scalars of every column, and the columns still updated
+    std::vector<double> alpha (k), omega (k), beta (k), rho (k), tol0 (k), tolk (k);
+    std::vector<int> act (k);
+    // one or two sums of every column in each reduction, the ones of the
+    // tolerance followed by the direct errors
+#if DIRECT_ERROR
+    int err_slots = dots->Nrm2Slots ();
+    double direct_err = 0.0;
+    double *res_err = NULL;
+    std::vector<double> errk (k);
+#else
+    int err_slots = 0;
+#endif
+    std::vector<double> reduce ((2 + err_slots) * k);
+    std::vector<const double *> dot_x (2 * k), dot_y (2 * k);
+
+    MPI_Comm_size(MPI_COMM_WORLD, &nProcs);
+    n = size; n_dist = sizeR; maxiter = 16 * size; umbral = 1.0e-8;
+    CreateDoubles (&r, n_dist * k);
+    CreateDoubles (&r0, n_dist * k);
+    CreateDoubles (&p, n_dist * k);
+    CreateDoubles (&s, n_dist * k);
+    CreateDoubles (&q, n_dist * k);
+    CreateDoubles (&y, n_dist * k);
+    CreateDoubles (&p_hat, n_dist * k);
+    CreateDoubles (&q_hat, n_dist * k);
+    CreateDoubles (&prod, n_dist * k);
+
+    // inverse of the Jacobi diagonal, ones without preconditioner
+    CreateDoubles (&diags, n_dist);
+#if PRECOND
+    CreateInts (&posd, n_dist);
+    GetDiagonalSparseMatrix2 (mat, dspls[myId], diags, posd);
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++) 
+        diags[i] = DONE / diags[i];
+#else
+    InitDoubles (diags, n_dist, DONE, DZERO);
+#endif
+#if FLOAT_DIAG
+    CreateFloats (&dinv, n_dist);
+    CopyDoublesToFloats (diags, dinv, n_dist);
+#else
+    dinv = diags;
+#endif
+    CreateDoubles (&aux, n * k); 
+#if DIRECT_ERROR
+    CreateDoubles (&res_err, n_dist);
+#endif // DIRECT_ERROR
+
+    // the rows of every process are contiguous in the row-major blocks
+    std::vector<int> sizesK (nProcs), dsplsK (nProcs);
+    for (i=0; i<nProcs; i++) {
+        sizesK[i] = sizes[i] * k; dsplsK[i] = dspls[i] * k;
+    }
+    dots->Reserve ((2 + err_slots) * k);
+
+    iter = 0;
+    MPI_Allgatherv (x, sizeR * k, MPI_DOUBLE, aux, sizesK.data(), dsplsK.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+    InitDoubles (prod, sizeR * k, DZERO, DZERO);
+    ProdSparseMatrixBlockByRows (mat, 0, k, aux, prod);                 // prod = A * x
+
+    // r = b - A * x by columns, and <r0,r0> of every column
+#pragma omp parallel for private(j)
+    for (i=0; i<n_dist; i++)
+        for (j=0; j<k; j++)
+            r[j*n_dist+i] = b[i*k+j] - prod[i*k+j];
+    for (j=0; j<k; j++) {
+        dot_x[j] = r + j*n_dist; dot_y[j] = r + j*n_dist;
+    }
+    dots->Dots (n_dist, k, dot_x.data(), dot_y.data(), 0);
+    for (j=0; j<k; j++)
+        act[j] = j;
+#if DIRECT_ERROR
+    BlockDirectErrors (n_dist, k, n, dspls[myId], x, k, act.data(), res_err, dots, k);
+#endif // DIRECT_ERROR
+    req = dots->ReduceBegin ((1 + err_slots) * k);
+
+    CopyDoubles (r, p, n_dist * k);                                     // p = r
+    CopyDoubles (r, r0, n_dist * k);                                    // r0 = r
+
+    dots->ReduceEnd (req, reduce.data());
+    for (j=0; j<k; j++) {
+        rho[j] = reduce[j];
+        tol0[j] = sqrt (rho[j]);
+        tolk[j] = 1.0;
+#if DIRECT_ERROR
+        errk[j] = dots->Nrm2Round (&reduce[k + j*err_slots]);
+#endif // DIRECT_ERROR
+    }
+    tol = 1.0;
+#if DIRECT_ERROR
+    direct_err = *std::max_element (errk.begin(), errk.end());
+#endif // DIRECT_ERROR
+
+    nk = 0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t1, &t2);
+
+    while ((iter < maxiter) && (tol > umbral)) {
+        // columns that have not reached the tolerance, the same on all processes
+        for (j=0, na=0; j<k; j++)
+            if (tolk[j] > umbral)
+                act[na++] = j;
+        // reductions and gathers of the na columns left, p_hat, q_hat and
+        // prod hold na values per row
+        if (na != nk) {
+            if (nk > 0) {
+                AllgathervFree (&gather_p); AllgathervFree (&gather_q);
+                dots->ReduceFree (req_alpha); dots->ReduceFree (req_pair); dots->ReduceFree (req_tol);
+            }
+            for (i=0; i<nProcs; i++) {
+                sizesK[i] = sizes[i] * na; dsplsK[i] = dspls[i] * na;
+            }
+            AllgathervInit (p_hat, sizeR * na, aux, sizesK.data(), dsplsK.data(), MPI_DOUBLE, MPI_COMM_WORLD, &gather_p);
+            AllgathervInit (q_hat, sizeR * na, aux, sizesK.data(), dsplsK.data(), MPI_DOUBLE, MPI_COMM_WORLD, &gather_q);
+            req_alpha = dots->ReduceInit (na);
+            req_pair = dots->ReduceInit (2 * na);
+            req_tol = dots->ReduceInit ((2 + err_slots) * na);
+            nk = na;
+        }
+
+        // p_hat = D^-1 * p by rows, then s = A * p_hat
+#pragma omp parallel for private(c)
+        for (i=0; i<n_dist; i++)
+            for (c=0; c<na; c++)
+                p_hat[i*na+c] = dinv[i] * p[act[c]*n_dist+i];
+        AllgathervStart (&gather_p); AllgathervWait (&gather_p);
+        InitDoubles (prod, sizeR * na, DZERO, DZERO);
+        ProdSparseMatrixBlockByRows (mat, 0, na, aux, prod);
+#pragma omp parallel for private(c)
+        for (i=0; i<n_dist; i++)
+            for (c=0; c<na; c++)
+                s[act[c]*n_dist+i] = prod[i*na+c];
+
+        if (myId == 0) 
+#if DIRECT_ERROR
+            printf ("%d \t %a \t %a \n", iter, tol, direct_err);
+#else
+            printf ("%d \t %a \n", iter, tol);
+#endif // DIRECT_ERROR
+
+        // alpha = <r_0, r_iter> / <r_0, s>
+        for (c=0; c<na; c++) {
+            dot_x[c] = r0 + act[c]*n_dist; dot_y[c] = s + act[c]*n_dist;
+        }
+        dots->Dots (n_dist, na, dot_x.data(), dot_y.data(), 0);
+        dots->ReduceStart (req_alpha);
+
+        // overlap the reduction with the copy q = r, as in BiCGStab
+        for (c=0; c<na; c++)
+            CopyDoubles (r + act[c]*n_dist, q + act[c]*n_dist, n_dist);
+
+        dots->ReduceEnd (req_alpha, reduce.data());
+        for (c=0; c<na; c++)
+            alpha[act[c]] = rho[act[c]] / reduce[c];
+
+        // q = r - alpha * s; q_hat = D^-1 * q by rows, then y = A * q_hat
+#pragma omp parallel for private(c, j)
+        for (i=0; i<n_dist; i++)
+            for (c=0; c<na; c++) {
+                j = act[c];
+                q[j*n_dist+i] = fma (-alpha[j], s[j*n_dist+i], q[j*n_dist+i]);
+                q_hat[i*na+c] = dinv[i] * q[j*n_dist+i];
+            }
+        AllgathervStart (&gather_q); AllgathervWait (&gather_q);
+        InitDoubles (prod, sizeR * na, DZERO, DZERO);
+        ProdSparseMatrixBlockByRows (mat, 0, na, aux, prod);
+#pragma omp parallel for private(c)
+        for (i=0; i<n_dist; i++)
+            for (c=0; c<na; c++)
+                y[act[c]*n_dist+i] = prod[i*na+c];
+
+        // omega = <q, y> / <y, y>
+        for (c=0; c<na; c++) {
+            dot_x[2*c] = q + act[c]*n_dist; dot_y[2*c] = y + act[c]*n_dist;
+            dot_x[2*c+1] = y + act[c]*n_dist; dot_y[2*c+1] = y + act[c]*n_dist;
+        }
+        dots->Dots (n_dist, 2 * na, dot_x.data(), dot_y.data(), 0);
+        dots->ReduceStart (req_pair);
+
+        // overlap the reduction with the work that does not depend on omega
+#pragma omp parallel for private(c, j)
+        for (i=0; i<n_dist; i++)
+            for (c=0; c<na; c++) {
+                j = act[c];
+                x[i*k+j] += alpha[j] * p_hat[i*na+c];                    // x += alpha * p_hat
+            }
+
+        dots->ReduceEnd (req_pair, reduce.data());
+        for (c=0; c<na; c++)
+            omega[act[c]] = reduce[2*c] / reduce[2*c+1];
+
+        // x+1 = x + alpha * p + omega * q
+#pragma omp parallel for private(c, j)
+        for (i=0; i<n_dist; i++)
+            for (c=0; c<na; c++) {
+                j = act[c];
+                x[i*k+j] += omega[j] * q_hat[i*na+c];
+            }
+
+        // r+1 = q - omega * y, with rho = <r0, r+1> and tolerance in the same pass
+        for (c=0; c<na; c++) {
+            j = act[c];
+            const double *dot_w[2] = {r0 + j*n_dist, r + j*n_dist};
+            dots->AxpyDots (n_dist, -omega[j], y + j*n_dist, q + j*n_dist, r + j*n_dist, 2, dot_w, 2*c);
+        }
+#if DIRECT_ERROR
+        // x is final, its direct errors go in the same message
+        BlockDirectErrors (n_dist, k, n, dspls[myId], x, na, act.data(), res_err, dots, 2*na);
+#endif // DIRECT_ERROR
+        dots->ReduceStart (req_tol);
+
+        // p+1 = r+1 + beta * (p - omega * s), the part before beta is known
+#pragma omp parallel for private(c, j)
+        for (i=0; i<n_dist; i++)
+            for (c=0; c<na; c++) {
+                j = act[c];
+                p[j*n_dist+i] = fma (-omega[j], s[j*n_dist+i], p[j*n_dist+i]);
+            }
+
+        dots->ReduceEnd (req_tol, reduce.data());
+        for (c=0; c<na; c++) {
+            j = act[c];
+            tolk[j] = sqrt (reduce[2*c+1]) / tol0[j];
+            // beta = (alpha / omega) * <r0, r+1> / <r0, r>
+            beta[j] = (alpha[j] / omega[j]) * (reduce[2*c] / rho[j]);
+            rho[j] = reduce[2*c];
+#if DIRECT_ERROR
+            errk[j] = dots->Nrm2Round (&reduce[2*na + c*err_slots]);
+#endif // DIRECT_ERROR
+        }
+        tol = *std::max_element (tolk.begin(), tolk.end());
+#if DIRECT_ERROR
+        direct_err = *std::max_element (errk.begin(), errk.end());
+#endif // DIRECT_ERROR
+
+        // p = beta * p + r
+#pragma omp parallel for private(c, j)
+        for (i=0; i<n_dist; i++)
+            for (c=0; c<na; c++) {
+                j = act[c];
+                p[j*n_dist+i] = fma (beta[j], p[j*n_dist+i], r[j*n_dist+i]);
+            }
+
+        iter++;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t3, &t4);
+
+    if (myId == 0) {
+        printf ("Size: %d \n", n);
+        printf ("Rhs: %d \n", k);
+        printf ("Iter: %d \n", iter);
+        printf ("Tol: %a \n", tol);
+        printf ("Time_loop: %20.10e\n", (t3-t1));
+        printf ("Time_iter: %20.10e\n", (t3-t1)/iter);
+        printf ("Dot: %s \n", dots->Name ());
+        printf ("Time_dot: %20.10e\n", dots->time_dot);
+        printf ("Time_reduce: %20.10e\n", dots->time_reduce);
+    }
+
+    if (nk > 0) {
+        AllgathervFree (&gather_p); AllgathervFree (&gather_q);
+        dots->ReduceFree (req_alpha); dots->ReduceFree (req_pair); dots->ReduceFree (req_tol);
+    }
+
+    RemoveDoubles (&aux); RemoveDoubles (&r); RemoveDoubles (&r0); RemoveDoubles (&p);
+    RemoveDoubles (&s); RemoveDoubles (&q); RemoveDoubles (&y); RemoveDoubles (&p_hat);
+    RemoveDoubles (&q_hat); RemoveDoubles (&prod); RemoveDoubles (&diags);
+#if DIRECT_ERROR
+    RemoveDoubles (&res_err);
+#endif // DIRECT_ERROR
+#if PRECOND
+    RemoveInts (&posd);
+#endif
+#if FLOAT_DIAG
+    RemoveFloats (&dinv);
+#endif
+}
+
+/*********************************************************************************/
+
+// Solve G * y = c, y overwriting c, for the l x l symmetric positive definite
+// G by Cholesky, the same on every process; G is overwritten by its factor
+static void SolveGram (int l, double *G, double *c) {
+    int i, j, k;
+    for (j=0; j<l; j++) {
+        for (k=0; k<j; k++) G[j*l+j] -= G[j*l+k] * G[j*l+k];
+        G[j*l+j] = sqrt (G[j*l+j]);
+        for (i=j+1; i<l; i++) {
+            for (k=0; k<j; k++) G[i*l+j] -= G[i*l+k] * G[j*l+k];
+            G[i*l+j] /= G[j*l+j];
+        }
+    }
+    for (i=0; i<l; i++) {
+        for (k=0; k<i; k++) c[i] -= G[i*l+k] * c[k];
+        c[i] /= G[i*l+i];
+    }
+    for (i=l-1; i>=0; i--) {
+        for (k=i+1; k<l; k++) c[i] -= G[k*l+i] * c[k];
+        c[i] /= G[i*l+i];
+    }
+}
+
+// BiCGStab(l) of Sleijpen and Fokkema. Every cycle makes l BiCG steps and
+// then minimizes the residual over a polynomial of degree l (instead of the
+// degree 1 of BiCGStab), which keeps converging on strongly nonsymmetric
+// matrices where BiCGStab stagnates. The operator is A * D^-1, so x receives
+// D^-1 times the updates. With f0 = (A * D^-1)^T * r0, as in IBiCGStab, the
+// <r0, r_j+1> of the next BiCG step comes from <f0, r_j> and <f0, u_j+1>
+// before r_j is updated, so every BiCG step has a single reduction of three
+// dots. The minimal residual step takes the Gram matrix of r_0 .. r_l with
+// r_0 .. r_l and r0 from one reduction (DotBackend::Gram, on the upper
+// triangle and the column of r0, as in CABiCGStab), solves the normal
+// equations on it, and also gets the first <r0, r> of the next cycle from
+// it. The norm of the updated r_0 would only come from it by cancellation,
+// so it is rather reduced with the first BiCG step of the next cycle, which
+// stops there once it reaches the tolerance (at maxiter, the tolerance is the
+// one of the start of the last cycle). Each cycle counts as l iterations,
+// with two products by the matrix each, as in BiCGStab.
+void BiCGStabL (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, int myId, DotBackend *dots) {
+    int size = mat.dim2, sizeR = mat.dim1, l = ell;
+    double DONE = 1.0, DZERO = 0.0;
+    int i, j, m, n, n_dist, iter, maxiter, nProcs;
+    double tol, tol0, umbral, rho0, rho1, rho_next, alpha, beta, omega;
+    double *rv = NULL, *uv = NULL, *r0 = NULL, *f0 = NULL, *v_hat = NULL;
+    double *aux = NULL, *diags = NULL;
+    double t1, t2, t3, t4;
+    int req, req_first, req_step, req_gram;
+    SparseMatrix matT;
+    AllgathervPlan gather_v;
+    // Gram matrix of r_0 .. r_l with r_0 .. r_l and r0, reduced by blocks of
+    // 4 rows on the columns from the block on; the first BiCG step of a cycle
+    // adds <r_0, r_0> and the direct error to its three dots
+    int num_cols = l + 2, num_gram = 0;
+    std::vector<int> block_slot;
+    for (i=0; i<=l; i+=4) {
+        block_slot.push_back (num_gram);
+        num_gram += std::min (4, l + 1 - i) * (num_cols - i);
+    }
+#if DIRECT_ERROR
+    int num_first = 4 + dots->Nrm2Slots ();
+#else
+    int num_first = 4;
+#endif
+    std::vector<double> reduce (std::max (num_gram, num_first)), gram ((l + 1) * num_cols), G (l * l), gam (l);
+    std::vector<double *> r (l + 1), u (l + 1);
+    std::vector<const double *> gram_w (num_cols);
+#if PRECOND
+    int *posd = NULL;
+#endif
+#if FLOAT_DIAG
+    float *dinv = NULL;
+#else
+    double *dinv = NULL;
+#endif
+#if FLOAT_MATRIX
+    SparseMatrixF matS;
+    CreateSparseMatrixF (mat, &matS);
+#else
+    SparseMatrix matS = mat;
+#endif
+
+    MPI_Comm_size(MPI_COMM_WORLD, &nProcs);
+    n = size; n_dist = sizeR; maxiter = 16 * size; umbral = 1.0e-8;
+    CreateDoubles (&rv, (l + 1) * n_dist);
+    CreateDoubles (&uv, (l + 1) * n_dist);
+    CreateDoubles (&r0, n_dist);
+    CreateDoubles (&f0, n_dist);
+    CreateDoubles (&v_hat, n_dist);
+    for (j=0; j<=l; j++) {
+        r[j] = rv + j * n_dist; u[j] = uv + j * n_dist;
+        gram_w[j] = r[j];
+    }
+    gram_w[l+1] = r0;
+#if DIRECT_ERROR
+    // init exact solution
+    int IONE = 1;
+    double DMONE = -1.0, *res_err = NULL, *x_exact = NULL, direct_err;
+    CreateDoubles (&x_exact, n_dist);
+    CreateDoubles (&res_err, n_dist);
+    InitDoubles (x_exact, n_dist, DONE, DZERO);
+#endif // DIRECT_ERROR 
+
+    // inverse of the Jacobi diagonal, ones without preconditioner
+    CreateDoubles (&diags, n_dist);
+#if PRECOND
+    CreateInts (&posd, n_dist);
+    GetDiagonalSparseMatrix2 (mat, dspls[myId], diags, posd);
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++) 
+        diags[i] = DONE / diags[i];
+#else
+    InitDoubles (diags, n_dist, DONE, DZERO);
+#endif
+#if FLOAT_DIAG
+    CreateFloats (&dinv, n_dist);
+    CopyDoublesToFloats (diags, dinv, n_dist);
+#else
+    dinv = diags;
+#endif
+    CreateDoubles (&aux, n); 
+    dots->Reserve (std::max (num_gram, num_first));
+
+    // the products by A * D^-1 are on v_hat = D^-1 * v
+    AllgathervInit (v_hat, sizeR, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD, &gather_v);
+
+    iter = 0;
+    MPI_Allgatherv (x, sizeR, MPI_DOUBLE, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+    InitDoubles (v_hat, sizeR, DZERO, DZERO);
+    SPMV_SOLVER (matS, 0, aux, v_hat);                                  // v_hat = A * x
+
+    // r_0 = b - A * x, r0 = r_0, u_0 = 0
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++) {
+        r[0][i] = b[i] - v_hat[i];
+        r0[i] = r[0][i];
+        u[0][i] = DZERO;
+    }
+
+    // f0 = (A * D^-1)^T * r0 = D^-1 * A^T * r0
+    MPI_Allgatherv (r0, sizeR, MPI_DOUBLE, aux, sizes, dspls, MPI_DOUBLE, MPI_COMM_WORLD);
+    // the transpose of matS, as in IBiCGStab
+    TransposeDistributedMatrix (mat, sizes, dspls, &matT, MPI_COMM_WORLD);
+#if FLOAT_MATRIX
+    SparseMatrixF matTS;
+    CreateSparseMatrixF (matT, &matTS);
+#else
+    SparseMatrix matTS = matT;
+#endif
+    InitDoubles (f0, sizeR, DZERO, DZERO);
+    SPMV_SOLVER (matTS, 0, aux, f0);
+#pragma omp parallel for
+    for (i=0; i<n_dist; i++)
+        f0[i] *= dinv[i];
+#if FLOAT_MATRIX
+    RemoveSparseMatrixF (&matTS);
+#endif
+    RemoveSparseMatrix (&matT);
+
+    // <r0, r0>
+    dots->Dot (n_dist, r0, r0, 0);
+    req = dots->ReduceBegin (1);
+    dots->ReduceEnd (req, reduce.data());
+    rho_next = reduce[0];
+    tol0 = sqrt (rho_next);
+    tol = tol0;
+    rho0 = DONE; alpha = DZERO; omega = DONE;
+
+    req_first = dots->ReduceInit (num_first);
+    req_step = dots->ReduceInit (3);
+    req_gram = dots->ReduceInit (num_gram);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t1, &t2);
+
+    while ((iter < maxiter) && (tol > umbral)) {
+        rho0 = -omega * rho0;
+        for (j=0; j<l; j++) {
+            // beta = alpha * <r0, r_j> / rho0
+            rho1 = rho_next;
+            beta = alpha * (rho1 / rho0);
+            rho0 = rho1;
+
+            // u_m = r_m - beta * u_m, m = 0 .. j, then u_j+1 = A * D^-1 * u_j
+#pragma omp parallel for private(m)
+            for (i=0; i<n_dist; i++) {
+                for (m=0; m<=j; m++)
+                    u[m][i] = r[m][i] - beta * u[m][i];
+                v_hat[i] = dinv[i] * u[j][i];
+            }
+            AllgathervStart (&gather_v); AllgathervWait (&gather_v);
+            InitDoubles (u[j+1], sizeR, DZERO, DZERO);
+            SPMV_SOLVER (matS, 0, aux, u[j+1]);
+
+            // alpha = rho0 / <r0, u_j+1>, and <r0, r_j+1> = <f0, r_j> - alpha * <f0, u_j+1>
+            // for the r_j after the update; the first step also takes the
+            // tolerance of the r_0 and x of the cycle
+            {
+                const double *dot_x[4] = {r0, f0, f0, r[0]}, *dot_y[4] = {u[j+1], r[j], u[j+1], r[0]};
+                dots->Dots (n_dist, (j == 0) ? 4 : 3, dot_x, dot_y, 0);
+            }
+            if (j == 0) {
+#if DIRECT_ERROR
+                // direct error ||x_exact - x||, reduced with the tolerance
+                dcopy (&n_dist, x_exact, &IONE, res_err, &IONE);       // res_err = x_exact
+                daxpy (&n_dist, &DMONE, x, &IONE, res_err, &IONE);     // res_err -= x
+                dots->Nrm2 (n_dist, res_err, 4);
+#endif // DIRECT_ERROR
+                dots->ReduceStart (req_first);
+                dots->ReduceEnd (req_first, reduce.data());
+                tol = sqrt (reduce[3]) / tol0;
+#if DIRECT_ERROR
+                direct_err = dots->Nrm2Round (&reduce[4]);
+#endif // DIRECT_ERROR
+                if (tol <= umbral)
+                    break;
+                if (myId == 0) 
+#if DIRECT_ERROR
+                    printf ("%d \t %a \t %a \n", iter, tol, direct_err);
+#else        
+                printf ("%d \t %a \n", iter, tol);
+#endif // DIRECT_ERROR
+            } else {
+                dots->ReduceStart (req_step);
+                dots->ReduceEnd (req_step, reduce.data());
+            }
+            alpha = rho0 / reduce[0];
+            rho_next = reduce[1] - alpha * reduce[2];
+
+            // r_m -= alpha * u_m+1, m = 0 .. j, x += alpha * D^-1 * u_0, then r_j+1 = A * D^-1 * r_j
+#pragma omp parallel for private(m)
+            for (i=0; i<n_dist; i++) {
+                for (m=0; m<=j; m++)
+                    r[m][i] -= alpha * u[m+1][i];
+                x[i] += alpha * (dinv[i] * u[0][i]);
+                v_hat[i] = dinv[i] * r[j][i];
+            }
+            AllgathervStart (&gather_v); AllgathervWait (&gather_v);
+            InitDoubles (r[j+1], sizeR, DZERO, DZERO);
+            SPMV_SOLVER (matS, 0, aux, r[j+1]);
+        }
+
+        if (tol <= umbral)
+            break;
+
+        // all the sums of the minimal residual step in one reduction, the
+        // lower triangle comes from the upper one
+        for (i=0; i<=l; i+=4)
+            dots->Gram (n_dist, std::min (4, l + 1 - i), &r[i], num_cols - i, &gram_w[i], block_slot[i/4]);
+        dots->ReduceStart (req_gram);
+        dots->ReduceEnd (req_gram, reduce.data());
+        for (i=0; i<=l; i+=4) {
+            int kv = std::min (4, l + 1 - i), kw = num_cols - i;
+            for (m=0; m<kv; m++)
+                for (j=0; j<kw; j++) {
+                    double val = reduce[block_slot[i/4] + m * kw + j];
+                    gram[(i+m)*num_cols+i+j] = val;
+                    if (i + j <= l)
+                        gram[(i+j)*num_cols+i+m] = val;
+                }
+        }
+
+        // gam minimizes ||r_0 - sum gam_m * r_m||, from G * gam = c with
+        // G_ij = <r_i, r_j> and c_i = <r_i, r_0>, i, j = 1 .. l
+        for (m=0; m<l; m++) {
+            for (j=0; j<l; j++)
+                G[m*l+j] = gram[(m+1)*num_cols+j+1];
+            gam[m] = gram[(m+1)*num_cols];
+        }
+        SolveGram (l, G.data(), gam.data());
+        omega = gam[l-1];
+
+        // <r0, r_0> after the update
+        rho_next = gram[l+1];
+        for (m=0; m<l; m++)
+            rho_next -= gam[m] * gram[(m+1)*num_cols+l+1];
+
+        // x += sum gam_m * D^-1 * r_m-1, r_0 -= sum gam_m * r_m, u_0 -= sum gam_m * u_m
+#pragma omp parallel for private(m)
+        for (i=0; i<n_dist; i++) {
+            double xs = DZERO, ri = r[0][i], ui = u[0][i];
+            for (m=0; m<l; m++) {
+                xs += gam[m] * r[m][i];
+                ri -= gam[m] * r[m+1][i];
+                ui -= gam[m] * u[m+1][i];
+            }
+            x[i] += dinv[i] * xs;
+            r[0][i] = ri; u[0][i] = ui;
+        }
+
+        iter += l;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myId == 0) 
+        reloj (&t3, &t4);
+
+    if (myId == 0) {
+        printf ("Size: %d \n", n);
+        printf ("Iter: %d \n", iter);
+        printf ("Tol: %a \n", tol);
+        printf ("Time_loop: %20.10e\n", (t3-t1));
+        printf ("Time_iter: %20.10e\n", (t3-t1)/iter);
+        printf ("Dot: %s \n", dots->Name ());
+        printf ("Time_dot: %20.10e\n", dots->time_dot);
+        printf ("Time_reduce: %20.10e\n", dots->time_reduce);
+    }
+
+    AllgathervFree (&gather_v);
+    dots->ReduceFree (req_first); dots->ReduceFree (req_step); dots->ReduceFree (req_gram);
+
+    RemoveDoubles (&aux); RemoveDoubles (&rv); RemoveDoubles (&uv); RemoveDoubles (&r0);
+    RemoveDoubles (&f0); RemoveDoubles (&v_hat); RemoveDoubles (&diags);
+#if PRECOND
+    RemoveInts (&posd);
+#endif
+#if FLOAT_DIAG
+    RemoveFloats (&dinv);
+#endif
+#if DIRECT_ERROR
+    RemoveDoubles (&x_exact); RemoveDoubles (&res_err);
+#endif // DIRECT_ERROR
+#if FLOAT_MATRIX
+    RemoveSparseMatrixF (&matS);
+#endif
+}
+
+/*********************************************************************************/
+
+// Solvers selected by the solver=<name> argument
+typedef void (*SolverFunc) (SparseMatrix mat, double *x, double *b, int *sizes, int *dspls, int myId, DotBackend *dots);
+static const struct {
+    const char *name;
+    SolverFunc run;
+    int block;          // x and b are row-major blocks of nrhs vectors
+} solvers[] = {
+    {"bicgstab", BiCGStab, 0},
+    {"pipe", PipeBiCGStab, 0},
+    {"sstep", CABiCGStab, 0},
+    {"ibicgstab", IBiCGStab, 0},
+    {"block", BlockBiCGStab, 1},
+    {"bicgstabl", BiCGStabL, 0},
+};
+static const int num_solvers = sizeof (solvers) / sizeof (solvers[0]);
+
+/*********************************************************************************/
+
+int main (int argc, char **argv) {
+    int dim; 
+    double *sol1 = NULL, *sol2 = NULL;
+    int index = 0, indexL = 0;
+    SparseMatrix mat  = {0, 0, NULL, NULL, NULL}, sym = {0, 0, NULL, NULL, NULL};
+
+    int root = 0, myId, nProcs;
+    int dimL, dspL, *vdimL = NULL, *vdspL = NULL;
+    SparseMatrix matL = {0, 0, NULL, NULL, NULL};
+    double *sol1L = NULL, *sol2L = NULL;
+
+    int mat_from_file, nodes = 0, size_param = 0, stencil_points = 0;
+    const char *dot_name = DOT_BACKEND, *solver_name = SOLVER;
+    DotBackend *dots = NULL;
+    int solver, num_rhs;
+
+    /***************************************/
+
+    MPI_Init (&argc, &argv);
+
+    // Definition of the variables nProcs and myId
+    MPI_Comm_size(MPI_COMM_WORLD, &nProcs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myId);
+    root = nProcs-1;
+    root = 0;
+
+    // options key=value may come anywhere, the other arguments are positional
+    int nargs = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp (argv[i], "dot=", 4) == 0)
+            dot_name = argv[i] + 4;
+        else if (strncmp (argv[i], "solver=", 7) == 0)
+            solver_name = argv[i] + 7;
+        else if (strncmp (argv[i], "s=", 2) == 0)
+            sstep = atoi (argv[i] + 2);
+        else if (strncmp (argv[i], "k=", 2) == 0)
+            nrhs = atoi (argv[i] + 2);
+        else if (strncmp (argv[i], "l=", 2) == 0)
+            ell = atoi (argv[i] + 2);
+        else
+            argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+    if (argc < 3 || (atoi(argv[2]) == 0 && argc < 6) || sstep < 1 || nrhs < 1 || ell < 1) {
+        if (myId == root) {
+            printf ("Usage: %s MAT.rb 1 [dot=<backend>] [solver=<solver>] [s=<steps>] [k=<rhs>] [l=<ell>]\n", argv[0]);
+            printf ("       %s - 0 nodes size_param stencil_points [dot=<backend>] [solver=<solver>] [s=<steps>] [k=<rhs>] [l=<ell>]\n", argv[0]);
+            printf ("Backends: %s\n", DotBackendNames ());
+            printf ("Solvers:");
+            for (int i = 0; i < num_solvers; i++)
+                printf (" %s", solvers[i].name);
+            printf ("\n");
+        }
+        MPI_Finalize ();
+        return 1;
+    }
+    for (solver = 0; solver < num_solvers; solver++)
+        if (strcmp (solvers[solver].name, solver_name) == 0)
+            break;
+    if (solver == num_solvers) {
+        if (myId == root)
+            printf ("Unknown solver %s\n", solver_name);
+        MPI_Finalize ();
+        return 1;
+    }
+    // the block solver works on nrhs right-hand sides, the others on one
+    num_rhs = solvers[solver].block ? nrhs : 1;
+    mat_from_file = atoi(argv[2]);
+    if (!mat_from_file) {
+        nodes = atoi(argv[3]);
+        size_param = atoi(argv[4]);
+        stencil_points = atoi(argv[5]);
+    }
+
+    // FPE size and traits of the exact dots, as chosen by TuneExdot
+    exblas::cpu::DotConfig dot_cfg = exblas::cpu::CurrentDotConfig();
+    if (myId == root)
+        exblas::cpu::ReadDotConfig ("exdot.conf", &dot_cfg);
+    MPI_Bcast (&dot_cfg, 3, MPI_INT, root, MPI_COMM_WORLD);
+    exblas::cpu::CurrentDotConfig() = dot_cfg;
+
+    dots = CreateDotBackend (dot_name, MPI_COMM_WORLD);
+    if (dots == NULL) {
+        if (myId == root)
+            printf ("Unknown dot backend %s, use one of: %s\n", dot_name, DotBackendNames ());
+        MPI_Finalize ();
+        return 1;
+    }
+
+    /***************************************/
+
+    CreateInts (&vdimL, nProcs); CreateInts (&vdspL, nProcs); 
+    if(mat_from_file) {
+        if (myId == root) {
+            // Creating the matrix
+            ReadMatrixHB (argv[1], &sym);
+            TransposeSparseMatrices (sym, 0, &mat, 0);
+            dim = mat.dim1;
+        }
+
+        // Distributing the matrix
+        dim = DistributeMatrix (mat, index, &matL, indexL, vdimL, vdspL, root, MPI_COMM_WORLD);
+        dimL = vdimL[myId]; dspL = vdspL[myId];
+    }
+    else {
+        dim = size_param * size_param * size_param;
+        int divL, rstL, i;
+        divL = (dim / nProcs); rstL = (dim % nProcs);
+        for (i=0; i<nProcs; i++) vdimL[i] = divL + (i < rstL);
+        vdspL[0] = 0; for (i=1; i<nProcs; i++) vdspL[i] = vdspL[i-1] + vdimL[i-1];
+        dimL = vdimL[myId]; dspL = vdspL[myId];
+        int band_width = size_param * (size_param + 1) + 1;
+        band_width = 100 * nodes;
+        long nnz_here = ((long) (stencil_points + 2 * band_width)) * dimL;
+        printf ("dimL: %d, nodes: %d, size_param: %d, band_width: %d, stencil_points: %d, nnz_here: %ld\n",
+                dimL, nodes, size_param, band_width, stencil_points, nnz_here);
+        allocate_matrix(dimL, dim, nnz_here, &matL);
+        generate_Poisson3D_filled(&matL, size_param, stencil_points, band_width, dspL, dimL, dim);
+
+        // To generate ill-conditioned matrices
+//        double factor = 1.0e6;
+//        ScaleFirstRowCol(matL, dspL, dimL, myId, root, factor);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Creating the vectors, sol2, sol1L and sol2L as row-major blocks of num_rhs vectors
+    CreateDoubles (&sol1, dim);
+    CreateDoubles (&sol2, dim * num_rhs);
+    CreateDoubles (&sol1L, dimL * num_rhs);
+    CreateDoubles (&sol2L, dimL * num_rhs);
+
+    InitDoubles (sol2, dim * num_rhs, 0.0, 0.0);
+    InitDoubles (sol1L, dimL * num_rhs, 0.0, 0.0);
+    InitDoubles (sol2L, dimL * num_rhs, 0.0, 0.0);
+
+    // the rows of every process are contiguous in the row-major blocks
+    int *vdimK = NULL, *vdspK = NULL;
+    CreateInts (&vdimK, nProcs); CreateInts (&vdspK, nProcs); 
+    for (int i=0; i<nProcs; i++) {
+        vdimK[i] = vdimL[i] * num_rhs; vdspK[i] = vdspL[i] * num_rhs;
+    }
+
+    /***************************************/
+
+    int IONE = 1;
+    double beta = 1.0 / sqrt(dim);
+    if(mat_from_file) {
+        // compute b = A * x_c, x_c = 1/sqrt(nbrows)
+        InitDoubles (sol1, dim, 1.0, 0.0);
+        SPMV (matL, 0, sol1, sol1L);                                    			// s = A * x
+        dscal (&dimL, &beta, sol1L, &IONE);                                         // s = beta * s
+    } else {
+        InitDoubles (sol1, dim, 0.0, 0.0);
+
+        int k=0;
+        int *vptrM = matL.vptr;
+        for (int i=0; i < matL.dim1; i++) {
+            for(int j=vptrM[i]; j<vptrM[i+1]; j++) {
+                sol1L[k] += matL.vval[j];
+            }
+        }
+    }
+
+    if (num_rhs > 1) {
+        // the other right-hand sides are b_j = A * x_j, x_j(i) = beta * (1 + j*i/dim),
+        // stored with b by rows
+        double *bj = NULL;
+        CreateDoubles (&bj, dimL);
+        for (int i=dimL-1; i>=0; i--)
+            sol1L[i*num_rhs] = sol1L[i];
+        for (int j=1; j<num_rhs; j++) {
+            InitDoubles (sol1, dim, beta, beta * j / dim);
+            InitDoubles (bj, dimL, 0.0, 0.0);
+            SPMV (matL, 0, sol1, bj);
+            for (int i=0; i<dimL; i++)
+                sol1L[i*num_rhs+j] = bj[i];
+        }
+        RemoveDoubles (&bj);
+    }
+
+    MPI_Scatterv (sol2, vdimK, vdspK, MPI_DOUBLE, sol2L, dimL * num_rhs, MPI_DOUBLE, root, MPI_COMM_WORLD);
+
+    // room for the norms of the errors, before the solver sets up its reductions
+    dots->Reserve (dots->Nrm2Slots () * num_rhs);
+    solvers[solver].run (matL, sol2L, sol1L, vdimL, vdspL, myId, dots);
+
+    // Error computation ||b-Ax||, of every right-hand side
+//    if(mat_from_file) {
+        MPI_Allgatherv (sol2L, dimL * num_rhs, MPI_DOUBLE, sol2, vdimK, vdspK, MPI_DOUBLE, MPI_COMM_WORLD);
+        InitDoubles (sol2L, dimL * num_rhs, 0, 0);
+        if (num_rhs == 1)
+            SPMV (matL, 0, sol2, sol2L);
+        else
+            ProdSparseMatrixBlockByRows (matL, 0, num_rhs, sol2, sol2L);
+        double DMONE = -1.0;
+        int dimK = dimL * num_rhs;
+        daxpy (&dimK, &DMONE, sol2L, &IONE, sol1L, &IONE);          
+
+        // the norms of all the columns in one reduction
+        int nrm2_slots = dots->Nrm2Slots ();
+        std::vector<double> sums (nrm2_slots * num_rhs);
+        for (int j=0; j<num_rhs; j++) {
+            for (int i=0; i<dimL; i++)
+                sol2L[i] = sol1L[i*num_rhs+j];
+            dots->Nrm2 (dimL, sol2L, j * nrm2_slots);
         }
-        MPI_Bcast(&beta, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        // ReproAllReduce -- End
+        dots->Reduce (nrm2_slots * num_rhs, sums.data());
         
 //    } else {
 //        // case with x_exact = {1.0}
@@ -433,9 +2054,9 @@ int main (int argc, char **argv) {
 //        beta = ddot (&dimL, sol2L, &IONE, sol2L, &IONE);            
 //    } 
 
-    beta = sqrt(beta);
     if (myId == 0) 
-        printf ("Error: %20.10e\n", beta);
+        for (int j=0; j<num_rhs; j++)
+            printf ("Error: %20.10e\n", dots->Nrm2Round (&sums[j * nrm2_slots]));
 
     /***************************************/
     // Freeing memory
@@ -444,11 +2065,13 @@ int main (int argc, char **argv) {
     RemoveDoubles (&sol1L); 
     RemoveDoubles (&sol2L);
     RemoveInts (&vdspL); RemoveInts (&vdimL); 
+    RemoveInts (&vdspK); RemoveInts (&vdimK); 
     if (myId == root) {
         RemoveSparseMatrix (&mat);
         RemoveSparseMatrix (&sym);
     } 
 
+    delete dots;
     MPI_Finalize ();
 
     return 0;
@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <mkl_blas.h>
+#include <mpi.h>
+#include <vector>
+#include <algorithm>
+
+#include "exblas/exdot_tuned.h"
+#include "exblas/exsum.h"
+#include "exblas/exgram.h"
+#include "exblas/mpi_accumulate.h"
+#include "exblas/mpi_binned.h"
+#include "exblas/mpi_fixed.h"
+#include "exblas/mpi_fpe.h"
+#include "DotBackend.h"
+
+// superaccumulators merged inside every node before the reduction between nodes
+#ifndef NODE_REDUCE
+#define NODE_REDUCE 1
+#endif
+
+/*********************************************************************************/
+
+// Every backend is the same template on a set of static functions: the
+// accumulator (Acc, Words of them per slot), the request of a nonblocking
+// reduction, the kernels, and what the backend sets up on the communicator
+// for its life.
+
+// Exact dots, with the FPE configuration of exdot_tuned
+struct SuperaccOps {
+	typedef int64_t Acc;
+	typedef exblas::cpu::ReproRequest Request;
+	static const int Words = exblas::BIN_COUNT;
+	static const int Nrm2Slots = exblas::NRM2_PARTS;
+
+	template<int K>
+	static void Dots (int n, const double *const (&x)[K], const double *const (&y)[K], Acc *acc, MPI_Comm comm) {
+		exblas::cpu::exdot_tuned<K> (n, x, y, acc);
+	}
+	template<int K>
+	static void AxpyDots (int n, double alpha, const double *x, const double *y, double *z,
+												const double *const (&w)[K], Acc *acc, MPI_Comm comm) {
+		exblas::cpu::exaxpy_dot_tuned<K> (n, alpha, x, y, z, w, acc);
+	}
+	static void Nrm2 (int n, const double *x, Acc *acc, MPI_Comm comm) {
+		exblas::cpu::exnrm2 (n, x, acc);
+	}
+	static double Nrm2Round (const double *sums) {
+		return exblas::cpu::Nrm2Round (sums);
+	}
+	static void Setup (MPI_Comm comm) {
+#if NODE_REDUCE
+		exblas::cpu::ReproNodeReductionEnable (comm);
+#endif
+	}
+	static void Cleanup (MPI_Comm comm) {
+#if NODE_REDUCE
+		exblas::cpu::ReproNodeReductionDisable (comm);
+#endif
+	}
+};
+
+// Binned sums, one MPI_Allreduce on BINNED_WORDS doubles per dot
+struct BinnedOps {
+	typedef double Acc;
+	typedef exblas::cpu::BinnedRequest Request;
+	static const int Words = exblas::BINNED_WORDS;
+	static const int Nrm2Slots = 1;
+
+	template<int K>
+	static void Dots (int n, const double *const (&x)[K], const double *const (&y)[K], Acc *acc, MPI_Comm comm) {
+		exblas::cpu::binned_dot<K> (n, x, y, acc);
+	}
+	template<int K>
+	static void AxpyDots (int n, double alpha, const double *x, const double *y, double *z,
+												const double *const (&w)[K], Acc *acc, MPI_Comm comm) {
+		exblas::cpu::binned_axpy_dot<K> (n, alpha, x, y, z, w, acc);
+	}
+	static void Nrm2 (int n, const double *x, Acc *acc, MPI_Comm comm) {
+		exblas::cpu::binned_dot (n, x, x, acc);
+	}
+	static double Nrm2Round (const double *sums) {
+		return sqrt (sums[0]);
+	}
+	static void Setup (MPI_Comm comm) {}
+	static void Cleanup (MPI_Comm comm) {}
+};
+
+// Fixed point, the dots agree on the largest exponent over comm first
+struct FixedOps {
+	typedef exblas::cpu::FixedSum Acc;
+	typedef exblas::cpu::FixedRequest Request;
+	static const int Words = 1;
+	static const int Nrm2Slots = 1;
+
+	template<int K>
+	static void Dots (int n, const double *const (&x)[K], const double *const (&y)[K], Acc *acc, MPI_Comm comm) {
+		exblas::cpu::fixed_dot<K> (n, x, y, acc, comm);
+	}
+	template<int K>
+	static void AxpyDots (int n, double alpha, const double *x, const double *y, double *z,
+												const double *const (&w)[K], Acc *acc, MPI_Comm comm) {
+		exblas::cpu::fixed_axpy_dot<K> (n, alpha, x, y, z, w, acc, comm);
+	}
+	static void Nrm2 (int n, const double *x, Acc *acc, MPI_Comm comm) {
+		exblas::cpu::fixed_dot (n, x, x, acc, comm);
+	}
+	static double Nrm2Round (const double *sums) {
+		return sqrt (sums[0]);
+	}
+	static void Setup (MPI_Comm comm) {}
+	static void Cleanup (MPI_Comm comm) {}
+};
+
+// Floating-point expansions only, exact and reproducible while they hold the
+// sums (see exblas/fpe.h)
+struct FpeOps {
+	typedef exblas::cpu::FpeSum Acc;
+	typedef exblas::cpu::FpeRequest Request;
+	static const int Words = 1;
+	static const int Nrm2Slots = 1;
+
+	template<int K>
+	static void Dots (int n, const double *const (&x)[K], const double *const (&y)[K], Acc *acc, MPI_Comm comm) {
+		exblas::cpu::fpe_dot<K> (n, x, y, acc);
+	}
+	template<int K>
+	static void AxpyDots (int n, double alpha, const double *x, const double *y, double *z,
+												const double *const (&w)[K], Acc *acc, MPI_Comm comm) {
+		exblas::cpu::fpe_axpy_dot<K> (n, alpha, x, y, z, w, acc);
+	}
+	static void Nrm2 (int n, const double *x, Acc *acc, MPI_Comm comm) {
+		exblas::cpu::fpe_dot (n, x, x, acc);
+	}
+	static double Nrm2Round (const double *sums) {
+		return sqrt (sums[0]);
+	}
+	static void Setup (MPI_Comm comm) {}
+	static void Cleanup (MPI_Comm comm) {}
+};
+
+// Plain sums in double: BLAS ddot and MPI_Allreduce
+typedef struct {
+	int num;
+	double *sums;
+	MPI_Comm comm;
+	MPI_Request req;
+	int persistent;
+} PlainRequest;
+
+static void PlainAllReduce (int num, double *sums, double *result, MPI_Comm comm) {
+	MPI_Allreduce (sums, result, num, MPI_DOUBLE, MPI_SUM, comm);
+}
+
+static void PlainAllReduceInit (int num, double *sums, MPI_Comm comm, PlainRequest *req) {
+	req->num = num; req->sums = sums; req->comm = comm;
+	req->req = MPI_REQUEST_NULL;
+	req->persistent = 1;
+#if MPI_VERSION >= 4
+	MPI_Allreduce_init (MPI_IN_PLACE, sums, num, MPI_DOUBLE, MPI_SUM, comm, MPI_INFO_NULL, &(req->req));
+#endif
+}
+
+static void PlainAllReduceStart (PlainRequest *req) {
+#if MPI_VERSION >= 4
+	if (req->persistent) {
+		MPI_Start (&(req->req));
+		return;
+	}
+#endif
+	MPI_Iallreduce (MPI_IN_PLACE, req->sums, req->num, MPI_DOUBLE, MPI_SUM, req->comm, &(req->req));
+}
+
+static void PlainAllReduceBegin (int num, double *sums, MPI_Comm comm, PlainRequest *req) {
+	req->num = num; req->sums = sums; req->comm = comm;
+	req->req = MPI_REQUEST_NULL;
+	req->persistent = 0;
+	PlainAllReduceStart (req);
+}
+
+static void PlainAllReduceEnd (PlainRequest *req, double *result) {
+	MPI_Wait (&(req->req), MPI_STATUS_IGNORE);
+	memcpy (result, req->sums, req->num * sizeof(double));
+}
+
+static void PlainAllReduceFree (PlainRequest *req) {
+	if (req->req != MPI_REQUEST_NULL)
+		MPI_Request_free (&(req->req));
+}
+
+struct DdotOps {
+	typedef double Acc;
+	typedef PlainRequest Request;
+	static const int Words = 1;
+	static const int Nrm2Slots = 1;
+
+	template<int K>
+	static void Dots (int n, const double *const (&x)[K], const double *const (&y)[K], Acc *acc, MPI_Comm comm) {
+		int IONE = 1;
+		for (int k = 0; k < K; k++)
+			acc[k] = ddot (&n, x[k], &IONE, y[k], &IONE);
+	}
+	template<int K>
+	static void AxpyDots (int n, double alpha, const double *x, const double *y, double *z,
+												const double *const (&w)[K], Acc *acc, MPI_Comm comm) {
+		// same update as the fused kernels of the other backends
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++)
+			z[i] = fma (alpha, x[i], y[i]);
+		const double *zs[K];
+		for (int k = 0; k < K; k++)
+			zs[k] = z;
+		Dots<K> (n, w, zs, acc, comm);
+	}
+	static void Nrm2 (int n, const double *x, Acc *acc, MPI_Comm comm) {
+		int IONE = 1;
+		acc[0] = ddot (&n, x, &IONE, x, &IONE);
+	}
+	static double Nrm2Round (const double *sums) {
+		return sqrt (sums[0]);
+	}
+	static void Setup (MPI_Comm comm) {}
+	static void Cleanup (MPI_Comm comm) {}
+};
+
+// Reductions of the exblas backends, overloaded on the accumulator
+template<class Ops>
+struct ReduceOps {
+	typedef typename Ops::Acc Acc;
+	typedef typename Ops::Request Request;
+	static void AllReduce (int num, Acc *acc, double *result, MPI_Comm comm) {
+		exblas::cpu::ReproAllReduce (num, acc, result, comm);
+	}
+	static void Init (int num, Acc *acc, MPI_Comm comm, Request *req) {
+		exblas::cpu::ReproAllReduceInit (num, acc, comm, req);
+	}
+	static void Start (Request *req) { exblas::cpu::ReproAllReduceStart (req); }
+	static void Begin (int num, Acc *acc, MPI_Comm comm, Request *req) {
+		exblas::cpu::ReproAllReduceBegin (num, acc, comm, req);
+	}
+	static void End (Request *req, double *result) { exblas::cpu::ReproAllReduceEnd (req, result); }
+	static void Free (Request *req) { exblas::cpu::ReproAllReduceFree (req); }
+};
+
+template<>
+struct ReduceOps<DdotOps> {
+	static void AllReduce (int num, double *acc, double *result, MPI_Comm comm) {
+		PlainAllReduce (num, acc, result, comm);
+	}
+	static void Init (int num, double *acc, MPI_Comm comm, PlainRequest *req) {
+		PlainAllReduceInit (num, acc, comm, req);
+	}
+	static void Start (PlainRequest *req) { PlainAllReduceStart (req); }
+	static void Begin (int num, double *acc, MPI_Comm comm, PlainRequest *req) {
+		PlainAllReduceBegin (num, acc, comm, req);
+	}
+	static void End (PlainRequest *req, double *result) { PlainAllReduceEnd (req, result); }
+	static void Free (PlainRequest *req) { PlainAllReduceFree (req); }
+};
+
+/*********************************************************************************/
+
+template<class Ops>
+class DotBackendOf : public DotBackend {
+	typedef typename Ops::Acc Acc;
+	typedef typename Ops::Request Request;
+	typedef ReduceOps<Ops> Reduce_;
+
+	const char *name;
+	MPI_Comm comm;
+	std::vector<Acc> acc;
+	// the requests are never moved, a persistent one may point into itself
+	Request req[DOT_HANDLES];
+	int state[DOT_HANDLES];     // 0 free, 1 persistent, 2 single
+
+	int NewHandle (int kind) {
+		for (int h = 0; h < DOT_HANDLES; h++)
+			if (state[h] == 0) {
+				state[h] = kind;
+				return h;
+			}
+		fprintf (stderr, "DotBackend: more than %d reductions\n", DOT_HANDLES);
+		MPI_Abort (comm, 1);
+		return -1;
+	}
+
+	template<int K>
+	void DotsOf (int n, const double *const *x, const double *const *y, int slot) {
+		const double *xs[K], *ys[K];
+		for (int k = 0; k < K; k++) {
+			xs[k] = x[k]; ys[k] = y[k];
+		}
+		Ops::template Dots<K> (n, xs, ys, &acc[slot * Ops::Words], comm);
+	}
+
+public:
+	DotBackendOf (const char *name, MPI_Comm comm) : name(name), comm(comm), acc(DOT_SLOTS * Ops::Words) {
+		for (int h = 0; h < DOT_HANDLES; h++)
+			state[h] = 0;
+		Ops::Setup (comm);
+	}
+
+	~DotBackendOf () {
+		for (int h = 0; h < DOT_HANDLES; h++)
+			if (state[h] == 1)
+				Reduce_::Free (&req[h]);
+		Ops::Cleanup (comm);
+	}
+
+	const char *Name () const { return name; }
+
+	void Dots (int n, int K, const double *const *x, const double *const *y, int slot) {
+		double t = MPI_Wtime ();
+		// one sweep for up to 4 dots, more are done 4 at a time
+		for (int k = 0; k < K; k += 4) {
+			switch (K - k) {
+				case 1: DotsOf<1> (n, x + k, y + k, slot + k); break;
+				case 2: DotsOf<2> (n, x + k, y + k, slot + k); break;
+				case 3: DotsOf<3> (n, x + k, y + k, slot + k); break;
+				default: DotsOf<4> (n, x + k, y + k, slot + k); break;
+			}
+		}
+		time_dot += MPI_Wtime () - t;
+	}
+
+	void Gram (int n, int KV, const double *const *v, int KW, const double *const *w, int slot) {
+		double t = MPI_Wtime ();
+		std::vector<const double *> vi (KW);
+		for (int i = 0; i < KV; i++) {
+			for (int j = 0; j < KW; j++)
+				vi[j] = v[i];
+			for (int j = 0; j < KW; j += 4) {
+				switch (KW - j) {
+					case 1: DotsOf<1> (n, &vi[j], w + j, slot + i * KW + j); break;
+					case 2: DotsOf<2> (n, &vi[j], w + j, slot + i * KW + j); break;
+					case 3: DotsOf<3> (n, &vi[j], w + j, slot + i * KW + j); break;
+					default: DotsOf<4> (n, &vi[j], w + j, slot + i * KW + j); break;
+				}
+			}
+		}
+		time_dot += MPI_Wtime () - t;
+	}
+
+	void AxpyDots (int n, double alpha, const double *x, const double *y, double *z,
+									int K, const double *const *w, int slot) {
+		double t = MPI_Wtime ();
+		if (K == 1) {
+			const double *const w1[1] = {w[0]};
+			Ops::template AxpyDots<1> (n, alpha, x, y, z, w1, &acc[slot * Ops::Words], comm);
+		} else {
+			const double *const w2[2] = {w[0], w[1]};
+			Ops::template AxpyDots<2> (n, alpha, x, y, z, w2, &acc[slot * Ops::Words], comm);
+		}
+		time_dot += MPI_Wtime () - t;
+	}
+
+	int Nrm2Slots () const { return Ops::Nrm2Slots; }
+
+	void Nrm2 (int n, const double *x, int slot) {
+		double t = MPI_Wtime ();
+		Ops::Nrm2 (n, x, &acc[slot * Ops::Words], comm);
+		time_dot += MPI_Wtime () - t;
+	}
+
+	double Nrm2Round (const double *sums) const { return Ops::Nrm2Round (sums); }
+
+	void Reserve (int num) {
+		if (num * Ops::Words <= (int) acc.size ())
+			return;
+		for (int h = 0; h < DOT_HANDLES; h++)
+			if (state[h] != 0) {
+				fprintf (stderr, "DotBackend: Reserve after the reductions are set up\n");
+				MPI_Abort (comm, 1);
+			}
+		acc.resize (num * Ops::Words);
+	}
+
+	int ReduceInit (int num) {
+		int h = NewHandle (1);
+		Reduce_::Init (num, &acc[0], comm, &req[h]);
+		return h;
+	}
+
+	void ReduceStart (int handle) {
+		double t = MPI_Wtime ();
+		Reduce_::Start (&req[handle]);
+		time_reduce += MPI_Wtime () - t;
+	}
+
+	void ReduceEnd (int handle, double *result) {
+		double t = MPI_Wtime ();
+		Reduce_::End (&req[handle], result);
+		if (state[handle] == 2)
+			state[handle] = 0;
+		time_reduce += MPI_Wtime () - t;
+	}
+
+	void ReduceFree (int handle) {
+		if (state[handle] == 1) {
+			Reduce_::Free (&req[handle]);
+			state[handle] = 0;
+		}
+	}
+
+	int ReduceBegin (int num) {
+		double t = MPI_Wtime ();
+		int h = NewHandle (2);
+		Reduce_::Begin (num, &acc[0], comm, &req[h]);
+		time_reduce += MPI_Wtime () - t;
+		return h;
+	}
+
+	void Reduce (int num, double *result) {
+		double t = MPI_Wtime ();
+		Reduce_::AllReduce (num, &acc[0], result, comm);
+		time_reduce += MPI_Wtime () - t;
+	}
+};
+
+// Exact Gram matrices by tiles of up to 4 x 4 dots, each one in one sweep of exgram
+template<int KV, int KW>
+static void GramTile (int n, const double *const *v, const double *const *w, int64_t *acc) {
+	const double *vs[KV], *ws[KW];
+	for (int i = 0; i < KV; i++)
+		vs[i] = v[i];
+	for (int j = 0; j < KW; j++)
+		ws[j] = w[j];
+	exblas::cpu::exgram<KV, KW> (n, vs, ws, acc);
+}
+
+template<int KV>
+static void GramTileRow (int n, const double *const *v, int KW, const double *const *w, int64_t *acc) {
+	switch (KW) {
+		case 1: GramTile<KV, 1> (n, v, w, acc); break;
+		case 2: GramTile<KV, 2> (n, v, w, acc); break;
+		case 3: GramTile<KV, 3> (n, v, w, acc); break;
+		default: GramTile<KV, 4> (n, v, w, acc); break;
+	}
+}
+
+template<>
+void DotBackendOf<SuperaccOps>::Gram (int n, int KV, const double *const *v, int KW, const double *const *w, int slot) {
+	const int W = SuperaccOps::Words;
+	double t = MPI_Wtime ();
+	std::vector<int64_t> tile (16 * W);
+	for (int i = 0; i < KV; i += 4) {
+		int kv = std::min (KV - i, 4);
+		for (int j = 0; j < KW; j += 4) {
+			int kw = std::min (KW - j, 4);
+			switch (kv) {
+				case 1: GramTileRow<1> (n, v + i, kw, w + j, &tile[0]); break;
+				case 2: GramTileRow<2> (n, v + i, kw, w + j, &tile[0]); break;
+				case 3: GramTileRow<3> (n, v + i, kw, w + j, &tile[0]); break;
+				default: GramTileRow<4> (n, v + i, kw, w + j, &tile[0]); break;
+			}
+			// the superaccumulator of (i+ii, j+jj) is at ii*kw+jj in the tile
+			for (int ii = 0; ii < kv; ii++)
+				std::copy (&tile[ii * kw * W], &tile[(ii + 1) * kw * W], &acc[(slot + (i + ii) * KW + j) * W]);
+		}
+	}
+	time_dot += MPI_Wtime () - t;
+}
+
+/*********************************************************************************/
+
+const char *DotBackendNames () {
+	return "superacc binned fixed fpe ddot";
+}
+
+DotBackend *CreateDotBackend (const char *name, MPI_Comm comm) {
+	if (strcmp (name, "superacc") == 0)
+		return new DotBackendOf<SuperaccOps> ("superacc", comm);
+	if (strcmp (name, "binned") == 0)
+		return new DotBackendOf<BinnedOps> ("binned", comm);
+	if (strcmp (name, "fixed") == 0)
+		return new DotBackendOf<FixedOps> ("fixed", comm);
+	if (strcmp (name, "fpe") == 0)
+		return new DotBackendOf<FpeOps> ("fpe", comm);
+	if (strcmp (name, "ddot") == 0)
+		return new DotBackendOf<DdotOps> ("ddot", comm);
+	return NULL;
+}
+
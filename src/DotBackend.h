@@ -0,0 +1,92 @@
+#ifndef DotBackendTip
+
+#define DotBackendTip 1
+
+#include <mpi.h>
+
+// Dot products and reductions of the solver, behind one interface so that
+// the way they are computed is chosen at run time. Every backend owns
+// DOT_SLOTS accumulators (or more, see Reserve): the dots fill some of them, the reductions combine
+// the first num ones over the processes and round them to doubles.
+
+#define DOT_SLOTS 8     // accumulators of a backend when it is created
+#define DOT_HANDLES 8   // reductions of a backend that can exist at the same time
+
+class DotBackend {
+public:
+	virtual ~DotBackend () {}
+
+	// Name of the backend, as given to CreateDotBackend
+	virtual const char *Name () const = 0;
+
+	// K dots <x_k, y_k> of n elements into the slots slot .. slot+K-1, in one
+	// sweep over the vectors for K up to 4
+	virtual void Dots (int n, int K, const double *const *x, const double *const *y, int slot) = 0;
+
+	// The KV*KW dots <v_i, w_j> into the slots slot + i*KW + j, in one sweep
+	// over the vectors for every tile of up to 4 x 4 dots where the backend
+	// has a kernel for it (superacc), otherwise as Dots of the rows
+	virtual void Gram (int n, int KV, const double *const *v, int KW, const double *const *w, int slot) = 0;
+
+	// z = y + alpha * x (rounded once, as an fma), then the K dots <w_k, z>
+	// into the slots slot .. slot+K-1 (K is 1 or 2); z may be y and any w_k may be z
+	virtual void AxpyDots (int n, double alpha, const double *x, const double *y, double *z,
+													int K, const double *const *w, int slot) = 0;
+
+	// Number of slots used by Nrm2
+	virtual int Nrm2Slots () const = 0;
+
+	// Sums giving ||x||, into the slots slot .. slot+Nrm2Slots()-1
+	virtual void Nrm2 (int n, const double *x, int slot) = 0;
+
+	// ||x|| from the Nrm2Slots() reduced sums of Nrm2
+	virtual double Nrm2Round (const double *sums) const = 0;
+
+	// Make room for at least num slots (DOT_SLOTS after CreateDotBackend),
+	// before any persistent reduction is set up
+	virtual void Reserve (int num) = 0;
+
+	// Persistent reduction of the slots 0 .. num-1, returns its handle
+	virtual int ReduceInit (int num) = 0;
+
+	// Start a reduction of ReduceInit, on the contents of the slots at this time
+	virtual void ReduceStart (int handle) = 0;
+
+	// Complete a reduction, result receives the num rounded sums. A handle
+	// of ReduceBegin is released.
+	virtual void ReduceEnd (int handle, double *result) = 0;
+
+	// Release a handle of ReduceInit, which must not be in progress
+	virtual void ReduceFree (int handle) = 0;
+
+	// Start a single reduction of the slots 0 .. num-1, returns its handle
+	virtual int ReduceBegin (int num) = 0;
+
+	// Blocking reduction of the slots 0 .. num-1
+	virtual void Reduce (int num, double *result) = 0;
+
+	// Single dot <x, y> into the slot
+	void Dot (int n, const double *x, const double *y, int slot) {
+		Dots (n, 1, &x, &y, slot);
+	}
+
+	double time_dot = 0.0;      // seconds spent in the dots (and the fused updates)
+	double time_reduce = 0.0;   // seconds spent starting and waiting for the reductions
+};
+
+/*********************************************************************************/
+
+// Names of the backends understood by CreateDotBackend, separated by spaces
+extern const char *DotBackendNames ();
+
+// Create the backend called name on the communicator comm (NULL if the name
+// is unknown). All the processes of comm must create the same one.
+//  - superacc : exact dots, superaccumulators reduced reproducibly (exblas)
+//  - binned   : binned sums of 3 bins, reproducible but not exact
+//  - fixed    : 128 bit fixed point, reproducible but not exact
+//  - fpe      : floating-point expansions only, exact and reproducible while
+//               they hold the sums, silently neither beyond
+//  - ddot     : BLAS ddot and MPI_Allreduce, neither exact nor reproducible
+extern DotBackend *CreateDotBackend (const char *name, MPI_Comm comm);
+
+#endif
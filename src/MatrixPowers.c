@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+#include <vector>
+#include <algorithm>
+#include <ScalarVectors.h>
+#include "MatrixPowers.h"
+
+/*********************************************************************************/
+
+// Fetch from their owners the rows of want (global indices, sorted), and
+// append them to vlen (lengths), vpos and vval. The local rows of mat are
+// the first ones of the whole matrix after dspl. Collective on comm.
+static void FetchRows (SparseMatrix mat, int dspl, int *dspls, int nProcs, std::vector<int> &want,
+												std::vector<int> &vlen, std::vector<int> &vpos, std::vector<double> &vval,
+												MPI_Comm comm) {
+	int i, j, p;
+	std::vector<int> scnt (nProcs, 0), rcnt (nProcs), sdsp (nProcs), rdsp (nProcs);
+	std::vector<int> snnz (nProcs, 0), rnnz (nProcs), sdspn (nProcs), rdspn (nProcs);
+	int *vptr = mat.vptr, base = mat.vptr[0];
+
+	// Rows asked to every owner, the owners are increasing along want
+	for (i=0; i<(int) want.size(); i++) {
+		p = (int) (std::upper_bound (dspls, dspls + nProcs, want[i]) - dspls) - 1;
+		scnt[p]++;
+	}
+	MPI_Alltoall (scnt.data(), 1, MPI_INT, rcnt.data(), 1, MPI_INT, comm);
+	sdsp[0] = rdsp[0] = 0;
+	for (p=1; p<nProcs; p++) {
+		sdsp[p] = sdsp[p-1] + scnt[p-1]; rdsp[p] = rdsp[p-1] + rcnt[p-1];
+	}
+	std::vector<int> asked (rdsp[nProcs-1] + rcnt[nProcs-1]);
+	MPI_Alltoallv (want.data(), scnt.data(), sdsp.data(), MPI_INT,
+								 asked.data(), rcnt.data(), rdsp.data(), MPI_INT, comm);
+
+	// Lengths of the asked rows, then their entries
+	std::vector<int> alen (asked.size()), len (want.size());
+	for (i=0; i<(int) asked.size(); i++)
+		alen[i] = vptr[asked[i]-dspl+1] - vptr[asked[i]-dspl];
+	MPI_Alltoallv (alen.data(), rcnt.data(), rdsp.data(), MPI_INT,
+								 len.data(), scnt.data(), sdsp.data(), MPI_INT, comm);
+	for (p=0; p<nProcs; p++) {
+		for (i=rdsp[p]; i<rdsp[p]+rcnt[p]; i++) rnnz[p] += alen[i];
+		for (i=sdsp[p]; i<sdsp[p]+scnt[p]; i++) snnz[p] += len[i];
+	}
+	sdspn[0] = rdspn[0] = 0;
+	for (p=1; p<nProcs; p++) {
+		sdspn[p] = sdspn[p-1] + snnz[p-1]; rdspn[p] = rdspn[p-1] + rnnz[p-1];
+	}
+	std::vector<int> apos; std::vector<double> aval;
+	for (i=0; i<(int) asked.size(); i++) {
+		for (j=vptr[asked[i]-dspl]; j<vptr[asked[i]-dspl+1]; j++) {
+			apos.push_back (mat.vpos[j-base]); aval.push_back (mat.vval[j-base]);
+		}
+	}
+	int old = (int) vpos.size(), nnz = sdspn[nProcs-1] + snnz[nProcs-1];
+	vpos.resize (old + nnz); vval.resize (old + nnz);
+	MPI_Alltoallv (apos.data(), rnnz.data(), rdspn.data(), MPI_INT,
+								 vpos.data() + old, snnz.data(), sdspn.data(), MPI_INT, comm);
+	MPI_Alltoallv (aval.data(), rnnz.data(), rdspn.data(), MPI_DOUBLE,
+								 vval.data() + old, snnz.data(), sdspn.data(), MPI_DOUBLE, comm);
+	vlen.insert (vlen.end(), len.begin(), len.end());
+}
+
+// Build the kernel of the given depth from the local rows of mat, which are
+// the rows dspls[myId] .. dspls[myId]+sizes[myId]-1 (as in DistributeMatrix)
+// with global columns. Collective on comm.
+void CreateMatrixPowers (SparseMatrix mat, int *sizes, int *dspls, int depth, MPI_Comm comm,
+													ptr_MatrixPowers mp) {
+	int i, j, k, myId, nProcs, dim = mat.dim2, dimL = mat.dim1;
+	int base = mat.vptr[0];
+
+	MPI_Comm_size (comm, &nProcs); MPI_Comm_rank (comm, &myId);
+	int dspl = dspls[myId];
+
+	// The local rows are the first ones
+	std::vector<int> vrow (dimL), vlen (dimL), vpos, vcnt;
+	std::vector<double> vval;
+	std::vector<char> in (dim, 0);
+	for (i=0; i<dimL; i++) {
+		vrow[i] = dspl + i; in[dspl+i] = 1;
+		vlen[i] = mat.vptr[i+1] - mat.vptr[i];
+	}
+	vpos.assign (mat.vpos, mat.vpos + (mat.vptr[dimL] - base));
+	vval.assign (mat.vval, mat.vval + (mat.vptr[dimL] - base));
+	vcnt.push_back (dimL);
+
+	// The rows at distance k are the new columns of the rows at distance k-1
+	int first = 0;
+	for (k=1; k<depth; k++) {
+		std::vector<int> want;
+		int last = (int) vrow.size();
+		for (i=0, j=0; i<first; i++) j += vlen[i];
+		for (i=first; i<last; i++) {
+			for (int e=j; e<j+vlen[i]; e++)
+				if (!in[vpos[e]]) {
+					in[vpos[e]] = 1; want.push_back (vpos[e]);
+				}
+			j += vlen[i];
+		}
+		std::sort (want.begin(), want.end());
+		FetchRows (mat, dspl, dspls, nProcs, want, vlen, vpos, vval, comm);
+		vrow.insert (vrow.end(), want.begin(), want.end());
+		vcnt.push_back ((int) vrow.size());
+		first = last;
+	}
+
+	// The structure of the rows of all levels
+	int numR = (int) vrow.size(), numE = (int) vpos.size();
+	mp->depth = depth; mp->dim = dim;
+	CreateSparseMatrix (&(mp->ext), 0, numR, dim, numE, 0);
+	for (i=0; i<numR; i++)
+		mp->ext.vptr[i+1] = mp->ext.vptr[i] + vlen[i];
+	std::copy (vpos.begin(), vpos.end(), mp->ext.vpos);
+	std::copy (vval.begin(), vval.end(), mp->ext.vval);
+	CreateInts (&(mp->vrow), numR);
+	std::copy (vrow.begin(), vrow.end(), mp->vrow);
+	CreateInts (&(mp->vcnt), depth);
+	std::copy (vcnt.begin(), vcnt.end(), mp->vcnt);
+	CreateDoubles (&(mp->vtmp), numR);
+}
+
+// Scale the columns of the kernel by the whole vector scale, so that its
+// products are by A * diag(scale)
+void ScaleMatrixPowers (ptr_MatrixPowers mp, double *scale) {
+	int i, nnz = mp->ext.vptr[mp->ext.dim1];
+
+#pragma omp parallel for
+	for (i=0; i<nnz; i++)
+		mp->ext.vval[i] *= scale[mp->ext.vpos[i]];
+}
+
+// This routine computes vecs[j] = A^j * vecs[0], j = 1 .. num (num <= depth),
+// with spmv as product of the rows (ProdSparseMatrixVectorByRows or a
+// variant). vecs[0] is a whole vector, vecs[j] are whole vectors of which
+// the rows at distance at most num-j are written, among them the local ones.
+void ProdMatrixPowers (MatrixPowers mp, int num, double **vecs,
+												void (*spmv) (SparseMatrix, int, double *, double *)) {
+	int i, j;
+	SparseMatrix rows = mp.ext;
+
+	for (j=1; j<=num; j++) {
+		// The first rows of ext are the ones at distance at most num-j
+		rows.dim1 = mp.vcnt[num-j];
+		InitDoubles (mp.vtmp, rows.dim1, 0.0, 0.0);
+		spmv (rows, 0, vecs[j-1], mp.vtmp);
+		double *dst = vecs[j];
+#pragma omp parallel for
+		for (i=0; i<rows.dim1; i++)
+			dst[mp.vrow[i]] = mp.vtmp[i];
+	}
+}
+
+// This routine liberates the memory related to mp
+void RemoveMatrixPowers (ptr_MatrixPowers mp) {
+	RemoveSparseMatrix (&(mp->ext));
+	RemoveInts (&(mp->vrow)); RemoveInts (&(mp->vcnt));
+	RemoveDoubles (&(mp->vtmp));
+	mp->depth = 0; mp->dim = 0;
+}
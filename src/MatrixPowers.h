@@ -0,0 +1,48 @@
+#ifndef MatrixPowersTip
+
+#define MatrixPowersTip 1
+
+#include <mpi.h>
+#include <SparseProduct.h>
+
+/*********************************************************************************/
+
+// Matrix powers kernel: the products A^j * v, j = 1 .. depth, on the local
+// rows of a matrix distributed by rows, from one gathered vector v and
+// without any other communication. Besides its own rows, every process keeps
+// the rows at distance less than depth of them in the graph of the matrix
+// (the halo), fetched once from their owners, and computes the power j on
+// the rows at distance at most depth-j. The rows are copied as they are, so
+// every entry of A^j * v is the same as with depth products by the matrix.
+typedef struct {
+	int depth;          // highest power
+	int dim;            // size of the whole vectors
+	int *vcnt;          // vcnt[k], rows at distance at most k (k = 0 .. depth-1)
+	int *vrow;          // global index of every row of ext
+	SparseMatrix ext;   // local rows, then the halo by increasing distance
+	double *vtmp;       // products on the rows of ext
+} MatrixPowers, *ptr_MatrixPowers;
+
+/*********************************************************************************/
+
+// Build the kernel of the given depth from the local rows of mat, which are
+// the rows dspls[myId] .. dspls[myId]+sizes[myId]-1 (as in DistributeMatrix)
+// with global columns. Collective on comm.
+extern void CreateMatrixPowers (SparseMatrix mat, int *sizes, int *dspls, int depth, MPI_Comm comm,
+																	ptr_MatrixPowers mp);
+
+// Scale the columns of the kernel by the whole vector scale, so that its
+// products are by A * diag(scale)
+extern void ScaleMatrixPowers (ptr_MatrixPowers mp, double *scale);
+
+// This routine computes vecs[j] = A^j * vecs[0], j = 1 .. num (num <= depth),
+// with spmv as product of the rows (ProdSparseMatrixVectorByRows or a
+// variant). vecs[0] is a whole vector, vecs[j] are whole vectors of which
+// the rows at distance at most num-j are written, among them the local ones.
+extern void ProdMatrixPowers (MatrixPowers mp, int num, double **vecs,
+																void (*spmv) (SparseMatrix, int, double *, double *));
+
+// This routine liberates the memory related to mp
+extern void RemoveMatrixPowers (ptr_MatrixPowers mp);
+
+#endif
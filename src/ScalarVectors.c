@@ -81,6 +81,23 @@ void RemoveDoubles (double **vdbl) {
 	if (*vdbl != NULL) free (*vdbl); *vdbl = NULL; 
 }
 
+void CreateFloats (float **vflt, int dim) {
+	if ((*vflt = (float *) malloc (sizeof(float)*dim)) == NULL)
+		{ printf ("Memory Error (CreateFloats(%d))\n", dim); exit (1); }
+}
+
+void RemoveFloats (float **vflt) { 
+	if (*vflt != NULL) free (*vflt); *vflt = NULL; 
+}
+
+// The values of src are rounded to the nearest float
+void CopyDoublesToFloats (double *src, float *dst, int dim) {
+	int i;
+
+	for (i=0; i<dim; i++) 
+		dst[i] = (float) src[i];
+}
+
 void InitDoubles (double *vdbl, int dim, double frst, double incr) {
 	int i; 
 	double *pd = vdbl, num = frst;
@@ -129,5 +146,39 @@ void VvecDoubles (double alfa, double *src1, double *src2, double beta, double *
     }
 }
 
+// z = y + a * x, then dst = beta * dst + alfa * src * z as VvecDoubles, in one pass
+void AxpyVvecDoubles (double a, double *x, double *y, double *z, double alfa, double *src, double beta, double *dst, int dim) {
+    int i;
+
+    for (i = 0; i < dim; i++) {
+        double zi = fma(a, x[i], y[i]);
+        z[i] = zi;
+        double tmp = alfa * src[i] * zi;
+        dst[i] = fma(beta, dst[i], tmp);
+    }
+}
+
+// Same as VvecDoubles, with src1 stored as floats
+void VvecDoublesF (double alfa, float *src1, double *src2, double beta, double *dst, int dim) {
+    int i;
+
+    for (i = 0; i < dim; i++) {
+        double tmp = alfa * (double) src1[i] * src2[i];
+        dst[i] = fma(beta, dst[i], tmp);
+    }
+}
+
+// Same as AxpyVvecDoubles, with src stored as floats
+void AxpyVvecDoublesF (double a, double *x, double *y, double *z, double alfa, float *src, double beta, double *dst, int dim) {
+    int i;
+
+    for (i = 0; i < dim; i++) {
+        double zi = fma(a, x[i], y[i]);
+        z[i] = zi;
+        double tmp = alfa * (double) src[i] * zi;
+        dst[i] = fma(beta, dst[i], tmp);
+    }
+}
+
 
 /*********************************************************************************/
@@ -27,6 +27,12 @@ extern void CreateDoubles (double **vdbl, int dim);
 
 extern void RemoveDoubles (double **vdbl); 
 
+extern void CreateFloats (float **vflt, int dim);
+
+extern void RemoveFloats (float **vflt); 
+
+extern void CopyDoublesToFloats (double *src, float *dst, int dim);
+
 extern void InitDoubles (double *vdbl, int dim, double frst, double incr);
 		
 extern void InitRandDoubles (double *vdbl, int dim, double frst, double last);
@@ -39,4 +45,10 @@ extern double DotDoubles (double *vdbl1, double *vdbl2, int dim);
 
 extern void VvecDoubles (double alfa, double *src1, double *src2, double beta, double *dst, int dim);
 
+extern void AxpyVvecDoubles (double a, double *x, double *y, double *z, double alfa, double *src, double beta, double *dst, int dim);
+
+extern void VvecDoublesF (double alfa, float *src1, double *src2, double beta, double *dst, int dim);
+
+extern void AxpyVvecDoublesF (double a, double *x, double *y, double *z, double alfa, float *src, double beta, double *dst, int dim);
+
 /*********************************************************************************/
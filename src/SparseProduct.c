@@ -7,6 +7,8 @@
 #include "hb_io.h"
 #include "SparseProduct.h"
 
+#include "exblas/exdot.h"
+
 /*********************************************************************************/
 
 // This routine creates a sparseMatrix from the next parameters
@@ -37,6 +39,24 @@ void RemoveSparseMatrix (ptr_SparseMatrix spr) {
 	RemoveInts (&(spr->vptr)); RemoveDoubles (&(spr->vval)); 
 }
 
+// This routine creates the matrix dst with the structure of src and its values
+// rounded to float. The vectors of indices are shared, not copied.
+void CreateSparseMatrixF (SparseMatrix src, ptr_SparseMatrixF dst) {
+	int nnz = src.vptr[src.dim1] - src.vptr[0];
+
+	dst->dim1 = src.dim1; dst->dim2 = src.dim2;
+	dst->vptr = src.vptr; dst->vpos = src.vpos;
+	CreateFloats (&(dst->vval), nnz);
+	CopyDoublesToFloats (src.vval, dst->vval, nnz);
+}
+
+// This routine liberates the values of matrix spr (not the shared indices)
+void RemoveSparseMatrixF (ptr_SparseMatrixF spr) {
+	spr->dim1 = -1; spr->dim2 = -1; 
+	spr->vptr = NULL; spr->vpos = NULL;
+	RemoveFloats (&(spr->vval)); 
+}
+
 /*********************************************************************************/
 
 // This routine creates de sparse matrix dst from the symmetric matrix spr.
@@ -286,6 +306,98 @@ void ProdSparseMatrixVectorByRows_OMP (SparseMatrix spr, int index, double *vec,
 	}
 }
 
+// This routine computes the product { res += spr * vec }, where every row
+// is summed exactly together with res and rounded once to nearest. The result
+// does not depend on the order of the entries or on the number of threads.
+// The parameter index indicates if 0-indexing or 1-indexing is used,
+void ProdSparseMatrixVectorByRows_Exact (SparseMatrix spr, int index, double *vec, double *res) {
+	int i, dim = spr.dim1;
+	int *pp1 = spr.vptr, *pi1 = spr.vpos + *pp1 - index;
+	double *pvec = vec + *pp1 - index;
+	double *pd1 = spr.vval + *pp1 - index;
+
+	// Process all the rows of the matrix
+	#pragma omp parallel for schedule(static)
+	for (i=0; i<dim; i++) {
+		int64_t acc[exblas::BIN_COUNT];
+		// The exact dot product between the row i and the vector vec is computed
+		exblas::cpu::exdot_gather (pp1[i+1]-pp1[i], pd1+pp1[i], pi1+pp1[i], pvec, acc);
+		// Accumulate the previous value of the result before the rounding
+		exblas::cpu::Accumulate (acc, res[i]);
+		res[i] = exblas::cpu::Round (acc);
+	}
+}
+
+// This routine computes the product { res += spr * vec } by a block of k
+// vectors, vec and res stored by rows (the k values of every row together).
+// The entries of a row are read once for every SPMM_COLS vectors, and every
+// column of res is the same as with ProdSparseMatrixVectorByRows.
+// The parameter index indicates if 0-indexing or 1-indexing is used,
+void ProdSparseMatrixBlockByRows (SparseMatrix spr, int index, int k, double *vec, double *res) {
+	int i, j, l, c, dim = spr.dim1;
+	int *pp1 = spr.vptr, *pi1 = spr.vpos + *pp1 - index;
+	double *pvec = vec + (size_t) (*pp1 - index) * k;
+	double *pd1 = spr.vval + *pp1 - index;
+
+	// Process all the rows of the matrix
+	#pragma omp parallel for private(j, l, c)
+	for (i=0; i<dim; i++) {
+		for (c=0; c<k; c+=SPMM_COLS) {
+			int nc = (k - c < SPMM_COLS) ? k - c : SPMM_COLS;
+			double aux[SPMM_COLS] = {0.0};
+			// The dot products between the row i and the vectors c .. c+nc-1 are computed
+			for (j=pp1[i]; j<pp1[i+1]; j++) {
+				double val = pd1[j], *pv = pvec + (size_t) pi1[j] * k + c;
+				for (l=0; l<nc; l++)
+					aux[l] = fma(val, pv[l], aux[l]);
+			}
+			// Accumulate the obtained values on the result
+			for (l=0; l<nc; l++)
+				res[(size_t) i * k + c + l] += aux[l];
+		}
+	}
+}
+
+// This routine computes the product { res += spr * vec }, with the float
+// values of spr widened to double on load.
+// The parameter index indicates if 0-indexing or 1-indexing is used,
+void ProdSparseMatrixFVectorByRows (SparseMatrixF spr, int index, double *vec, double *res) {
+	int i, j, dim = spr.dim1;
+	int *pp1 = spr.vptr, *pi1 = spr.vpos + *pp1 - index;
+	double aux, *pvec = vec + *pp1 - index;
+	float *pd1 = spr.vval + *pp1 - index;
+
+	// Process all the rows of the matrix
+	for (i=0; i<dim; i++) {
+		// The dot product between the row i and the vector vec is computed
+		aux = 0.0;
+		for (j=pp1[i]; j<pp1[i+1]; j++)
+			aux = fma((double) pd1[j], pvec[pi1[j]], aux);
+		// Accumulate the obtained value on the result
+		res[i] += aux; 
+	}
+}
+
+// Same as ProdSparseMatrixVectorByRows_Exact, with the float values of spr
+// The parameter index indicates if 0-indexing or 1-indexing is used,
+void ProdSparseMatrixFVectorByRows_Exact (SparseMatrixF spr, int index, double *vec, double *res) {
+	int i, dim = spr.dim1;
+	int *pp1 = spr.vptr, *pi1 = spr.vpos + *pp1 - index;
+	double *pvec = vec + *pp1 - index;
+	float *pd1 = spr.vval + *pp1 - index;
+
+	// Process all the rows of the matrix
+	#pragma omp parallel for schedule(static)
+	for (i=0; i<dim; i++) {
+		int64_t acc[exblas::BIN_COUNT];
+		// The exact dot product between the row i and the vector vec is computed
+		exblas::cpu::exdot_gather (pp1[i+1]-pp1[i], pd1+pp1[i], pi1+pp1[i], pvec, acc);
+		// Accumulate the previous value of the result before the rounding
+		exblas::cpu::Accumulate (acc, res[i]);
+		res[i] = exblas::cpu::Round (acc);
+	}
+}
+
 /*void ProdSparseMatrixVectorByRows_OMPTasks (SparseMatrix spr, int index, double *vec, double *res, int bm) {
 	int i, dim = spr.dim1;
 
@@ -2,6 +2,12 @@
 
 #define SparseProductTip 1
 
+// Vectors of a block multiplied together by ProdSparseMatrixBlockByRows,
+// whose partial sums of a row stay in registers
+#ifndef SPMM_COLS
+#define SPMM_COLS 8
+#endif
+
 typedef struct
 	{
 		int dim1, dim2;
@@ -10,6 +16,16 @@ typedef struct
 		double *vval;
 	} SparseMatrix, *ptr_SparseMatrix;
 
+// Same structure with the values stored as floats, to halve their traffic.
+// The vectors of indices are shared with the SparseMatrix it comes from.
+typedef struct
+	{
+		int dim1, dim2;
+		int *vptr;
+		int *vpos;
+		float *vval;
+	} SparseMatrixF, *ptr_SparseMatrixF;
+
 /*********************************************************************************/
 
 // This routine creates a sparseMatrix from the next parameters
@@ -25,6 +41,13 @@ extern void CreateSparseMatrix (ptr_SparseMatrix p_spr, int index, int numR, int
 // This routine liberates the memory related to matrix spr
 extern void RemoveSparseMatrix (ptr_SparseMatrix spr);
 
+// This routine creates the matrix dst with the structure of src and its values
+// rounded to float. The vectors of indices are shared, not copied.
+extern void CreateSparseMatrixF (SparseMatrix src, ptr_SparseMatrixF dst);
+
+// This routine liberates the values of matrix spr (not the shared indices)
+extern void RemoveSparseMatrixF (ptr_SparseMatrixF spr);
+
 /*********************************************************************************/
 
 // This routine creates de sparse matrix dst from the symmetric matrix spr.
@@ -58,6 +81,26 @@ extern void ProdSparseMatrixVectorByRows (SparseMatrix spr, int index, double *v
 // The parameter index indicates if 0-indexing or 1-indexing is used,
 extern void ProdSparseMatrixVectorByRows_OMP (SparseMatrix spr, int index, double *vec, double *res);
 
+// This routine computes the product { res += spr * vec }, with every row
+// summed exactly and rounded once, independently of the order of its entries.
+// The parameter index indicates if 0-indexing or 1-indexing is used,
+extern void ProdSparseMatrixVectorByRows_Exact (SparseMatrix spr, int index, double *vec, double *res);
+
+// This routine computes the product { res += spr * vec } by a block of k
+// vectors, vec and res stored by rows (the k values of every row together).
+// Every column of res is the same as with ProdSparseMatrixVectorByRows.
+// The parameter index indicates if 0-indexing or 1-indexing is used,
+extern void ProdSparseMatrixBlockByRows (SparseMatrix spr, int index, int k, double *vec, double *res);
+
+// This routine computes the product { res += spr * vec }, with the float
+// values of spr widened to double on load.
+// The parameter index indicates if 0-indexing or 1-indexing is used,
+extern void ProdSparseMatrixFVectorByRows (SparseMatrixF spr, int index, double *vec, double *res);
+
+// Same as ProdSparseMatrixVectorByRows_Exact, with the float values of spr
+// The parameter index indicates if 0-indexing or 1-indexing is used,
+extern void ProdSparseMatrixFVectorByRows_Exact (SparseMatrixF spr, int index, double *vec, double *res);
+
 /*********************************************************************************/
 
 // This routine computes the product { res += spr * vec }.
@@ -225,3 +225,102 @@ int DistributeMatrix (SparseMatrix spr, int index, ptr_SparseMatrix sprL, int in
 	return dim;
 }
 
+// Create sprT, the local rows of the transpose of the matrix distributed by
+// rows whose local rows are sprL, with the same vdimL and vdspL. The entries
+// of every row of sprT are in increasing order of column, whatever the
+// number of processes. Collective on comm.
+void TransposeDistributedMatrix (SparseMatrix sprL, int *vdimL, int *vdspL, ptr_SparseMatrix sprT,
+																		MPI_Comm comm) {
+	int myId, nProcs;
+	int i, j, k, p, dim = sprL.dim2, dimL, dspL, nnzL = sprL.vptr[sprL.dim1] - sprL.vptr[0];
+	int *scnt = NULL, *rcnt = NULL, *sdsp = NULL, *rdsp = NULL, *vown = NULL;
+	int *sidx = NULL, *ridx = NULL, *vlen = NULL, *vnxt = NULL;
+	double *sval = NULL, *rval = NULL;
+
+	MPI_Comm_rank(comm, &myId); MPI_Comm_size(comm, &nProcs); 
+	dimL = vdimL[myId]; dspL = vdspL[myId];
+
+	// Owner of every column, and number of entries sent to each of them
+	CreateInts (&vown, dim); CreateInts (&scnt, nProcs); CreateInts (&rcnt, nProcs);
+	CreateInts (&sdsp, nProcs+1); CreateInts (&rdsp, nProcs+1);
+	for (p=0; p<nProcs; p++) 
+		for (j=vdspL[p]; j<vdspL[p]+vdimL[p]; j++) vown[j] = p;
+	InitInts (scnt, nProcs, 0, 0);
+	for (k=0; k<nnzL; k++) scnt[vown[sprL.vpos[k]]]++;
+	MPI_Alltoall (scnt, 1, MPI_INT, rcnt, 1, MPI_INT, comm);
+	sdsp[0] = rdsp[0] = 0;
+	for (p=0; p<nProcs; p++) {
+		sdsp[p+1] = sdsp[p] + scnt[p]; rdsp[p+1] = rdsp[p] + rcnt[p];
+	}
+
+	// The entries (column, global row, value), by owner and by increasing row
+	CreateInts (&sidx, 2*nnzL+1); CreateDoubles (&sval, nnzL+1);
+	CreateInts (&vnxt, nProcs); CopyInts (sdsp, vnxt, nProcs);
+	for (i=0; i<sprL.dim1; i++) 
+		for (k=sprL.vptr[i]-sprL.vptr[0]; k<sprL.vptr[i+1]-sprL.vptr[0]; k++) {
+			j = vnxt[vown[sprL.vpos[k]]]++;
+			sidx[2*j] = sprL.vpos[k]; sidx[2*j+1] = dspL + i; sval[j] = sprL.vval[k];
+		}
+	CreateInts (&ridx, 2*rdsp[nProcs]+1); CreateDoubles (&rval, rdsp[nProcs]+1);
+	MPI_Alltoallv (sval, scnt, sdsp, MPI_DOUBLE, rval, rcnt, rdsp, MPI_DOUBLE, comm);
+	nnzL = rdsp[nProcs];
+	for (p=0; p<nProcs; p++) {
+		scnt[p] *= 2; sdsp[p] *= 2; rcnt[p] *= 2; rdsp[p] *= 2;
+	}
+	MPI_Alltoallv (sidx, scnt, sdsp, MPI_INT, ridx, rcnt, rdsp, MPI_INT, comm);
+
+	// The senders and their rows are increasing, a stable counting sort by
+	// column leaves the rows increasing in every row of sprT
+	CreateSparseMatrix (sprT, 0, dimL, dim, nnzL, 0);
+	CreateInts (&vlen, dimL+1);
+	InitInts (vlen, dimL+1, 0, 0);
+	for (k=0; k<nnzL; k++) vlen[ridx[2*k]-dspL+1]++;
+	for (i=0; i<dimL; i++) vlen[i+1] += vlen[i];
+	CopyInts (vlen, sprT->vptr, dimL+1);
+	for (k=0; k<nnzL; k++) {
+		j = vlen[ridx[2*k]-dspL]++;
+		sprT->vpos[j] = ridx[2*k+1]; sprT->vval[j] = rval[k];
+	}
+
+	RemoveInts (&vown); RemoveInts (&scnt); RemoveInts (&rcnt); RemoveInts (&sdsp); RemoveInts (&rdsp);
+	RemoveInts (&sidx); RemoveInts (&ridx); RemoveInts (&vlen); RemoveInts (&vnxt);
+	RemoveDoubles (&sval); RemoveDoubles (&rval);
+}
+
+/*********************************************************************************/
+
+// Create the plan of MPI_Allgatherv (sbuf, scount, type, rbuf, rcounts, rdispls, type, comm)
+void AllgathervInit (void *sbuf, int scount, void *rbuf, int *rcounts, int *rdispls, 
+											MPI_Datatype type, MPI_Comm comm, ptr_AllgathervPlan plan) {
+	plan->sbuf = sbuf; plan->scount = scount; 
+	plan->rbuf = rbuf; plan->rcounts = rcounts; plan->rdispls = rdispls;
+	plan->type = type; plan->comm = comm;
+	plan->req = MPI_REQUEST_NULL;
+#if MPI_VERSION >= 4
+	MPI_Allgatherv_init (sbuf, scount, type, rbuf, rcounts, rdispls, type, comm, 
+												MPI_INFO_NULL, &(plan->req));
+#endif
+}
+
+// Start the collective of plan, whose buffers must not be touched until AllgathervWait
+void AllgathervStart (ptr_AllgathervPlan plan) {
+#if MPI_VERSION >= 4
+	MPI_Start (&(plan->req));
+#else
+	MPI_Iallgatherv (plan->sbuf, plan->scount, plan->type, plan->rbuf, plan->rcounts, 
+										plan->rdispls, plan->type, plan->comm, &(plan->req));
+#endif
+}
+
+// Complete the collective started by AllgathervStart
+void AllgathervWait (ptr_AllgathervPlan plan) {
+	MPI_Wait (&(plan->req), MPI_STATUS_IGNORE);
+}
+
+// This routine liberates the resources of plan
+void AllgathervFree (ptr_AllgathervPlan plan) {
+	if (plan->req != MPI_REQUEST_NULL)
+		MPI_Request_free (&(plan->req));
+}
+
+/*********************************************************************************/
@@ -62,6 +62,19 @@ typedef struct {
 } PacketNode, *ptr_PacketNode;
 
 
+/*********************************************************************************/
+
+// Allgatherv with fixed buffers, counts and displacements, set up once and
+// started at every use. It is a persistent request with MPI 4, otherwise the
+// arguments are cached and an MPI_Iallgatherv is issued at every start.
+typedef struct {
+	void *sbuf, *rbuf;
+	int scount, *rcounts, *rdispls;
+	MPI_Datatype type;
+	MPI_Comm comm;
+	MPI_Request req;
+} AllgathervPlan, *ptr_AllgathervPlan;
+
 /*********************************************************************************/
 
 extern void Synchonization (MPI_Comm Synch_Comm, char *message);
@@ -103,4 +116,26 @@ extern int ComputeSprMatrixRecvWeights (int prc_src, int sizes, MPI_Comm comm);
 extern int DistributeMatrix (SparseMatrix spr, int index, ptr_SparseMatrix sprL, int indexL,
 															int *vdimL, int *vdspL, int root, MPI_Comm comm);
 
+// Create sprT, the local rows of the transpose of the matrix distributed by
+// rows whose local rows are sprL, with the same vdimL and vdspL. The entries
+// of every row of sprT are in increasing order of column, whatever the
+// number of processes. Collective on comm.
+extern void TransposeDistributedMatrix (SparseMatrix sprL, int *vdimL, int *vdspL, ptr_SparseMatrix sprT,
+																					MPI_Comm comm);
+
+/*********************************************************************************/
+
+// Create the plan of MPI_Allgatherv (sbuf, scount, type, rbuf, rcounts, rdispls, type, comm)
+extern void AllgathervInit (void *sbuf, int scount, void *rbuf, int *rcounts, int *rdispls, 
+														MPI_Datatype type, MPI_Comm comm, ptr_AllgathervPlan plan);
+
+// Start the collective of plan, whose buffers must not be touched until AllgathervWait
+extern void AllgathervStart (ptr_AllgathervPlan plan);
+
+// Complete the collective started by AllgathervStart
+extern void AllgathervWait (ptr_AllgathervPlan plan);
+
+// This routine liberates the resources of plan
+extern void AllgathervFree (ptr_AllgathervPlan plan);
+
 #endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <hb_io.h>
+#include <vector>
+
+#include "reloj.h"
+#include "ScalarVectors.h"
+#include "SparseProduct.h"
+#include "common.h"
+
+#include "exblas/exdot_tuned.h"
+
+// ================================================================================
+
+// Number of Krylov vectors used as operands
+#define NVEC 4
+// Number of timings of each configuration, the best one is kept
+#define TRIALS 3
+
+// Time reps calls of the two kinds of dots done by the solver:
+// <r, r> alone and <q, y>, <y, y> together. The results are left in res.
+double TimeConfig (exblas::cpu::DotConfig cfg, int n, double **v, int reps, double *res) {
+    std::vector<int64_t> h_superacc(2 * exblas::BIN_COUNT);
+    double t1, t2, best = 0.0, ucpu;
+
+    exblas::cpu::CurrentDotConfig() = cfg;
+    for (int t = 0; t < TRIALS; t++) {
+        int k = 0;
+        reloj (&t1, &ucpu);
+        for (int rep = 0; rep < reps; rep++) {
+            for (int j = 0; j < NVEC-1; j++) {
+                const double *dot_x[2] = {v[j], v[j+1]}, *dot_y[2] = {v[j+1], v[j+1]};
+                exblas::cpu::exdot_tuned (n, v[j], v[j], &h_superacc[0]);
+                res[k++] = exblas::cpu::Round (&h_superacc[0]);
+                exblas::cpu::exdot_tuned (n, dot_x, dot_y, &h_superacc[0]);
+                res[k++] = exblas::cpu::Round (&h_superacc[0]);
+                res[k++] = exblas::cpu::Round (&h_superacc[exblas::BIN_COUNT]);
+            }
+            k = 0;
+        }
+        reloj (&t2, &ucpu);
+        if (t == 0 || t2 - t1 < best)
+            best = t2 - t1;
+    }
+
+    return best;
+}
+
+/*********************************************************************************/
+
+int main (int argc, char **argv) {
+    SparseMatrix mat = {0, 0, NULL, NULL, NULL}, sym = {0, 0, NULL, NULL, NULL};
+    const char *file = "exdot.conf";
+    double *v[NVEC], *aux = NULL;
+    int n, reps;
+
+    if (argc < 2) {
+        printf ("Usage: %s MAT.rb [config file (default %s)]\n", argv[0], file);
+        return 1;
+    }
+    if (argc > 2)
+        file = argv[2];
+
+    ReadMatrixHB (argv[1], &sym);
+    TransposeSparseMatrices (sym, 0, &mat, 0);
+    n = mat.dim1;
+
+    // The residuals of the solve are combinations of the Krylov vectors of
+    // the right-hand side b = A * x_c, x_c = 1/sqrt(nbrows), so use them
+    CreateDoubles (&aux, n);
+    InitDoubles (aux, n, 1.0 / sqrt(n), 0.0);
+    for (int j = 0; j < NVEC; j++) {
+        CreateDoubles (&v[j], n);
+        InitDoubles (v[j], n, 0.0, 0.0);
+        ProdSparseMatrixVectorByRows (mat, 0, (j == 0) ? aux : v[j-1], v[j]);
+        if (j > 0)
+            ScaleDoubles (v[j], 1.0 / norm_inf (n, v[j]), n);
+    }
+
+    // about 2*10^6 elements per timing
+    reps = 2000000 / (3 * (NVEC-1) * n) + 1;
+
+    // reference results, with the former hard-coded configuration
+    exblas::cpu::DotConfig ref = {8, 1, 0}, best = ref;
+    double res_ref[3 * NVEC], res[3 * NVEC];
+    double t_ref = TimeConfig (ref, n, v, reps, res_ref), t_best = t_ref;
+
+    printf ("Size: %d  Repetitions: %d\n", n, reps);
+    printf ("nbfpe early_exit check_range_first   time\n");
+    for (int nbfpe = exblas::cpu::NBFPE_MIN; nbfpe <= exblas::cpu::NBFPE_MAX; nbfpe++) {
+        for (int ee = 0; ee < 2; ee++) {
+            for (int crf = 0; crf < 2; crf++) {
+                exblas::cpu::DotConfig cfg = {nbfpe, ee, crf};
+                double t = TimeConfig (cfg, n, v, reps, res);
+                // every configuration is exact, but only keep verified ones
+                int same = (memcmp (res, res_ref, 3 * (NVEC-1) * sizeof(double)) == 0);
+                printf ("%5d %10d %17d %10.4f%s\n", nbfpe, ee, crf, t, same ? "" : "  (not reproducible, discarded)");
+                fflush (stdout);
+                if (same && t < t_best) {
+                    best = cfg; t_best = t;
+                }
+            }
+        }
+    }
+
+    printf ("Best: nbfpe %d early_exit %d check_range_first %d (%.2fx the default)\n",
+            best.nbfpe, best.early_exit, best.check_range_first, t_ref / t_best);
+    if (!exblas::cpu::WriteDotConfig (file, &best)) {
+        printf ("Cannot write %s\n", file);
+        return 1;
+    }
+    printf ("Written to %s\n", file);
+
+    for (int j = 0; j < NVEC; j++)
+        RemoveDoubles (&v[j]);
+    RemoveDoubles (&aux);
+    RemoveSparseMatrix (&mat);
+    RemoveSparseMatrix (&sym);
+
+    return 0;
+}
@@ -46,14 +46,19 @@ struct FPExpansionTraits
  * \brief This struct is meant to introduce functionality for working with
  *  floating-point expansions in conjuction with superaccumulators
  */
-template<typename T, int N, typename TRAITS=FPExpansionTraits<false,false> >
+template<typename T, int N, typename TRAITS=FPExpansionTraits<false,false>, typename ACC=int64_t>
 struct FPExpansionVect
 {
+    typedef ACC Superacc;   //!< what the expansion is flushed to (int64_t or a SuperaccWindow)
+    typedef T Value;        //!< type of the terms (double or a vector of doubles)
+    //! the same expansion with other terms or flush target
+    template<typename T2, typename ACC2> using Rebind = FPExpansionVect<T2, N, TRAITS, ACC2>;
+
     /**
      * Constructor
      * \param sa superaccumulator
      */
-    FPExpansionVect(int64_t* sa);
+    FPExpansionVect(ACC* sa);
 
     /**
      * This function accumulates value x to the floating-point expansion
@@ -73,6 +78,14 @@ struct FPExpansionVect
      */
     void Flush();
 
+    /**
+     * This function moves the non-zero terms of the expansion (every lane of
+     * them) to the expansion dst, which flushes them on overflow only
+     * \param dst usually a scalar expansion, with a few terms to flush at the end
+     */
+    template<typename FPE>
+    void FlushTo(FPE & dst);
+
 private:
     void FlushVector(T x) const;
     void Insert(T & x);
@@ -80,7 +93,7 @@ private:
     static void Swap(T & x1, T & x2);
     static T twosum(T a, T b, T & s);
 
-    int64_t* superacc;
+    ACC* superacc;
 
     // Most significant digits first!
 #ifdef _MSC_VER
@@ -91,8 +104,8 @@ private:
     T victim;
 };
 
-template<typename T, int N, typename TRAITS>
-FPExpansionVect<T,N,TRAITS>::FPExpansionVect(int64_t * sa) :
+template<typename T, int N, typename TRAITS, typename ACC>
+FPExpansionVect<T,N,TRAITS,ACC>::FPExpansionVect(ACC * sa) :
     superacc(sa),
     victim(0)
 {
@@ -114,7 +127,7 @@ inline static T TwoProductFMA(T a, T b, T &d) {
 #ifdef _WITHOUT_VCL
     d = fma(a,b,-p);
 #else
-    d = vcl::mul_sub_x(a, b, p); //extra precision even if FMA is not available
+    d = simd::mul_sub_x(a, b, p);
 #endif//_WITHOUT_VCL
     return p;
 }
@@ -125,8 +138,8 @@ inline static T FMA2Sum(T a, T b, T & s)
 {
 #ifndef _WITHOUT_VCL
     T r = a + b;
-    T z = vcl::mul_sub(1., r, a);
-    s = vcl::mul_add(1., a - vcl::mul_sub(1., r, z), b - z);
+    T z = simd::mul_sub(T(1.), r, a);
+    s = simd::mul_add(T(1.), a - simd::mul_sub(T(1.), r, z), b - z);
     return r;
 #else
     T r = a + b;
@@ -136,10 +149,11 @@ inline static T FMA2Sum(T a, T b, T & s)
 #endif//_WITHOUT_VCL
 }
 
-template<typename T, int N, typename TRAITS> UNROLL_ATTRIBUTE
-void FPExpansionVect<T,N,TRAITS>::Accumulate(T x)
+template<typename T, int N, typename TRAITS, typename ACC> UNROLL_ATTRIBUTE
+void FPExpansionVect<T,N,TRAITS,ACC>::Accumulate(T x)
 {
     // Experimental
+    using std::abs; // the vector versions are found by ADL
     if(TRAITS::CheckRangeFirst && horizontal_or(abs(x) < abs(a[N-1]))) {
         FlushVector(x);
         return;
@@ -155,8 +169,8 @@ void FPExpansionVect<T,N,TRAITS>::Accumulate(T x)
     }
 }
 
-template<typename T, int N, typename TRAITS>
-T FPExpansionVect<T,N,TRAITS>::twosum(T a, T b, T & s)
+template<typename T, int N, typename TRAITS, typename ACC>
+T FPExpansionVect<T,N,TRAITS,ACC>::twosum(T a, T b, T & s)
 {
 //#if INSTRSET > 7                       // AVX2 and later
 	// Assume Haswell-style architecture with parallel Add and FMA pipelines
@@ -171,8 +185,8 @@ T FPExpansionVect<T,N,TRAITS>::twosum(T a, T b, T & s)
 //#endif
 }
 
-template<typename T, int N, typename TRAITS>
-void FPExpansionVect<T,N,TRAITS>::Swap(T & x1, T & x2)
+template<typename T, int N, typename TRAITS, typename ACC>
+void FPExpansionVect<T,N,TRAITS,ACC>::Swap(T & x1, T & x2)
 {
     //if(TRAITS::ConditionalSwap) {
     //    swap_if_nonzero(x1, x2);
@@ -182,8 +196,8 @@ void FPExpansionVect<T,N,TRAITS>::Swap(T & x1, T & x2)
     //}
 }
 
-template<typename T, int N, typename TRAITS> UNROLL_ATTRIBUTE
-void FPExpansionVect<T,N,TRAITS>::Insert(T & x)
+template<typename T, int N, typename TRAITS, typename ACC> UNROLL_ATTRIBUTE
+void FPExpansionVect<T,N,TRAITS,ACC>::Insert(T & x)
 {
     if(TRAITS::Sort) {
         // Insert at tail. Unconditional version.
@@ -214,8 +228,8 @@ void FPExpansionVect<T,N,TRAITS>::Insert(T & x)
     }
 }
 
-template<typename T, int N, typename TRAITS> UNROLL_ATTRIBUTE
-void FPExpansionVect<T,N,TRAITS>::Insert(T & x1, T & x2)
+template<typename T, int N, typename TRAITS, typename ACC> UNROLL_ATTRIBUTE
+void FPExpansionVect<T,N,TRAITS,ACC>::Insert(T & x1, T & x2)
 {
     if(TRAITS::Sort) {
         // x1 <= a[0]
@@ -246,8 +260,8 @@ void FPExpansionVect<T,N,TRAITS>::Insert(T & x1, T & x2)
 #undef IACA_START
 #undef IACA_END
 
-template<typename T, int N, typename TRAITS>
-void FPExpansionVect<T,N,TRAITS>::Flush()
+template<typename T, int N, typename TRAITS, typename ACC>
+void FPExpansionVect<T,N,TRAITS,ACC>::Flush()
 {
     for(unsigned int i = 0; i != N; ++i)
     {
@@ -259,8 +273,22 @@ void FPExpansionVect<T,N,TRAITS>::Flush()
     }
 }
 
-template<typename T, int N, typename TRAITS> inline
-void FPExpansionVect<T,N,TRAITS>::FlushVector(T x) const
+template<typename T, int N, typename TRAITS, typename ACC> template<typename FPE>
+void FPExpansionVect<T,N,TRAITS,ACC>::FlushTo(FPE & dst)
+{
+    const int W = sizeof(T) / sizeof(double);
+    for(unsigned int i = 0; i != N; ++i)
+    {
+        const double* v = (const double*)&a[i];
+        for(int j = 0; j != W; ++j)
+            if(v[j] != 0.)
+                dst.Accumulate(v[j]);
+        a[i] = 0;
+    }
+}
+
+template<typename T, int N, typename TRAITS, typename ACC> inline
+void FPExpansionVect<T,N,TRAITS,ACC>::FlushVector(T x) const
 {
     // TODO: update status, handle Inf/Overflow/NaN cases
     // TODO: make it work for other values of 4
@@ -16,6 +16,7 @@
  *        Matthias Wiesenberger -- mattwi@fysik.dtu.dk
  */
 #pragma once
+#include <algorithm>
 #include "config.h"
 #include "mylibm.hpp"
 #include "nearsum.hpp"
@@ -27,48 +28,55 @@ namespace cpu {
 //********* Here, the change from float to double happens ***************//
 ///////////////////////////////////////////////////////////////////////////
 #ifndef _WITHOUT_VCL
-static inline vcl::Vec8d make_vcl_vec8d( double x, int i){
-    return vcl::Vec8d(x);
+static inline simd::Vecd make_simd_vec( double x, int i){
+    return simd::Vecd(x);
 }
-static inline vcl::Vec8d make_vcl_vec8d( const double* x, int i){
-    return vcl::Vec8d().load( x+i);
+static inline simd::Vecd make_simd_vec( const double* x, int i){
+    return simd::Vecd().load( x+i);
 }
-static inline vcl::Vec8d make_vcl_vec8d( double x, int i, int num){
-    return vcl::Vec8d(x);
+// partial vectors: the lanes from num on are zero
+static inline simd::Vecd make_simd_vec( double x, int i, int num){
+    return simd::Vecd(x).cutoff( num);
 }
-static inline vcl::Vec8d make_vcl_vec8d( const double* x, int i, int num){
-    return vcl::Vec8d().load_partial( num, x+i);
+static inline simd::Vecd make_simd_vec( const double* x, int i, int num){
+    return simd::Vecd().load_partial( num, x+i);
 }
-static inline vcl::Vec8d make_vcl_vec8d( float x, int i){
-    return vcl::Vec8d((double)x);
+static inline simd::Vecd make_simd_vec( float x, int i){
+    return simd::Vecd((double)x);
 }
-static inline vcl::Vec8d make_vcl_vec8d( const float* x, int i){
-    double tmp[8];
-    for(int i=0; i<8; i++)
-        tmp[i] = (double)x[i];
-    return vcl::Vec8d().load( tmp);
+static inline simd::Vecd make_simd_vec( const float* x, int i){
+    double tmp[simd::Vecd::size];
+    for(int j=0; j<simd::Vecd::size; j++)
+        tmp[j] = (double)x[i+j];
+    return simd::Vecd().load( tmp);
 }
-static inline vcl::Vec8d make_vcl_vec8d( float x, int i, int num){
-    return vcl::Vec8d((double)x);
+static inline simd::Vecd make_simd_vec( float x, int i, int num){
+    return simd::Vecd((double)x).cutoff( num);
 }
-static inline vcl::Vec8d make_vcl_vec8d( const float* x, int i, int num){
-    double tmp[8];
-    for(int i=0; i<num; i++)
-        tmp[i] = (double)x[i];
-    return vcl::Vec8d().load_partial( num, tmp);
+static inline simd::Vecd make_simd_vec( const float* x, int i, int num){
+    double tmp[simd::Vecd::size];
+    for(int j=0; j<num; j++)
+        tmp[j] = (double)x[i+j];
+    return simd::Vecd().load_partial( num, tmp);
 }
 #endif//_WITHOUT_VCL
 template<class T>
-inline double get_element( const T x, int i){
+inline double get_element( const T* x, int i){
 	return (double)(*(x+i));
 }
+inline double get_element( double x, int i){
+	return x;
+}
+inline double get_element( float x, int i){
+	return (double)x;
+}
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Main computation pass: compute partial superaccs
 ////////////////////////////////////////////////////////////////////////////////
 ///@cond
-static inline void AccumulateWord( int64_t *accumulator, int i, int64_t x) {
+static inline void AccumulateWord( int64_t *accumulator, int i, int64_t x, int count = BIN_COUNT) {
     // With atomic accumulator updates
     // accumulation and carry propagation can happen in any order,
     // as long as addition is atomic
@@ -99,7 +107,7 @@ static inline void AccumulateWord( int64_t *accumulator, int i, int64_t x) {
         carry += carrybit;
 
         ++i;
-        if (i >= BIN_COUNT){
+        if (i >= count){
             //status = Overflow;
             return;
         }
@@ -111,6 +119,13 @@ static inline void AccumulateWord( int64_t *accumulator, int i, int64_t x) {
 /**
 * @brief Accumulate a double to the superaccumulator
 *
+* The last bit of the superaccumulator (word \c IMIN) has the weight
+* 2^-(DIGITS*F_WORDS) = 2^-1040, so the accumulation is exact for the doubles
+* from 2^-988 on. The bits of smaller values, subnormals included, are
+* rounded to the nearest multiple of 2^-1040 before they are added, each
+* value on its own: sums of such values are still reproducible, but no longer
+* exact. Subnormals are scaled by \c DELTASCALE first, which is exact.
+*
 * @ingroup lowlevel
 * @param accumulator a pointer to at least \c BIN_COUNT 64 bit integers on the CPU (representing the superaccumulator)
 * @param x the double to add to the superaccumulator
@@ -119,15 +134,22 @@ static inline void Accumulate( int64_t* accumulator, double x) {
     if (x == 0)
         return;
 
+    // a subnormal is scaled exactly by one word, and accumulated one word lower
+    int shift = 0;
+    if (unlikely(cpu::biased_exponent(x) == 0)) {
+        x *= DELTASCALE;
+        shift = 1;
+    }
 
     int e = cpu::exponent(x);
     int exp_word = e / DIGITS;  // Word containing MSbit (upper bound)
-    int iup = exp_word + F_WORDS;
+    int iup = exp_word + F_WORDS - shift;
 
     double xscaled = cpu::myldexp(x, -DIGITS * exp_word);
 
+    // the bits below the last word are rounded into it
     int i;
-    for (i = iup; xscaled != 0; --i) {
+    for (i = iup; xscaled != 0 && i >= IMIN; --i) {
         double xrounded = cpu::myrint(xscaled);
         int64_t xint = cpu::myllrint(xscaled);
         AccumulateWord(accumulator, i, xint);
@@ -136,28 +158,137 @@ static inline void Accumulate( int64_t* accumulator, double x) {
         xscaled *= DELTASCALE;
     }
 }
+
+/**
+* @brief Window of NW words of a superaccumulator, in front of the full one
+*
+* Floating point expansions flush their values into the window, which fits in
+* one or two cache lines instead of the BIN_COUNT words of the whole range.
+* It is placed by the first value flushed into it, with three words of room
+* above that value and NW-7 words below it. The top word only takes carries. Values that fall outside go
+* to the full superaccumulator, so the sum is the same as without the window. Finish adds the window
+* to the full superaccumulator. NW = 0 disables the window.
+*
+* @ingroup lowlevel
+* @tparam NW number of words of the window (0 or at least 8)
+*/
+template<int NW>
+struct SuperaccWindow {
+    static_assert(NW == 0 || (NW >= 8 && NW <= BIN_COUNT), "the window needs between 8 and BIN_COUNT words");
+    int64_t* full;      //!< full superaccumulator (fallback and destination)
+    int lo;             //!< word of the full superaccumulator matching word 0 of the window, -1 until placed
+    int64_t w[NW];      //!< words of the window
+
+    void Init( int64_t* accumulator) {
+        full = accumulator;
+        lo = -1;
+        std::fill(w, w + NW, 0);
+    }
+    void Finish() {
+        for(int j = 0; lo >= 0 && j < NW; j++)
+            if(w[j] != 0)
+                AccumulateWord(full, lo + j, w[j]);
+        Init(full);
+    }
+};
+///@cond
+template<>
+struct SuperaccWindow<0> {
+    int64_t* full;
+    void Init( int64_t* accumulator) { full = accumulator; }
+    void Finish() {}
+};
+///@endcond
+
+/**
+* @brief Accumulate a double to a window of a superaccumulator
+*
+* @ingroup lowlevel
+* @param win the window (the full superaccumulator receives the values that do not fit)
+* @param x the double to add
+*/
+template<int NW>
+static inline void Accumulate( SuperaccWindow<NW>* win, double x) {
+    if (x == 0)
+        return;
+    if (unlikely(cpu::biased_exponent(x) == 0)) {
+        Accumulate(win->full, x);
+        return;
+    }
+
+    int e = cpu::exponent(x);
+    int exp_word = e / DIGITS;  // Word containing MSbit (upper bound)
+    int iup = exp_word + F_WORDS;
+    if (unlikely(win->lo < 0))
+        win->lo = std::min(std::max(iup + 4 - (NW - 1), IMIN), BIN_COUNT - NW);
+    // x covers the words iup down to iup-2 at most, the top word is kept for carries
+    int i = iup - win->lo;
+    if (unlikely(i < 2 || i > NW - 2)) {
+        Accumulate(win->full, x);
+        return;
+    }
+
+    double xscaled = cpu::myldexp(x, -DIGITS * exp_word);
+    for (; xscaled != 0; --i) {
+        double xrounded = cpu::myrint(xscaled);
+        int64_t xint = cpu::myllrint(xscaled);
+        AccumulateWord(win->w, i, xint, NW);
+
+        xscaled -= xrounded;
+        xscaled *= DELTASCALE;
+    }
+}
+///@cond
+static inline void Accumulate( SuperaccWindow<0>* win, double x) {
+    Accumulate(win->full, x);
+}
+///@endcond
+
 #ifndef _WITHOUT_VCL
-static inline void Accumulate( int64_t* accumulator, vcl::Vec8d x) {
-    double v[8];
+/**
+* @brief Accumulate all the lanes of a vector to the superaccumulator
+*
+* @ingroup lowlevel
+* @param accumulator a pointer to at least \c BIN_COUNT 64 bit integers on the CPU (representing the superaccumulator)
+* @param x the doubles to add to the superaccumulator
+*/
+static inline void Accumulate( int64_t* accumulator, simd::Vecd x) {
+    double v[simd::Vecd::size];
     x.store(v);
 
-#if INSTRSET >= 7
-    _mm256_zeroupper();
-#endif
-    for(unsigned int j = 0; j != 8; ++j) {
+    // the compiler inserts vzeroupper itself before the scalar code if needed;
+    // doing it by hand here clobbers the expansions still held in registers
+    for(int j = 0; j != simd::Vecd::size; ++j) {
         exblas::cpu::Accumulate(accumulator, v[j]);
     }
 }
+
+/**
+* @brief Accumulate all the lanes of a vector to a window of a superaccumulator
+*
+* @ingroup lowlevel
+* @param win the window (the full superaccumulator receives the values that do not fit)
+* @param x the doubles to add
+*/
+template<int NW>
+static inline void Accumulate( SuperaccWindow<NW>* win, simd::Vecd x) {
+    double v[simd::Vecd::size];
+    x.store(v);
+
+    for(int j = 0; j != simd::Vecd::size; ++j) {
+        exblas::cpu::Accumulate(win, v[j]);
+    }
+}
 #endif //_WITHOUT_VCL
 ////////////////////////////////////////////////////////////////////////////////
 // Normalize functions
 ////////////////////////////////////////////////////////////////////////////////
-// Returns sign
-// Does not really normalize! MW: what does that mean?
-//
 /**
 * @brief Normalize a superaccumulator
 *
+* After normalization, all the words but the last one are in [0, 2^DIGITS)
+* and the last one is signed.
+*
 * @ingroup lowlevel
 * @param accumulator a pointer to at least \c BIN_COUNT 64 bit integers on the CPU (representing the superaccumulator)
 * @param imin the first index in the accumulator
@@ -166,22 +297,23 @@ static inline void Accumulate( int64_t* accumulator, vcl::Vec8d x) {
 * @return  carry in bit (sign)
 */
 static inline bool Normalize( int64_t *accumulator, int& imin, int& imax) {
-    int64_t carry_in = accumulator[imin] >> DIGITS;
-    accumulator[imin] -= carry_in << DIGITS;
+    // The carries form a dependency chain of two instructions per word
+    // (add, shift), the digits are extracted off that chain with a mask
+    const int64_t mask = (1ll << DIGITS) - 1;
+    int64_t carry_in = 0;
     int i;
     // Sign-extend all the way
-    for (i = imin + 1; i < BIN_COUNT; ++i) {
+    for (i = imin; i < IMAX; ++i) {
         accumulator[i] += carry_in;
-        int64_t carry_out = accumulator[i] >> DIGITS;    // Arithmetic shift
-        accumulator[i] -= (carry_out << DIGITS);
-        carry_in = carry_out;
+        carry_in = accumulator[i] >> DIGITS;    // Arithmetic shift
+        accumulator[i] &= mask;
     }
-    imax = i - 1;
+    imax = i;
 
     // Do not cancel the last carry to avoid losing information
-    accumulator[imax] += carry_in << DIGITS;
+    accumulator[imax] += carry_in;
 
-    return carry_in < 0;
+    return accumulator[imax] < 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -246,6 +378,10 @@ static inline double RoundStickyBit( int64_t * accumulator) {
 /**
 * @brief Convert a superaccumulator to the nearest double precision number (CPU version)
 *
+* The leading words are gathered in a signed 128 bit integer, the other words
+* only contribute a sticky bit, and the magnitude is rounded once to nearest,
+* ties to even (to the subnormal grid if needed).
+*
 * @ingroup highlevel
 * @param accumulator a pointer to at least \c BIN_COUNT 64 bit integers on the CPU (representing the superaccumulator)
 * @return the double precision number nearest to the superaccumulator
@@ -255,60 +391,46 @@ static inline double Round( int64_t * accumulator) {
     int imax = IMAX;
     bool negative = Normalize(accumulator, imin, imax);
 
-    // Find leading word
-    // Skip zeroes
-    int i;
-    for(i = imax; accumulator[i] == 0 && i >= imin; --i) {
+    // Leading zeros (or ones if negative) vanish by themselves: the integer
+    // stays 0 (or -1) until the first significant word. Stop at 76 bits,
+    // enough for the 53 bits of the result and the guard bits.
+    const __int128 limit = (__int128) 1 << 75;
+    __int128 m = accumulator[IMAX];
+    int j;
+    for (j = IMAX - 1; j >= IMIN && m < limit && m > -limit; --j) {
+        m = m * (1ll << DIGITS) + accumulator[j];
     }
-    if (negative) {
-        // Skip ones
-        for(; (accumulator[i] & ((1ll << DIGITS) - 1)) == ((1ll << DIGITS) - 1) && i >= imin; --i) {
-        }
+    // The value is m * 2^e + low, with 0 <= low < 2^e
+    int64_t sticky = 0;
+    for (int k = j; k >= IMIN; --k) {
+        sticky |= accumulator[k];
     }
-    if (i < 0) {
+    int e = (j + 1 - F_WORDS) * DIGITS;
+    // Magnitude: -(m * 2^e + low) = (-m - 1) * 2^e + (2^e - low) when low > 0
+    unsigned __int128 mag = negative ? (unsigned __int128) (-m) - (sticky != 0) : (unsigned __int128) m;
+    if (mag == 0) {
         return 0.0;
     }
-    imax = i;
-
-    // find actual imin
-    // Skip zeroes
-    int ii;
-    for(ii = imin; accumulator[ii] == 0 && ii <= imax; ++ii) {
-    }
-    if (negative) {
-        // Skip ones
-        for(; (accumulator[ii] & ((1ll << DIGITS) - 1)) == ((1ll << DIGITS) - 1) && ii <= imax; ++ii) {
-        }
-    }
-    imin = ii;
-
-    // form array of doubles with all meaningful values of long accumulator
-    double arr[imax-imin+1];
-
-    // populate this array
-    int64_t hiword = negative ? ((1ll << DIGITS) - 1) - accumulator[i] : accumulator[i];
-    double rounded = (double)hiword;
-    double hi = ldexp(rounded, (i - F_WORDS) * DIGITS);
-    if (i == 0) {
-        hi = negative ? -hi : hi;  // Correct rounding achieved
-    }
-    int j = 0;
-    arr[j] = hi;
 
-    i--;
-    for(int ii = i; ii >= imin; --ii) {
-        ++j;
-        hiword = negative ? ((1ll << DIGITS) - 1) - accumulator[ii] : accumulator[ii];
-        rounded = (double)hiword;
-        hi = ldexp(rounded, (ii - F_WORDS) * DIGITS);
-        if (i == 0) {
-            hi = negative ? -hi : hi;  // Correct rounding achieved
-        }
-        arr[j] = hi;
+    uint64_t mhi = (uint64_t) (mag >> 64);
+    int nbits = mhi ? 128 - __builtin_clzll(mhi) : 64 - __builtin_clzll((uint64_t) mag);
+    int shift = std::max(nbits - 53, -1074 - e);
+    uint64_t mant;
+    if (shift <= 0) {
+        mant = (uint64_t) mag;    // Exact, and then there is no sticky part
+    } else if (shift > nbits) {
+        return negative ? -0.0 : 0.0;
+    } else {
+        unsigned __int128 q = (shift < 128) ? (mag >> shift) : 0;
+        unsigned __int128 rem = mag - (q << (shift & 127));
+        unsigned __int128 half = (unsigned __int128) 1 << (shift - 1);
+        mant = (uint64_t) q;
+        if (rem > half || (rem == half && (sticky != 0 || (mant & 1))))
+            ++mant;             // may give 2^53, which is still exact
+        e += shift;
     }
-
-    hi = NearSum(imax-imin+1, &arr[0], 1);
-    return negative ? -hi : hi; 
+    double hi = (e >= -1022 && e <= 1023 - 54) ? cpu::myldexp((double) mant, e) : std::ldexp((double) mant, e);
+    return negative ? -hi : hi;
 }
 
 static inline void PrintS( int64_t * accumulator) {
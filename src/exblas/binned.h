@@ -0,0 +1,405 @@
+/**
+ *  @file binned.h
+ *  @brief Reproducible dot products with binned K-fold sums
+ *
+ *  A binned sum keeps BINNED_FOLD consecutive bins of a fixed grid of
+ *  exponents, each one a primary double (the pre-rounded part of the values)
+ *  and a carry (a count of quarters of the bin). A value is split on the bins
+ *  with plain additions, so that the content of every bin only depends on the
+ *  value and on the grid, whatever the order of the additions. The sum is
+ *  reproducible, but the parts of the values below the last bin are lost and
+ *  it is not correctly rounded. It is much lighter than a superaccumulator:
+ *  BINNED_WORDS doubles, merged by a single MPI_Allreduce.
+ *
+ *  See J. Demmel, P. Ahrens and H. D. Nguyen, Efficient reproducible floating
+ *  point summation and BLAS, UCB/EECS-2016-121 (ReproBLAS).
+ */
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "config.h"
+
+namespace exblas{
+///@cond
+namespace cpu{
+
+////////////////////////////////////////////////////////////////////////////////
+// Layout and grid
+////////////////////////////////////////////////////////////////////////////////
+// A binned sum is BINNED_FOLD primaries followed by BINNED_FOLD carries. Bin i
+// of the grid has the exponent BINNED_TOP - i*BINNED_WIDTH; its primary starts
+// at 1.5*2^exponent and stays in [2^exponent, 2^(exponent+1)), so that its
+// last bit is fixed. The bins of a sum are identified by the exponent of its
+// first primary; an empty sum has a zero first primary, and a sum that met
+// an infinity or a NaN keeps it in its first primary.
+static constexpr int BINNED_TOP  = 1022;
+static constexpr int BINNED_LAST = (BINNED_TOP + 1022) / BINNED_WIDTH; //!< last bin with a normal primary
+
+static inline int BinnedExponent(int i) { return BINNED_TOP - i*BINNED_WIDTH; }
+
+static inline double BinnedBase(int i) { return std::ldexp(1.5, BinnedExponent(i)); }
+
+// Grid index of the first bin of a (non empty) sum
+static inline int BinnedIndex(const double *bin) { return (BINNED_TOP - std::ilogb(bin[0])) / BINNED_WIDTH; }
+
+// Index of the first bin able to hold values up to m in absolute value: a bin
+// takes values below 2^(BINNED_WIDTH-1) times its last bit. A renormalized
+// primary is 2^50 last bits away from the edges of its binade, so
+// 2^(51-BINNED_WIDTH) = 2^11 such additions fit before the next
+// renormalization (BINNED_BLOCK is below that). Values from 2^1009 on
+// overflow the first bin.
+static inline int BinnedIndexOf(double m) {
+    int gap = BINNED_TOP - (std::ilogb(m) + 54 - BINNED_WIDTH);
+    return std::min(std::max(gap, 0) / BINNED_WIDTH, BINNED_LAST - BINNED_FOLD + 1);
+}
+
+static inline void BinnedInit(double *bin, int i) {
+    for (int j = 0; j < BINNED_FOLD; j++) {
+        bin[j] = BinnedBase(i+j);
+        bin[BINNED_FOLD+j] = 0.;
+    }
+}
+
+// Move the bins of a finite sum up to the grid index i, dropping the ones
+// that fall off the bottom. The lost parts are below the last bin of i, so
+// they are lost whatever the order in which the values came.
+static inline void BinnedAlign(double *bin, int i) {
+    if (bin[0] == 0.) {
+        BinnedInit(bin, i);
+        return;
+    }
+    int d = BinnedIndex(bin) - i;
+    if (d <= 0)
+        return;
+    for (int j = BINNED_FOLD-1; j >= 0; j--) {
+        bin[j] = (j >= d) ? bin[j-d] : BinnedBase(i+j);
+        bin[BINNED_FOLD+j] = (j >= d) ? bin[BINNED_FOLD+j-d] : 0.;
+    }
+}
+
+// Bring the primaries back to [1.5, 1.75)*2^exponent, moving whole quarters
+// of the bin to the carries. The result only depends on the value of each bin.
+static inline void BinnedRenorm(double *bin) {
+    if (!std::isfinite(bin[0]))
+        return;
+    for (int j = 0; j < BINNED_FOLD; j++) {
+        udouble u;
+        u.d = bin[j];
+        bin[BINNED_FOLD+j] += (double) ((int) ((u.i >> 50) & 3) - 2);
+        u.i &= ~(1ll << 50);
+        u.i |= 1ll << 51;
+        bin[j] = u.d;
+    }
+}
+
+static inline double BinnedLowBit(double x) {
+    udouble u;
+    u.d = x;
+    u.i |= 1;
+    return u.d;
+}
+#ifndef _WITHOUT_VCL
+static inline simd::Vecd BinnedLowBit(simd::Vecd x) { return simd::set_low_bit(x); }
+#endif//_WITHOUT_VCL
+
+// Split x on the bins of the primaries p. Each bin takes x rounded to its
+// last bit (with the last bit of x set, so that there are no ties) and
+// passes on the exact remainder.
+template<typename T>
+inline void BinnedDeposit(T *p, T x) {
+    for (int j = 0; j < BINNED_FOLD-1; j++) {
+        T q = p[j] + BinnedLowBit(x);
+        x = x + (p[j] - q);
+        p[j] = q;
+    }
+    p[BINNED_FOLD-1] = p[BINNED_FOLD-1] + BinnedLowBit(x);
+}
+
+// Deposit the n values of buf (at most BINNED_BLOCK, padded with zeros to a
+// multiple of twice the vector width) in the renormalized sum bin
+static inline void BinnedDepositBlock(int n, const double *buf, double *bin) {
+#ifndef _WITHOUT_VCL
+    typedef simd::Vecd T;
+#else
+    typedef double T;
+#endif//_WITHOUT_VCL
+    using std::max; using std::abs;
+    const int W = sizeof(T) / sizeof(double);
+
+    if (!std::isfinite(bin[0]))
+        return;
+    T vmax(0.), vbad(0.);
+    for (int i = 0; i < n; i += W) {
+        T v;
+#ifndef _WITHOUT_VCL
+        v.load(buf+i);
+#else
+        v = buf[i];
+#endif//_WITHOUT_VCL
+        vmax = max(vmax, abs(v));
+        vbad = vbad + v * T(0.);
+    }
+    double lanes[W], m = 0.;
+#ifndef _WITHOUT_VCL
+    vmax.store(lanes);
+    if (horizontal_or(vbad)) {
+#else
+    lanes[0] = vmax;
+    if (vbad != 0.) {
+#endif//_WITHOUT_VCL
+        // infinities and NaNs replace the sum, whatever the finite values
+        for (int i = 0; i < n; i++)
+            if (!std::isfinite(buf[i]))
+                bin[0] += buf[i];
+        return;
+    }
+    for (int l = 0; l < W; l++)
+        m = std::max(m, lanes[l]);
+    if (m == 0.)
+        return;
+    BinnedAlign(bin, BinnedIndexOf(m));
+
+    // two sets of lanes, to hide the latency of the additions
+    double base[BINNED_FOLD];
+    T p0[BINNED_FOLD], p1[BINNED_FOLD];
+    int i = BinnedIndex(bin);
+    for (int j = 0; j < BINNED_FOLD; j++) {
+        base[j] = BinnedBase(i+j);
+        p0[j] = T(base[j]);
+        p1[j] = T(base[j]);
+    }
+    for (int k = 0; k < n; k += 2*W) {
+#ifndef _WITHOUT_VCL
+        BinnedDeposit(p0, T().load(buf+k));
+        BinnedDeposit(p1, T().load(buf+k+W));
+#else
+        BinnedDeposit(p0, buf[k]);
+        BinnedDeposit(p1, buf[k+1]);
+#endif//_WITHOUT_VCL
+    }
+    // the lanes hold multiples of the last bit of their bin, in the same
+    // binade as the primaries of bin, so the differences and sums are exact
+    for (int j = 0; j < BINNED_FOLD; j++) {
+        T* p[2] = {&p0[j], &p1[j]};
+        for (int s = 0; s < 2; s++) {
+#ifndef _WITHOUT_VCL
+            p[s]->store(lanes);
+#else
+            lanes[0] = *p[s];
+#endif//_WITHOUT_VCL
+            for (int l = 0; l < W; l++)
+                bin[j] += lanes[l] - base[j];
+        }
+    }
+    BinnedRenorm(bin);
+}
+
+// Add the renormalized sum src to the renormalized sum dst
+static inline void BinnedMerge(double *dst, const double *src) {
+    if (src[0] == 0.)
+        return;
+    if (dst[0] == 0.) {
+        std::copy(src, src + BINNED_WORDS, dst);
+        return;
+    }
+    if (!std::isfinite(dst[0]) || !std::isfinite(src[0])) {
+        dst[0] += src[0];
+        return;
+    }
+    double tmp[BINNED_WORDS];
+    int i = std::min(BinnedIndex(dst), BinnedIndex(src));
+    std::copy(src, src + BINNED_WORDS, tmp);
+    BinnedAlign(dst, i);
+    BinnedAlign(tmp, i);
+    for (int j = 0; j < BINNED_FOLD; j++) {
+        dst[j] += tmp[j] - BinnedBase(i+j);
+        dst[BINNED_FOLD+j] += tmp[BINNED_FOLD+j];
+    }
+    BinnedRenorm(dst);
+}
+
+// Fill buf with the n products of a and b, padded with zeros to a multiple
+// of twice the vector width, and return the padded length
+static inline int BinnedProducts(int n, const double *a, const double *b, double *buf) {
+    int i = 0;
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    for (; i + W <= n; i += W)
+        (simd::Vecd().load(a+i) * simd::Vecd().load(b+i)).store(buf+i);
+#else
+    const int W = 1;
+#endif//_WITHOUT_VCL
+    for (; i < n; i++)
+        buf[i] = a[i] * b[i];
+    int padded = (n + 2*W - 1) / (2*W) * (2*W);
+    for (; i < padded; i++)
+        buf[i] = 0.;
+    return padded;
+}
+
+// z = fma(alpha, x, y) on n elements
+static inline void BinnedAxpy(int n, double alpha, const double *x, const double *y, double *z) {
+    int i = 0;
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    const simd::Vecd va(alpha);
+    for (; i + W <= n; i += W)
+        simd::mul_add(va, simd::Vecd().load(x+i), simd::Vecd().load(y+i)).store(z+i);
+#endif//_WITHOUT_VCL
+    for (; i < n; i++)
+        z[i] = std::fma(alpha, x[i], y[i]);
+}
+
+// K binned dot products on one thread, block by block
+template<int K>
+void BinnedDOT(int N, const double* const* a, const double* const* b, double* bin) {
+    alignas(64) double buf[BINNED_BLOCK];
+    for (int s = 0; s < N; s += BINNED_BLOCK) {
+        int n = std::min(BINNED_BLOCK, N - s);
+        for (int k = 0; k < K; k++)
+            BinnedDepositBlock(BinnedProducts(n, a[k]+s, b[k]+s, buf), buf, bin + k*BINNED_WORDS);
+    }
+}
+
+// z = fma(alpha, x, y) and the K binned dots <w_k, z>, block by block. z may
+// be y and w_k may be z; the block of z is still in cache for the dots.
+template<int K>
+void BinnedAXPYDOT(int N, double alpha, const double* x, const double* y, double* z, const double* const* w, double* bin) {
+    alignas(64) double buf[BINNED_BLOCK];
+    for (int s = 0; s < N; s += BINNED_BLOCK) {
+        int n = std::min(BINNED_BLOCK, N - s);
+        BinnedAxpy(n, alpha, x+s, y+s, z+s);
+        for (int k = 0; k < K; k++)
+            BinnedDepositBlock(BinnedProducts(n, w[k]+s, z+s, buf), buf, bin + k*BINNED_WORDS);
+    }
+}
+
+// Split [0,N) among the OpenMP threads as ParallelSweep, and merge the sums
+// of the threads in their order
+template<int K, class Sweep>
+void BinnedSweep(int N, double* bin, Sweep sweep) {
+    for (int i = 0; i < K*BINNED_WORDS; i++)
+        bin[i] = 0.;
+#ifdef _OPENMP
+    int nthreads = omp_in_parallel() ? 1 : std::min(omp_get_max_threads(), N / OMP_GRAIN);
+    if (nthreads > 1) {
+        const int stride = (K*BINNED_WORDS + 7) & ~7;
+        std::vector<double> partial(nthreads*stride, 0.);
+        #pragma omp parallel num_threads(nthreads)
+        {
+            int t = omp_get_thread_num(), nt = omp_get_num_threads();
+            int blocks = (N + 7) / 8;
+            int begin = std::min(N, (int)((int64_t)blocks * t / nt) * 8);
+            int end   = std::min(N, (int)((int64_t)blocks * (t+1) / nt) * 8);
+            sweep(begin, end, &partial[t*stride]);
+        }
+        for (int t = 0; t < nthreads; t++)
+            for (int k = 0; k < K; k++)
+                BinnedMerge(bin + k*BINNED_WORDS, &partial[t*stride + k*BINNED_WORDS]);
+        return;
+    }
+#endif//_OPENMP
+    sweep(0, N, bin);
+}
+
+}//namespace cpu
+///@endcond
+
+namespace cpu{
+
+/*!@brief rounds a binned sum to a double
+ *
+ * The bins are added in a fixed order with error-free transformations, so
+ * the result only depends on the value of the sum.
+ * @ingroup highlevel
+ * @param bin pointer to \c exblas::BINNED_WORDS doubles, as filled by binned_dot
+ * @return the sum (0 if empty, an infinity or a NaN if one of the values was)
+*/
+static inline double BinnedRound(const double *bin) {
+    if (bin[0] == 0. || !std::isfinite(bin[0]))
+        return bin[0];
+    int i = BinnedIndex(bin);
+    double s = 0., e = 0.;
+    for (int j = 0; j < 2*BINNED_FOLD; j++) {
+        double a = (j % 2 == 0) ? std::ldexp(bin[BINNED_FOLD+j/2], BinnedExponent(i+j/2) - 2)
+                                : bin[j/2] - BinnedBase(i+j/2);
+        // Knuth 2Sum
+        double t = s + a, z = t - s;
+        e += (s - (t - z)) + (a - z);
+        s = t;
+    }
+    return s + e;
+}
+
+/*!@brief several reproducible dot products with binned sums
+ *
+ * Computes the K sums \f[ \sum_{i=0}^{N-1} x_{k,i} y_{k,i} \f] as binned sums of
+ * \c exblas::BINNED_FOLD bins. The products are rounded before being added and
+ * the parts of them below the last bin are lost, so the result is not exact,
+ * but it is bitwise identical for any order of the elements, any number of
+ * threads and (after ReproAllReduce) any number of processes.
+ * Threads are used as in exdot.
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @param size size N of the arrays to sum
+ * @param x1_ptr K first arrays
+ * @param x2_ptr K second arrays
+ * @param h_binned pointer to at least \c K*exblas::BINNED_WORDS doubles; the k-th sum starts at \c h_binned+k*BINNED_WORDS (contents are overwritten)
+*/
+template<int K>
+void binned_dot(unsigned size, const double* const (&x1_ptr)[K], const double* const (&x2_ptr)[K], double* h_binned) {
+    BinnedSweep<K>((int)size, h_binned, [&](int begin, int end, double* mine) {
+        const double *as[K], *bs[K];
+        for (int k = 0; k < K; k++) {
+            as[k] = x1_ptr[k] + begin;
+            bs[k] = x2_ptr[k] + begin;
+        }
+        BinnedDOT<K>(end-begin, as, bs, mine);
+    });
+}
+
+/*!@brief reproducible dot product with a binned sum
+ *
+ * @ingroup highlevel
+ * @param size size N of the arrays to sum
+ * @param x1_ptr first array
+ * @param x2_ptr second array
+ * @param h_binned pointer to at least \c exblas::BINNED_WORDS doubles (contents are overwritten)
+*/
+static inline void binned_dot(unsigned size, const double* x1_ptr, const double* x2_ptr, double* h_binned) {
+    const double* const x1[1] = {x1_ptr};
+    const double* const x2[1] = {x2_ptr};
+    binned_dot<1>(size, x1, x2, h_binned);
+}
+
+/*!@brief vector update followed by K reproducible dot products of the result, in one pass
+ *
+ * Computes \f$ z = y + \alpha x \f$ as exaxpy_dot and the binned sums of
+ * \f$ (w_k, z) \f$ as binned_dot.
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @param size size N of the arrays
+ * @param alpha scalar of the update
+ * @param x array scaled by alpha
+ * @param y array added to alpha * x (may be z)
+ * @param z updated array (output)
+ * @param w K first operands of the dot products, any of them may be z
+ * @param h_binned pointer to at least \c K*exblas::BINNED_WORDS doubles (contents are overwritten)
+*/
+template<int K>
+void binned_axpy_dot(unsigned size, double alpha, const double* x, const double* y, double* z, const double* const (&w)[K], double* h_binned) {
+    BinnedSweep<K>((int)size, h_binned, [&](int begin, int end, double* mine) {
+        const double* ws[K];
+        for (int k = 0; k < K; k++)
+            ws[k] = w[k] + begin;
+        BinnedAXPYDOT<K>(end-begin, alpha, x+begin, y+begin, z+begin, ws, mine);
+    });
+}
+
+}//namespace cpu
+}//namespace exblas
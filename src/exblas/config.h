@@ -20,18 +20,15 @@
 #endif
 
 ////////////////////////////////////////////////////////////////////////
-//include vcl if available
+//vectorize with the AVX2 (4 wide) or AVX-512 (8 wide) wrappers if available
 #ifndef _WITHOUT_VCL
 
-#define MAX_VECTOR_SIZE 512 //configuration of vcl
-#define VCL_NAMESPACE vcl
-#include "vcl/vectorclass.h" //vcl by Agner Fog, may also include immintrin.h e.g.
-#if INSTRSET <5
+#if !defined __AVX2__ || !defined __FMA__
 #define _WITHOUT_VCL
-#pragma message("WARNING: Instruction set below SSE4.1! Deactivating vectorization!")
-#elif INSTRSET <7
-#pragma message( "NOTE: If available, it is recommended to activate AVX instruction set (-mavx) or higher")
-#endif//INSTRSET
+#pragma message( "NOTE: AVX2 and FMA are not enabled (-mavx2 -mfma), exblas is not vectorized")
+#else
+#include "simd.h"
+#endif//__AVX2__
 
 #endif//_WITHOUT_VCL
 
@@ -57,8 +54,6 @@
 // Debug mode
 #define paranoid_assert(x) assert(x)
 // Making C code less readable in an attempt to make assembly more readable
-// TODO: this temporary fixes the issue with accumulation and VLC 
-#define _WITHOUT_VCL
 #if not defined _MSC_VER //there is no builtin_expect on msvc:
 #define likely(x)       __builtin_expect(!!(x), 1)
 #define unlikely(x)     __builtin_expect(!!(x), 0)
@@ -77,6 +72,17 @@ static constexpr int E_WORDS        =  19;  //!< number of lower exponent words
 static constexpr int BIN_COUNT     =  F_WORDS+E_WORDS; //!< size of superaccumulator (in 64 bit units)
 static constexpr int IMIN           = 0; //!< first index in a superaccumulator
 static constexpr int IMAX           = BIN_COUNT-1; //!< last index in a superaccumulator
+static constexpr int WIN_COUNT      =  10; //!< number of words of a superaccumulator sent by the compact reduction
+static constexpr int FLUSH_WINDOW   =  16; //!< number of words of the window superaccumulator the FPEs of exdot flush into (0: no window)
+static constexpr int OMP_GRAIN      =  8192; //!< minimum number of elements handled by each thread of a parallel exact dot
+static constexpr int EXDOT_SHORT    =  1024; //!< largest local size for which the exact dots skip the window and the threads
+static constexpr int BINNED_FOLD    =  3; //!< number of bins of a binned sum
+static constexpr int BINNED_WIDTH   =  40; //!< width of the bins of a binned sum (bits)
+static constexpr int BINNED_BLOCK   =  1024; //!< number of values deposited in a binned sum between two renormalizations
+static constexpr int BINNED_WORDS   =  2*BINNED_FOLD; //!< size of a binned sum (in doubles)
+static constexpr int FIXED_BLOCK    =  1024; //!< number of products summed in 64 bit lanes by the fixed-point dot before they are widened
+static constexpr int FPE_SIZE       =  8; //!< number of terms of the floating-point expansions of the FPE-only dots
+static constexpr int NRM2_PARTS     =  3; //!< number of superaccumulators of exnrm2 (squares of the large, medium and small values)
 static constexpr double DELTASCALE = double(1ull << DIGITS); //!< Assumes KRX>0
 
 ///@brief Characterizes the result of summation
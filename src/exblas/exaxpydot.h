@@ -0,0 +1,125 @@
+/**
+ *  @file exaxpydot.h
+ *  @brief Vector update fused with exact dot products of the updated vector
+ *
+ *  Computes \f$ z = y + \alpha x \f$ and feeds every new element of z into the
+ *  floating point expansions of the dot products \f$ (w_k, z) \f$ in the same
+ *  sweep, instead of writing z and reading it again in exdot.
+ */
+#pragma once
+#include "exdot.h"
+
+namespace exblas{
+///@cond
+namespace cpu{
+
+// z = fma(alpha, x, y) and the K dots <w_k, z>. z may be y (in place update)
+// and w_k may be z; elements of z are used straight from the registers.
+template<typename CACHE, int K>
+void ExAXPYDOTFPE(int N, double alpha, const double* x, const double* y, double* z, const double* const* w, int64_t* acc) {
+    typename CACHE::Superacc win[K];
+    alignas(CACHE) unsigned char storage[K * sizeof(CACHE)];
+    CACHE* cache = reinterpret_cast<CACHE*>(storage);
+    bool self[K];
+    for(int k = 0; k < K; k++) {
+        win[k].Init(acc + k*BIN_COUNT);
+        new (&cache[k]) CACHE(&win[k]);
+        self[k] = (w[k] == z);
+    }
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    const simd::Vecd va(alpha);
+    int r = N - N % W;
+    for(int i = 0; i < r; i+=W) {
+        simd::Vecd zi = simd::mul_add(va, simd::Vecd().load(x+i), simd::Vecd().load(y+i));
+        zi.store(z+i);
+        for(int k = 0; k < K; k++) {
+            simd::Vecd r1;
+            simd::Vecd p = TwoProductFMA(self[k] ? zi : simd::Vecd().load(w[k]+i), zi, r1);
+            cache[k].Accumulate(p);
+            cache[k].Accumulate(r1);
+        }
+    }
+    if( r != N) {
+        //update and accumulate remainder, the missing lanes are zero
+        simd::Vecd zi = simd::mul_add(va, simd::Vecd().load_partial(N-r, x+r), simd::Vecd().load_partial(N-r, y+r));
+        zi.store_partial(N-r, z+r);
+        for(int k = 0; k < K; k++) {
+            simd::Vecd r1;
+            simd::Vecd p = TwoProductFMA(self[k] ? zi : simd::Vecd().load_partial(N-r, w[k]+r), zi, r1);
+            cache[k].Accumulate(p);
+            cache[k].Accumulate(r1);
+        }
+    }
+#else// _WITHOUT_VCL
+    for(int i = 0; i < N; i++) {
+        double zi = std::fma(alpha, x[i], y[i]);
+        z[i] = zi;
+        for(int k = 0; k < K; k++) {
+            double r1;
+            double p = TwoProductFMA(self[k] ? zi : w[k][i], zi, r1);
+            cache[k].Accumulate(p);
+            cache[k].Accumulate(r1);
+        }
+    }
+#endif// _WITHOUT_VCL
+    for(int k = 0; k < K; k++) {
+        cache[k].Flush();
+        cache[k].~CACHE();
+        win[k].Finish();
+    }
+}
+
+// ExAXPYDOTFPE split among the OpenMP threads; every thread updates its own block of z.
+// Short vectors are updated first, z is still in cache for ExDOTFPE_short.
+template<typename CACHE, int K>
+void ExAXPYDOTFPE_parallel(int N, double alpha, const double* x, const double* y, double* z, const double* const* w, int64_t* acc) {
+    if( N <= EXDOT_SHORT) {
+        const double* zs[K];
+        for(int i = 0; i < N; i++)
+            z[i] = std::fma(alpha, x[i], y[i]);
+        for(int k = 0; k < K; k++)
+            zs[k] = z;
+        ExDOTFPE_short<CACHE, K>(N, w, zs, acc);
+        return;
+    }
+    ParallelSweep<K>(N, acc, [=](int begin, int end, int64_t* mine) {
+        const double* ws[K];
+        for(int k = 0; k < K; k++)
+            ws[k] = w[k]+begin;
+        ExAXPYDOTFPE<CACHE, K>(end-begin, alpha, x+begin, y+begin, z+begin, ws, mine);
+    });
+}
+
+/*!@brief vector update followed by K exact dot products of the result, in one pass
+ *
+ * Computes \f[ z_i = y_i + \alpha x_i \f] rounded once (as a fused multiply-add,
+ * like \c daxpy on FMA hardware) and the exact sums \f[ \sum_{i=0}^{N-1} w_{k,i} z_i \f]
+ * The results are bitwise identical to the update followed by exdot_multi,
+ * for any number of threads.
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @tparam NBFPE size of the floating point expansion (should be between 3 and 8)
+ * @param size size N of the arrays
+ * @param alpha scalar of the update
+ * @param x array scaled by alpha
+ * @param y array added to alpha * x (may be z)
+ * @param z updated array (output)
+ * @param w K first operands of the dot products, any of them may be z
+ * @param h_superacc pointer to at least \c K*exblas::BIN_COUNT 64 bit integers (contents are overwritten)
+*/
+template<int K, size_t NBFPE=8>
+void exaxpy_dot(unsigned size, double alpha, const double* x, const double* y, double* z, const double* const (&w)[K], int64_t* h_superacc){
+    for( int i=0; i<K*exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
+#ifndef _WITHOUT_VCL
+    ExAXPYDOTFPE_parallel<FPExpansionVect<simd::Vecd, NBFPE, FPExpansionTraits<true>, SuperaccWindow<FLUSH_WINDOW> >, K>((int)size, alpha, x, y, z, w, h_superacc);
+#else
+    ExAXPYDOTFPE_parallel<FPExpansionVect<double, NBFPE, FPExpansionTraits<true>, SuperaccWindow<FLUSH_WINDOW> >, K>((int)size, alpha, x, y, z, w, h_superacc);
+#endif//_WITHOUT_VCL
+}
+
+}//namespace cpu
+///@endcond
+
+}//namespace exblas
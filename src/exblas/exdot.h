@@ -7,7 +7,7 @@
 
 /**
  *  @file exdot.h
- *  @brief Serial version of exdot
+ *  @brief Serial and OpenMP versions of exdot
  *
  *  @authors
  *    Developers : \n
@@ -21,6 +21,12 @@
 #include <cstdio>
 #include <cmath>
 #include <iostream>
+#include <new>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "accumulate.h"
 #include "ExSUM.FPE.hpp"
@@ -33,24 +39,25 @@ template<typename CACHE, typename PointerOrValue1, typename PointerOrValue2>
 void ExDOTFPE(int N, PointerOrValue1 a, PointerOrValue2 b, int64_t* acc) {
     CACHE cache(acc);
 #ifndef _WITHOUT_VCL
-    int r = (( int64_t(N) ) & ~7ul);
-    for(int i = 0; i < r; i+=8) {
+    const int W = simd::Vecd::size;
+    int r = N - N % W;
+    for(int i = 0; i < r; i+=W) {
 #ifndef _MSC_VER
         asm ("# myloop");
 #endif
-        vcl::Vec8d r1 ;
-        vcl::Vec8d x  = TwoProductFMA(make_vcl_vec8d(a,i), make_vcl_vec8d(b,i), r1);
-        //vcl::Vec8d x  = TwoProductFMA(vcl::Vec8d().load(a+i), vcl::Vec8d().load(b+i), r1);
-        //vcl::Vec8d x  = vcl::Vec8d().load(a+i)*vcl::Vec8d().load(b+i);
+        simd::Vecd r1 ;
+        simd::Vecd x  = TwoProductFMA(make_simd_vec(a,i), make_simd_vec(b,i), r1);
+        //simd::Vecd x  = TwoProductFMA(simd::Vecd().load(a+i), simd::Vecd().load(b+i), r1);
+        //simd::Vecd x  = simd::Vecd().load(a+i)*simd::Vecd().load(b+i);
         cache.Accumulate(x);
         cache.Accumulate(r1);
     }
     if( r != N) {
         //accumulate remainder
-        vcl::Vec8d r1;
-        vcl::Vec8d x  = TwoProductFMA(make_vcl_vec8d(a,r,N-r), make_vcl_vec8d(b,r,N-r), r1);
-        //vcl::Vec8d x  = TwoProductFMA(vcl::Vec8d().load_partial(N-r, a+r), vcl::Vec8d().load_partial(N-r,b+r), r1);
-        //vcl::Vec8d x  = vcl::Vec8d().load_partial(N-r, a+r)*vcl::Vec8d().load_partial(N-r,b+r);
+        simd::Vecd r1;
+        simd::Vecd x  = TwoProductFMA(make_simd_vec(a,r,N-r), make_simd_vec(b,r,N-r), r1);
+        //simd::Vecd x  = TwoProductFMA(simd::Vecd().load_partial(N-r, a+r), simd::Vecd().load_partial(N-r,b+r), r1);
+        //simd::Vecd x  = simd::Vecd().load_partial(N-r, a+r)*simd::Vecd().load_partial(N-r,b+r);
         cache.Accumulate(x);
         cache.Accumulate(r1);
     }
@@ -65,9 +72,196 @@ void ExDOTFPE(int N, PointerOrValue1 a, PointerOrValue2 b, int64_t* acc) {
     cache.Flush();
 }
 
-/*!@brief serial version of exact dot product
+// K dot products in one sweep: every output has its own FPE, all of them are
+// fed in the same loop so that operands shared between the dots are read
+// from memory only once. The FPEs flush into windows (CACHE::Superacc) in
+// front of the superaccumulators.
+template<typename CACHE, int K, typename PointerOrValue1, typename PointerOrValue2>
+void ExDOTFPE_multi(int N, const PointerOrValue1* a, const PointerOrValue2* b, int64_t* acc) {
+    typename CACHE::Superacc win[K];
+    // FPExpansionVect has no default constructor and is over-aligned
+    alignas(CACHE) unsigned char storage[K * sizeof(CACHE)];
+    CACHE* cache = reinterpret_cast<CACHE*>(storage);
+    for(int k = 0; k < K; k++) {
+        win[k].Init(acc + k*BIN_COUNT);
+        new (&cache[k]) CACHE(&win[k]);
+    }
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    int r = N - N % W;
+    for(int i = 0; i < r; i+=W) {
+        for(int k = 0; k < K; k++) {
+            simd::Vecd r1 ;
+            simd::Vecd x  = TwoProductFMA(make_simd_vec(a[k],i), make_simd_vec(b[k],i), r1);
+            cache[k].Accumulate(x);
+            cache[k].Accumulate(r1);
+        }
+    }
+    if( r != N) {
+        //accumulate remainder
+        for(int k = 0; k < K; k++) {
+            simd::Vecd r1;
+            simd::Vecd x  = TwoProductFMA(make_simd_vec(a[k],r,N-r), make_simd_vec(b[k],r,N-r), r1);
+            cache[k].Accumulate(x);
+            cache[k].Accumulate(r1);
+        }
+    }
+#else// _WITHOUT_VCL
+    for(int i = 0; i < N; i++) {
+        for(int k = 0; k < K; k++) {
+            double r1;
+            double x = TwoProductFMA(get_element(a[k],i),get_element(b[k],i),r1);
+            cache[k].Accumulate(x);
+            cache[k].Accumulate(r1);
+        }
+    }
+#endif// _WITHOUT_VCL
+    for(int k = 0; k < K; k++) {
+        cache[k].Flush();
+        cache[k].~CACHE();
+        win[k].Finish();
+    }
+}
+
+// ExDOTFPE_multi for short vectors (at most EXDOT_SHORT elements), where the
+// fixed costs matter: the FPEs flush straight into the superaccumulators (no
+// window to set up and carry), and at the end their lanes are gathered in a
+// scalar FPE, so that only the few terms of the merged expansion are
+// accumulated instead of every lane of every term.
+template<typename CACHE, int K, typename PointerOrValue1, typename PointerOrValue2>
+void ExDOTFPE_short(int N, const PointerOrValue1* a, const PointerOrValue2* b, int64_t* acc) {
+    typedef typename CACHE::template Rebind<typename CACHE::Value, int64_t> VCACHE;
+    typedef typename CACHE::template Rebind<double, int64_t> SCACHE;
+    alignas(VCACHE) unsigned char storage[K * sizeof(VCACHE)];
+    VCACHE* cache = reinterpret_cast<VCACHE*>(storage);
+    for(int k = 0; k < K; k++)
+        new (&cache[k]) VCACHE(acc + k*BIN_COUNT);
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    int r = N - N % W;
+    for(int i = 0; i < r; i+=W) {
+        for(int k = 0; k < K; k++) {
+            simd::Vecd r1 ;
+            simd::Vecd x  = TwoProductFMA(make_simd_vec(a[k],i), make_simd_vec(b[k],i), r1);
+            cache[k].Accumulate(x);
+            cache[k].Accumulate(r1);
+        }
+    }
+    if( r != N) {
+        for(int k = 0; k < K; k++) {
+            simd::Vecd r1;
+            simd::Vecd x  = TwoProductFMA(make_simd_vec(a[k],r,N-r), make_simd_vec(b[k],r,N-r), r1);
+            cache[k].Accumulate(x);
+            cache[k].Accumulate(r1);
+        }
+    }
+#else// _WITHOUT_VCL
+    for(int i = 0; i < N; i++) {
+        for(int k = 0; k < K; k++) {
+            double r1;
+            double x = TwoProductFMA(get_element(a[k],i),get_element(b[k],i),r1);
+            cache[k].Accumulate(x);
+            cache[k].Accumulate(r1);
+        }
+    }
+#endif// _WITHOUT_VCL
+    for(int k = 0; k < K; k++) {
+        SCACHE merged(acc + k*BIN_COUNT);
+        cache[k].FlushTo(merged);
+        merged.Flush();
+        cache[k].~VCACHE();
+    }
+}
+
+// Exact sum of a[i] * v[idx[i]], for the short indexed rows of sparse
+// matrices: the gather does not vectorize, so a scalar FPE is used
+template<typename CACHE, typename T>
+void ExDOTFPE_gather(int N, const T* a, const int* idx, const double* v, int64_t* acc) {
+    CACHE cache(acc);
+    for(int i = 0; i < N; i++) {
+        double r1;
+        double x = TwoProductFMA((double)a[i], v[idx[i]], r1);
+        cache.Accumulate(x);
+        cache.Accumulate(r1);
+    }
+    cache.Flush();
+}
+
+// Advance an operand to element i (constant operands stay the same)
+template<class T>
+inline T* shift_operand( T* x, int i){
+    return x+i;
+}
+template<class T>
+inline T shift_operand( T x, int i){
+    return x;
+}
+
+// Split a sweep that feeds K superaccumulators among the OpenMP threads.
+// sweep(begin, end, acc) handles elements begin..end-1 into acc. Every thread
+// runs its own contiguous block into a private set of superaccumulators,
+// which are then normalized and added in thread order. Superaccumulators are
+// exact, so the result does not depend on the number of threads.
+template<int K, typename Sweep>
+void ParallelSweep(int N, int64_t* acc, Sweep sweep) {
+#ifdef _OPENMP
+    int nthreads = omp_in_parallel() ? 1 : std::min(omp_get_max_threads(), N / OMP_GRAIN);
+    if( nthreads > 1) {
+        // round the stride up to whole cache lines to avoid false sharing
+        const int stride = (K*BIN_COUNT + 7) & ~7;
+        std::vector<int64_t> partial(nthreads*stride, 0);
+        #pragma omp parallel num_threads(nthreads)
+        {
+            int t = omp_get_thread_num(), nt = omp_get_num_threads();
+            // blocks of 8 elements keep full vectors in all but the last thread
+            int blocks = (N + 7) / 8;
+            int begin = std::min(N, (int)((int64_t)blocks * t / nt) * 8);
+            int end   = std::min(N, (int)((int64_t)blocks * (t+1) / nt) * 8);
+            int64_t* mine = &partial[t*stride];
+            sweep(begin, end, mine);
+            for(int k = 0; k < K; k++) {
+                int imin = IMIN, imax = IMAX;
+                Normalize(mine + k*BIN_COUNT, imin, imax);
+            }
+        }
+        for(int t = 0; t < nthreads; t++)
+            for(int i = 0; i < K*BIN_COUNT; i++)
+                acc[i] += partial[t*stride + i];
+        for(int k = 0; k < K; k++) {
+            int imin = IMIN, imax = IMAX;
+            Normalize(acc + k*BIN_COUNT, imin, imax);
+        }
+        return;
+    }
+#endif//_OPENMP
+    sweep(0, N, acc);
+}
+
+// The K dot products of ExDOTFPE_multi, split among the OpenMP threads
+// (ExDOTFPE_short below EXDOT_SHORT elements)
+template<typename CACHE, int K, typename PointerOrValue1, typename PointerOrValue2>
+void ExDOTFPE_parallel(int N, const PointerOrValue1* a, const PointerOrValue2* b, int64_t* acc) {
+    if( N <= EXDOT_SHORT) {
+        ExDOTFPE_short<CACHE, K>(N, a, b, acc);
+        return;
+    }
+    ParallelSweep<K>(N, acc, [=](int begin, int end, int64_t* mine) {
+        PointerOrValue1 as[K];
+        PointerOrValue2 bs[K];
+        for(int k = 0; k < K; k++) {
+            as[k] = shift_operand(a[k], begin);
+            bs[k] = shift_operand(b[k], begin);
+        }
+        ExDOTFPE_multi<CACHE, K>(end-begin, as, bs, mine);
+    });
+}
+
+/*!@brief exact dot product
  *
  * Computes the exact sum \f[ \sum_{i=0}^{N-1} x_i y_i \f]
+ * When compiled with OpenMP and called outside of a parallel region, the
+ * sum is split among the threads (at least \c exblas::OMP_GRAIN elements each);
+ * the result is bitwise identical for any number of threads.
  * @ingroup highlevel
  * @tparam NBFPE size of the floating point expansion (should be between 3 and 8)
  * @tparam PointerOrValue must be one of <tt> T, T&&, T&, const T&, T* or const T* </tt>, where \c T is either \c float or \c double. If it is a pointer type, then we iterate through the pointed data from 0 to \c size, else we consider the value constant in every iteration.
@@ -82,13 +276,65 @@ void exdot(unsigned size, PointerOrValue1 x1_ptr, PointerOrValue2 x2_ptr, int64_
     static_assert( has_floating_value<PointerOrValue2>::value, "PointerOrValue2 needs to be T or T* with T one of (const) float or (const) double");
     for( int i=0; i<exblas::BIN_COUNT; i++)
         h_superacc[i] = 0;
+    PointerOrValue1 x1[1] = {x1_ptr};
+    PointerOrValue2 x2[1] = {x2_ptr};
+#ifndef _WITHOUT_VCL
+    cpu::ExDOTFPE_parallel<cpu::FPExpansionVect<simd::Vecd, NBFPE, cpu::FPExpansionTraits<true>, cpu::SuperaccWindow<FLUSH_WINDOW> >, 1>((int)size,x1,x2, h_superacc);
+#else
+    cpu::ExDOTFPE_parallel<cpu::FPExpansionVect<double, NBFPE, cpu::FPExpansionTraits<true>, cpu::SuperaccWindow<FLUSH_WINDOW> >, 1>((int)size,x1,x2, h_superacc);
+#endif//_WITHOUT_VCL
+}
+
+/*!@brief several exact dot products computed in one pass
+ *
+ * Computes the K exact sums \f[ \sum_{i=0}^{N-1} x_{k,i} y_{k,i} \f] in the same loop.
+ * The results are bitwise identical to K calls of exdot, but a vector that
+ * appears in several products (e.g. \f$ (q,y) \f$ and \f$ (y,y) \f$) is streamed once.
+ * Threads are used as in exdot.
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @tparam NBFPE size of the floating point expansion (should be between 3 and 8)
+ * @tparam PointerOrValue must be one of <tt> T, T&&, T&, const T&, T* or const T* </tt>, where \c T is either \c float or \c double. If it is a pointer type, then we iterate through the pointed data from 0 to \c size, else we consider the value constant in every iteration.
+ * @param size size N of the arrays to sum
+ * @param x1_ptr K first arrays
+ * @param x2_ptr K second arrays
+ * @param h_superacc pointer to an array of 64 bit integers in host memory with size at least \c K*exblas::BIN_COUNT; the k-th superaccumulator starts at \c h_superacc+k*BIN_COUNT (contents are overwritten)
+*/
+template<int K, class PointerOrValue1, class PointerOrValue2, size_t NBFPE=8>
+void exdot_multi(unsigned size, const PointerOrValue1 (&x1_ptr)[K], const PointerOrValue2 (&x2_ptr)[K], int64_t* h_superacc){
+    static_assert( has_floating_value<PointerOrValue1>::value, "PointerOrValue1 needs to be T or T* with T one of (const) float or (const) double");
+    static_assert( has_floating_value<PointerOrValue2>::value, "PointerOrValue2 needs to be T or T* with T one of (const) float or (const) double");
+    for( int i=0; i<K*exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
 #ifndef _WITHOUT_VCL
-    cpu::ExDOTFPE<cpu::FPExpansionVect<vcl::Vec8d, NBFPE, cpu::FPExpansionTraits<true> > >((int)size,x1_ptr,x2_ptr, h_superacc);
+    cpu::ExDOTFPE_parallel<cpu::FPExpansionVect<simd::Vecd, NBFPE, cpu::FPExpansionTraits<true>, cpu::SuperaccWindow<FLUSH_WINDOW> >, K>((int)size,x1_ptr,x2_ptr, h_superacc);
 #else
-    cpu::ExDOTFPE<cpu::FPExpansionVect<double, NBFPE, cpu::FPExpansionTraits<true> > >((int)size,x1_ptr,x2_ptr, h_superacc);
+    cpu::ExDOTFPE_parallel<cpu::FPExpansionVect<double, NBFPE, cpu::FPExpansionTraits<true>, cpu::SuperaccWindow<FLUSH_WINDOW> >, K>((int)size,x1_ptr,x2_ptr, h_superacc);
 #endif//_WITHOUT_VCL
 }
 
+/*!@brief exact dot product with an indexed second operand
+ *
+ * Computes the exact sum \f[ \sum_{i=0}^{N-1} x_i y_{idx_i} \f] e.g. a row of a
+ * sparse matrix in CSR format times a vector. The result does not depend on
+ * the order of the entries. It runs on the calling thread only, so that the
+ * rows can be distributed among the threads.
+ * @ingroup highlevel
+ * @tparam T \c float or \c double (float values are widened exactly)
+ * @tparam NBFPE size of the floating point expansion (should be between 3 and 8)
+ * @param size size N of x1_ptr and idx
+ * @param x1_ptr first array
+ * @param idx indices of the elements of x2_ptr
+ * @param x2_ptr second array
+ * @param h_superacc pointer to an array of 64 bit integers (the superaccumulator) in host memory with size at least \c exblas::BIN_COUNT (39) (contents are overwritten)
+*/
+template<class T, size_t NBFPE=8>
+void exdot_gather(unsigned size, const T* x1_ptr, const int* idx, const double* x2_ptr, int64_t* h_superacc){
+    for( int i=0; i<exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
+    cpu::ExDOTFPE_gather<cpu::FPExpansionVect<double, NBFPE, cpu::FPExpansionTraits<true> > >((int)size, x1_ptr, idx, x2_ptr, h_superacc);
+}
+
 }//namespace cpu
 ///@endcond
 
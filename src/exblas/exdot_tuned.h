@@ -0,0 +1,191 @@
+/**
+ *  @file exdot_tuned.h
+ *  @brief Runtime selection of the FPE size and traits used by exdot
+ *
+ *  The size of the floating point expansion and its traits are template
+ *  parameters of exdot. This file instantiates the meaningful combinations
+ *  once and dispatches to one of them at run time, according to a
+ *  configuration written by the TuneExdot tool, both for exdot and for the
+ *  fused update of exaxpy_dot. All of them give bitwise
+ *  identical results, only the speed differs.
+ */
+#pragma once
+#include <cstdio>
+#include <cstring>
+
+#include "exdot.h"
+#include "exaxpydot.h"
+
+namespace exblas{
+namespace cpu{
+
+/**
+ * @brief Configuration of the floating point expansions of exdot
+ *
+ * Only the traits that FPExpansionVect actually implements are exposed.
+ * @ingroup highlevel
+ */
+typedef struct {
+    int nbfpe;              //!< size of the floating point expansion (3 to 8)
+    int early_exit;         //!< FPExpansionTraits::EarlyExit
+    int check_range_first;  //!< FPExpansionTraits::CheckRangeFirst
+} DotConfig;
+
+static constexpr int NBFPE_MIN = 3; //!< smallest FPE size that can be selected
+static constexpr int NBFPE_MAX = 8; //!< largest FPE size that can be selected
+
+///@brief Configuration used by exdot_tuned (defaults to the former hard-coded one)
+inline DotConfig& CurrentDotConfig() {
+    static DotConfig cfg = {8, 1, 0};
+    return cfg;
+}
+
+/**
+ * @brief Read a configuration written by TuneExdot
+ *
+ * The file holds one <tt>key value</tt> pair per line, lines starting with
+ * \c # are comments.
+ * @param file name of the file
+ * @param cfg configuration to fill (untouched if the file is missing or invalid)
+ * @return 1 if the configuration was read, 0 otherwise
+ */
+static inline int ReadDotConfig(const char *file, DotConfig *cfg) {
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL)
+        return 0;
+
+    DotConfig tmp = *cfg;
+    char line[256], key[64];
+    int value, ok = 1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%63s %d", key, &value) != 2)
+            continue;
+        if (strcmp(key, "nbfpe") == 0)                  tmp.nbfpe = value;
+        else if (strcmp(key, "early_exit") == 0)        tmp.early_exit = (value != 0);
+        else if (strcmp(key, "check_range_first") == 0) tmp.check_range_first = (value != 0);
+        else ok = 0;
+    }
+    fclose(fp);
+    if (!ok || tmp.nbfpe < NBFPE_MIN || tmp.nbfpe > NBFPE_MAX)
+        return 0;
+    *cfg = tmp;
+    return 1;
+}
+
+/**
+ * @brief Write a configuration that ReadDotConfig understands
+ * @param file name of the file
+ * @param cfg configuration to write
+ * @return 1 on success, 0 otherwise
+ */
+static inline int WriteDotConfig(const char *file, const DotConfig *cfg) {
+    FILE *fp = fopen(file, "w");
+    if (fp == NULL)
+        return 0;
+    fprintf(fp, "# exdot configuration written by TuneExdot\n");
+    fprintf(fp, "nbfpe %d\n", cfg->nbfpe);
+    fprintf(fp, "early_exit %d\n", cfg->early_exit);
+    fprintf(fp, "check_range_first %d\n", cfg->check_range_first);
+    fclose(fp);
+    return 1;
+}
+
+///@cond
+typedef void (*ExDotFn)(unsigned, const double* const*, const double* const*, int64_t*);
+
+template<int K, int NBFPE, bool EX, bool CRF>
+void ExDotKernel(unsigned size, const double* const* x1_ptr, const double* const* x2_ptr, int64_t* h_superacc) {
+    for( int i=0; i<K*exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
+#ifndef _WITHOUT_VCL
+    cpu::ExDOTFPE_parallel<cpu::FPExpansionVect<simd::Vecd, NBFPE, cpu::FPExpansionTraits<EX, false, false, CRF>, cpu::SuperaccWindow<FLUSH_WINDOW> >, K>((int)size, x1_ptr, x2_ptr, h_superacc);
+#else
+    cpu::ExDOTFPE_parallel<cpu::FPExpansionVect<double, NBFPE, cpu::FPExpansionTraits<EX, false, false, CRF>, cpu::SuperaccWindow<FLUSH_WINDOW> >, K>((int)size, x1_ptr, x2_ptr, h_superacc);
+#endif//_WITHOUT_VCL
+}
+
+typedef void (*ExAxpyDotFn)(unsigned, double, const double*, const double*, double*, const double* const*, int64_t*);
+
+template<int K, int NBFPE, bool EX, bool CRF>
+void ExAxpyDotKernel(unsigned size, double alpha, const double* x, const double* y, double* z, const double* const* w, int64_t* h_superacc) {
+    for( int i=0; i<K*exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
+#ifndef _WITHOUT_VCL
+    cpu::ExAXPYDOTFPE_parallel<cpu::FPExpansionVect<simd::Vecd, NBFPE, cpu::FPExpansionTraits<EX, false, false, CRF>, cpu::SuperaccWindow<FLUSH_WINDOW> >, K>((int)size, alpha, x, y, z, w, h_superacc);
+#else
+    cpu::ExAXPYDOTFPE_parallel<cpu::FPExpansionVect<double, NBFPE, cpu::FPExpansionTraits<EX, false, false, CRF>, cpu::SuperaccWindow<FLUSH_WINDOW> >, K>((int)size, alpha, x, y, z, w, h_superacc);
+#endif//_WITHOUT_VCL
+}
+
+#define EXDOT_KERNELS(F, N) \
+    {{&F<K, N, false, false>, &F<K, N, false, true>}, \
+     {&F<K, N, true,  false>, &F<K, N, true,  true>}}
+
+template<int K>
+ExDotFn GetExDot(const DotConfig& cfg) {
+    static const ExDotFn table[NBFPE_MAX-NBFPE_MIN+1][2][2] = {
+        EXDOT_KERNELS(ExDotKernel, 3), EXDOT_KERNELS(ExDotKernel, 4), EXDOT_KERNELS(ExDotKernel, 5),
+        EXDOT_KERNELS(ExDotKernel, 6), EXDOT_KERNELS(ExDotKernel, 7), EXDOT_KERNELS(ExDotKernel, 8)
+    };
+    return table[cfg.nbfpe-NBFPE_MIN][cfg.early_exit != 0][cfg.check_range_first != 0];
+}
+
+template<int K>
+ExAxpyDotFn GetExAxpyDot(const DotConfig& cfg) {
+    static const ExAxpyDotFn table[NBFPE_MAX-NBFPE_MIN+1][2][2] = {
+        EXDOT_KERNELS(ExAxpyDotKernel, 3), EXDOT_KERNELS(ExAxpyDotKernel, 4), EXDOT_KERNELS(ExAxpyDotKernel, 5),
+        EXDOT_KERNELS(ExAxpyDotKernel, 6), EXDOT_KERNELS(ExAxpyDotKernel, 7), EXDOT_KERNELS(ExAxpyDotKernel, 8)
+    };
+    return table[cfg.nbfpe-NBFPE_MIN][cfg.early_exit != 0][cfg.check_range_first != 0];
+}
+#undef EXDOT_KERNELS
+///@endcond
+
+/*!@brief K exact dot products with the configuration selected at run time
+ *
+ * Same as exdot_multi on double arrays, with the FPE size and traits of
+ * CurrentDotConfig().
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @param size size N of the arrays to sum
+ * @param x1_ptr K first arrays
+ * @param x2_ptr K second arrays
+ * @param h_superacc pointer to at least \c K*exblas::BIN_COUNT 64 bit integers (contents are overwritten)
+*/
+template<int K>
+void exdot_tuned(unsigned size, const double* const (&x1_ptr)[K], const double* const (&x2_ptr)[K], int64_t* h_superacc) {
+    GetExDot<K>(CurrentDotConfig())(size, x1_ptr, x2_ptr, h_superacc);
+}
+
+/*!@brief exact dot product with the configuration selected at run time
+ *
+ * @ingroup highlevel
+ * @param size size N of the arrays to sum
+ * @param x1_ptr first array
+ * @param x2_ptr second array
+ * @param h_superacc pointer to at least \c exblas::BIN_COUNT 64 bit integers (contents are overwritten)
+*/
+static inline void exdot_tuned(unsigned size, const double* x1_ptr, const double* x2_ptr, int64_t* h_superacc) {
+    GetExDot<1>(CurrentDotConfig())(size, &x1_ptr, &x2_ptr, h_superacc);
+}
+
+/*!@brief vector update and K exact dot products of the result, with the configuration selected at run time
+ *
+ * Same as exaxpy_dot, with the FPE size and traits of CurrentDotConfig().
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @param size size N of the arrays
+ * @param alpha scalar of the update
+ * @param x array scaled by alpha
+ * @param y array added to alpha * x (may be z)
+ * @param z updated array, \f$ z = y + \alpha x \f$ (output)
+ * @param w K first operands of the dot products with z, any of them may be z
+ * @param h_superacc pointer to at least \c K*exblas::BIN_COUNT 64 bit integers (contents are overwritten)
+*/
+template<int K>
+void exaxpy_dot_tuned(unsigned size, double alpha, const double* x, const double* y, double* z, const double* const (&w)[K], int64_t* h_superacc) {
+    GetExAxpyDot<K>(CurrentDotConfig())(size, alpha, x, y, z, w, h_superacc);
+}
+
+}//namespace cpu
+}//namespace exblas
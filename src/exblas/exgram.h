@@ -0,0 +1,138 @@
+/**
+ *  @file exgram.h
+ *  @brief Exact block inner products of two sets of vectors
+ *
+ *  Computes all the exact dots \f$ (v_i, w_j) \f$ of KV vectors v and KW
+ *  vectors w, the Gram matrix \f$ V^T W \f$ of block and s-step methods, in
+ *  one sweep: every element of the KV+KW vectors is loaded once and fed to
+ *  the KV*KW floating point expansions, which stay in cache. The result is a
+ *  batch of KV*KW superaccumulators, reduced over MPI with one ReproAllReduce.
+ */
+#pragma once
+#include "exdot.h"
+
+namespace exblas{
+///@cond
+namespace cpu{
+
+// The KV*KW dots <v_i, w_j>, the FPE of (i, j) at i*KW+j; w_j may be v_i
+template<typename CACHE, int KV, int KW>
+void ExGRAMFPE(int N, const double* const* v, const double* const* w, int64_t* acc) {
+    const int K = KV*KW;
+    typename CACHE::Superacc win[K];
+    alignas(CACHE) unsigned char storage[K * sizeof(CACHE)];
+    CACHE* cache = reinterpret_cast<CACHE*>(storage);
+    for(int k = 0; k < K; k++) {
+        win[k].Init(acc + k*BIN_COUNT);
+        new (&cache[k]) CACHE(&win[k]);
+    }
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    int r = N - N % W;
+    for(int l = 0; l < r; l+=W) {
+        simd::Vecd vl[KV], wl[KW];
+        for(int i = 0; i < KV; i++)
+            vl[i].load(v[i]+l);
+        for(int j = 0; j < KW; j++)
+            wl[j].load(w[j]+l);
+        for(int i = 0; i < KV; i++) {
+            for(int j = 0; j < KW; j++) {
+                simd::Vecd r1;
+                simd::Vecd x = TwoProductFMA(vl[i], wl[j], r1);
+                cache[i*KW+j].Accumulate(x);
+                cache[i*KW+j].Accumulate(r1);
+            }
+        }
+    }
+    if( r != N) {
+        //accumulate remainder, the missing lanes are zero
+        simd::Vecd vl[KV], wl[KW];
+        for(int i = 0; i < KV; i++)
+            vl[i].load_partial(N-r, v[i]+r);
+        for(int j = 0; j < KW; j++)
+            wl[j].load_partial(N-r, w[j]+r);
+        for(int i = 0; i < KV; i++) {
+            for(int j = 0; j < KW; j++) {
+                simd::Vecd r1;
+                simd::Vecd x = TwoProductFMA(vl[i], wl[j], r1);
+                cache[i*KW+j].Accumulate(x);
+                cache[i*KW+j].Accumulate(r1);
+            }
+        }
+    }
+#else// _WITHOUT_VCL
+    for(int l = 0; l < N; l++) {
+        for(int i = 0; i < KV; i++) {
+            for(int j = 0; j < KW; j++) {
+                double r1;
+                double x = TwoProductFMA(v[i][l], w[j][l], r1);
+                cache[i*KW+j].Accumulate(x);
+                cache[i*KW+j].Accumulate(r1);
+            }
+        }
+    }
+#endif// _WITHOUT_VCL
+    for(int k = 0; k < K; k++) {
+        cache[k].Flush();
+        cache[k].~CACHE();
+        win[k].Finish();
+    }
+}
+
+// ExGRAMFPE split among the OpenMP threads (the pairs of ExDOTFPE_short below EXDOT_SHORT elements)
+template<typename CACHE, int KV, int KW>
+void ExGRAMFPE_parallel(int N, const double* const* v, const double* const* w, int64_t* acc) {
+    if( N <= EXDOT_SHORT) {
+        const double* a[KV*KW];
+        const double* b[KV*KW];
+        for(int i = 0; i < KV; i++) {
+            for(int j = 0; j < KW; j++) {
+                a[i*KW+j] = v[i];
+                b[i*KW+j] = w[j];
+            }
+        }
+        ExDOTFPE_short<CACHE, KV*KW>(N, a, b, acc);
+        return;
+    }
+    ParallelSweep<KV*KW>(N, acc, [=](int begin, int end, int64_t* mine) {
+        const double* vs[KV];
+        const double* ws[KW];
+        for(int i = 0; i < KV; i++)
+            vs[i] = v[i]+begin;
+        for(int j = 0; j < KW; j++)
+            ws[j] = w[j]+begin;
+        ExGRAMFPE<CACHE, KV, KW>(end-begin, vs, ws, mine);
+    });
+}
+
+/*!@brief exact block inner product \f$ V^T W \f$
+ *
+ * Computes the KV*KW exact sums \f[ G_{ij} = \sum_{l=0}^{N-1} v_{i,l} w_{j,l} \f]
+ * in one pass over the vectors. The results are bitwise identical to
+ * exdot_multi on the same pairs, for any number of threads; all of them are
+ * reduced over MPI with one ReproAllReduce of \c KV*KW superaccumulators.
+ * @ingroup highlevel
+ * @tparam KV number of vectors v (rows of G)
+ * @tparam KW number of vectors w (columns of G)
+ * @tparam NBFPE size of the floating point expansion (should be between 3 and 8)
+ * @param size size N of the arrays
+ * @param v KV arrays
+ * @param w KW arrays, any of them may also be in v
+ * @param h_superacc pointer to at least \c KV*KW*exblas::BIN_COUNT 64 bit integers (contents are overwritten),
+ * the superaccumulator of \f$ G_{ij} \f$ is at \c (i*KW+j)*exblas::BIN_COUNT
+*/
+template<int KV, int KW, size_t NBFPE=8>
+void exgram(unsigned size, const double* const (&v)[KV], const double* const (&w)[KW], int64_t* h_superacc){
+    for( int i=0; i<KV*KW*exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
+#ifndef _WITHOUT_VCL
+    ExGRAMFPE_parallel<FPExpansionVect<simd::Vecd, NBFPE, FPExpansionTraits<true>, SuperaccWindow<FLUSH_WINDOW> >, KV, KW>((int)size, v, w, h_superacc);
+#else
+    ExGRAMFPE_parallel<FPExpansionVect<double, NBFPE, FPExpansionTraits<true>, SuperaccWindow<FLUSH_WINDOW> >, KV, KW>((int)size, v, w, h_superacc);
+#endif//_WITHOUT_VCL
+}
+
+}//namespace cpu
+///@endcond
+
+}//namespace exblas
@@ -0,0 +1,215 @@
+/**
+ *  @file exsum.h
+ *  @brief Exact sum, sum of absolute values and Euclidean norm
+ *
+ *  The other BLAS-1 reductions on the machinery of exdot: floating point
+ *  expansions flushed into superaccumulators, split among the OpenMP threads
+ *  in the same way. The results are superaccumulators too, so they can be
+ *  reduced over MPI in the same batch as the dots.
+ *
+ *  exnrm2 sums the squares in three superaccumulators, as Blue's algorithm
+ *  does: the large and the small values are scaled by powers of two, so that
+ *  their squares neither overflow nor underflow and every square is exact.
+ */
+#pragma once
+#include "exdot.h"
+
+namespace exblas{
+///@cond
+namespace cpu{
+
+// Values of exnrm2 above 2^NRM2_RANGE go to the large part, scaled by
+// 2^-NRM2_SCALE; values below 2^-NRM2_RANGE go to the small part, scaled by
+// 2^NRM2_SCALE. The squares of all the parts, and their errors, then stay
+// within the range of the superaccumulators (about 2^-988 to 2^1040).
+static constexpr int NRM2_RANGE = 440;
+static constexpr int NRM2_SCALE = 600;
+
+// Exact sum of the a_i (of |a_i| if ABS)
+template<typename CACHE, bool ABS>
+void ExSUMFPE(int N, const double* a, int64_t* acc) {
+    typename CACHE::Superacc win;
+    win.Init(acc);
+    CACHE cache(&win);
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    int r = N - N % W;
+    for(int i = 0; i < r; i+=W) {
+        simd::Vecd x = simd::Vecd().load(a+i);
+        cache.Accumulate(ABS ? abs(x) : x);
+    }
+    if( r != N) {
+        simd::Vecd x = simd::Vecd().load_partial(N-r, a+r);
+        cache.Accumulate(ABS ? abs(x) : x);
+    }
+#else// _WITHOUT_VCL
+    for(int i = 0; i < N; i++)
+        cache.Accumulate(ABS ? std::fabs(a[i]) : a[i]);
+#endif// _WITHOUT_VCL
+    cache.Flush();
+    win.Finish();
+}
+
+// Exact square of x into the FPE
+template<typename CACHE, typename T>
+inline void AccumulateSquare(CACHE& cache, T x) {
+    T r1;
+    T p = TwoProductFMA(x, x, r1);
+    cache.Accumulate(p);
+    cache.Accumulate(r1);
+}
+
+// Exact sums of the squares of the a_i, in the NRM2_PARTS superaccumulators
+// (large, medium and small values)
+template<typename CACHE>
+void ExNRM2FPE(int N, const double* a, int64_t* acc) {
+    typename CACHE::Superacc win[NRM2_PARTS];
+    alignas(CACHE) unsigned char storage[NRM2_PARTS * sizeof(CACHE)];
+    CACHE* cache = reinterpret_cast<CACHE*>(storage);
+    for(int k = 0; k < NRM2_PARTS; k++) {
+        win[k].Init(acc + k*BIN_COUNT);
+        new (&cache[k]) CACHE(&win[k]);
+    }
+    const double big = std::ldexp(1., NRM2_RANGE), small = std::ldexp(1., -NRM2_RANGE);
+    const double down = std::ldexp(1., -NRM2_SCALE), up = std::ldexp(1., NRM2_SCALE);
+    int i = 0;
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    const simd::Vecd vbig(big), vsmall(small), vzero(0.);
+    for(; i < N; i+=W) {
+        int n = std::min(W, N-i);
+        simd::Vecd x = (n == W) ? simd::Vecd().load(a+i) : simd::Vecd().load_partial(n, a+i);
+        simd::Vecd ax = abs(x);
+        if( !horizontal_or(vbig < ax) && !horizontal_or((ax < vsmall) & (vzero < ax))) {
+            AccumulateSquare(cache[1], x);
+            continue;
+        }
+        // rare: split the lanes among the parts, the others are zero
+        double lanes[W], part[NRM2_PARTS][W];
+        x.store(lanes);
+        for(int l = 0; l < W; l++) {
+            double al = std::fabs(lanes[l]);
+            int k = (al > big) ? 0 : (al < small) ? 2 : 1;
+            for(int j = 0; j < NRM2_PARTS; j++)
+                part[j][l] = 0.;
+            part[k][l] = lanes[l] * ((k == 0) ? down : (k == 2) ? up : 1.);
+        }
+        for(int k = 0; k < NRM2_PARTS; k++)
+            AccumulateSquare(cache[k], simd::Vecd().load(part[k]));
+    }
+#else// _WITHOUT_VCL
+    for(; i < N; i++) {
+        double al = std::fabs(a[i]);
+        if( al > big)
+            AccumulateSquare(cache[0], a[i] * down);
+        else if( al < small)
+            AccumulateSquare(cache[2], a[i] * up);
+        else
+            AccumulateSquare(cache[1], a[i]);
+    }
+#endif// _WITHOUT_VCL
+    for(int k = 0; k < NRM2_PARTS; k++) {
+        cache[k].Flush();
+        cache[k].~CACHE();
+        win[k].Finish();
+    }
+}
+
+// ExSUMFPE split among the OpenMP threads
+template<typename CACHE, bool ABS>
+void ExSUMFPE_parallel(int N, const double* a, int64_t* acc) {
+    ParallelSweep<1>(N, acc, [=](int begin, int end, int64_t* mine) {
+        ExSUMFPE<CACHE, ABS>(end-begin, a+begin, mine);
+    });
+}
+
+// ExNRM2FPE split among the OpenMP threads
+template<typename CACHE>
+void ExNRM2FPE_parallel(int N, const double* a, int64_t* acc) {
+    ParallelSweep<NRM2_PARTS>(N, acc, [=](int begin, int end, int64_t* mine) {
+        ExNRM2FPE<CACHE>(end-begin, a+begin, mine);
+    });
+}
+
+#ifndef _WITHOUT_VCL
+#define EXSUM_CACHE(NBFPE) FPExpansionVect<simd::Vecd, NBFPE, FPExpansionTraits<true>, SuperaccWindow<FLUSH_WINDOW> >
+#else
+#define EXSUM_CACHE(NBFPE) FPExpansionVect<double, NBFPE, FPExpansionTraits<true>, SuperaccWindow<FLUSH_WINDOW> >
+#endif//_WITHOUT_VCL
+
+/*!@brief exact sum
+ *
+ * Computes the exact sum \f[ \sum_{i=0}^{N-1} x_i \f]
+ * bitwise identical for any number of threads.
+ * @ingroup highlevel
+ * @tparam NBFPE size of the floating point expansion (should be between 3 and 8)
+ * @param size size N of the array
+ * @param x array
+ * @param h_superacc pointer to at least \c exblas::BIN_COUNT 64 bit integers (contents are overwritten)
+*/
+template<size_t NBFPE=8>
+void exsum(unsigned size, const double* x, int64_t* h_superacc){
+    for( int i=0; i<exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
+    ExSUMFPE_parallel<EXSUM_CACHE(NBFPE), false>((int)size, x, h_superacc);
+}
+
+/*!@brief exact sum of absolute values
+ *
+ * Computes the exact sum \f[ \sum_{i=0}^{N-1} |x_i| \f]
+ * bitwise identical for any number of threads.
+ * @ingroup highlevel
+ * @tparam NBFPE size of the floating point expansion (should be between 3 and 8)
+ * @param size size N of the array
+ * @param x array
+ * @param h_superacc pointer to at least \c exblas::BIN_COUNT 64 bit integers (contents are overwritten)
+*/
+template<size_t NBFPE=8>
+void exasum(unsigned size, const double* x, int64_t* h_superacc){
+    for( int i=0; i<exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
+    ExSUMFPE_parallel<EXSUM_CACHE(NBFPE), true>((int)size, x, h_superacc);
+}
+
+/*!@brief exact sum of squares for the Euclidean norm, without overflow or underflow
+ *
+ * Computes the exact sum \f[ \sum_{i=0}^{N-1} x_i^2 \f] in \c exblas::NRM2_PARTS
+ * superaccumulators, the squares of the large, medium and small values
+ * scaled apart. They are reduced over MPI like \c NRM2_PARTS dots, and
+ * Nrm2Round turns the rounded sums into the norm.
+ * @ingroup highlevel
+ * @tparam NBFPE size of the floating point expansion (should be between 3 and 8)
+ * @param size size N of the array
+ * @param x array
+ * @param h_superacc pointer to at least \c exblas::NRM2_PARTS*exblas::BIN_COUNT 64 bit integers (contents are overwritten)
+*/
+template<size_t NBFPE=8>
+void exnrm2(unsigned size, const double* x, int64_t* h_superacc){
+    for( int i=0; i<NRM2_PARTS*exblas::BIN_COUNT; i++)
+        h_superacc[i] = 0;
+    ExNRM2FPE_parallel<EXSUM_CACHE(NBFPE)>((int)size, x, h_superacc);
+}
+
+#undef EXSUM_CACHE
+
+/*!@brief Euclidean norm from the sums of exnrm2
+ *
+ * When all the values are in the medium range, this is the square root of
+ * the correctly rounded sum of squares; otherwise the largest non-zero part
+ * dominates and is scaled back.
+ * @ingroup highlevel
+ * @param sums the \c exblas::NRM2_PARTS sums of exnrm2, rounded (e.g. by ReproAllReduce)
+ * @return the Euclidean norm
+*/
+static inline double Nrm2Round(const double* sums){
+    if( sums[0] != 0.)
+        return std::ldexp(std::sqrt(sums[0] + std::ldexp(sums[1], -2*NRM2_SCALE)), NRM2_SCALE);
+    if( sums[1] != 0.)
+        return std::sqrt(sums[1] + std::ldexp(sums[2], -2*NRM2_SCALE));
+    return std::ldexp(std::sqrt(sums[2]), -NRM2_SCALE);
+}
+
+}//namespace cpu
+///@endcond
+
+}//namespace exblas
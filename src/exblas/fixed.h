@@ -0,0 +1,260 @@
+/**
+ *  @file fixed.h
+ *  @brief Reproducible dot products in 128 bit fixed point
+ *
+ *  The sum is done in two phases. The first one finds the largest exponent E
+ *  of the products (to be agreed on by all the processes, see mpi_fixed.h);
+ *  the second one rounds every product to a multiple of 2^(E-90) and adds
+ *  them as integers, in 64 bit lanes widened to 128 bits every FIXED_BLOCK
+ *  products. Integer additions are associative, so the result does not depend
+ *  on the order of the products; the parts of the products below 2^(E-90)
+ *  are lost, so it is reproducible but not exact. The 128 bits leave room
+ *  for 2^36 products as large as the largest one.
+ */
+#pragma once
+#include <cmath>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "config.h"
+
+namespace exblas{
+namespace cpu{
+
+/**
+* @brief A fixed-point sum
+*
+* The sum is the 128 bit integer <tt> hi*2^64 + lo </tt> times 2^(e-50-FIXED_FRACTION), where
+* e is the exponent of the largest product, or one of the codes FIXED_EMPTY
+* (all the products are zero), FIXED_NAN, FIXED_PINF or FIXED_NINF.
+* @ingroup highlevel
+*/
+typedef struct {
+    int64_t e;      //!< exponent of the largest product, or code
+    uint64_t lo;    //!< low word of the integer
+    int64_t hi;     //!< high word of the integer
+} FixedSum;
+
+static constexpr int64_t FIXED_EMPTY = -4096; //!< code of a sum of zeros
+static constexpr int64_t FIXED_NAN   =  4096; //!< code of a sum with a NaN or infinities of both signs
+static constexpr int64_t FIXED_PINF  =  4097; //!< code of a sum with +inf
+static constexpr int64_t FIXED_NINF  =  4098; //!< code of a sum with -inf
+static constexpr int FIXED_SCAN      =  4;    //!< number of ints of the first phase, per dot
+static constexpr int FIXED_FRACTION  =  40;   //!< bits kept below the unit of the products scaled under 2^51
+
+///@cond
+// 1.5*2^52: adding it rounds values below 2^51 to integers, found in the low
+// bits of the result
+static constexpr double FIXED_MAGIC = 6755399441055744.0;
+
+static inline int64_t FixedBits(double x) {
+    udouble u;
+    u.d = x;
+    return u.i;
+}
+
+// Code of the exponent field of the sums, from the scan {ilogb of the
+// largest finite product (FIXED_EMPTY if none is not zero), NaN met, +inf
+// met, -inf met} of all the processes
+static inline int64_t FixedHeader(const int *scan) {
+    if (scan[1] || (scan[2] && scan[3]))
+        return FIXED_NAN;
+    if (scan[2])
+        return FIXED_PINF;
+    if (scan[3])
+        return FIXED_NINF;
+    return scan[0];
+}
+
+// Largest |a_i b_i| of the n products (n at most FIXED_BLOCK), and the
+// special values met among them in flags (1: NaN, 2: +inf, 4: -inf)
+static inline double FixedScanBlock(int n, const double *a, const double *b, int &flags) {
+    using std::max; using std::abs;
+    double m = 0.;
+    int i = 0;
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    simd::Vecd vmax(0.), vbad(0.);
+    for (; i + W <= n; i += W) {
+        simd::Vecd p = simd::Vecd().load(a+i) * simd::Vecd().load(b+i);
+        vmax = max(vmax, abs(p));
+        vbad = vbad + p * simd::Vecd(0.);
+    }
+    double lanes[W];
+    vmax.store(lanes);
+    for (int l = 0; l < W; l++)
+        m = max(m, lanes[l]);
+    if (horizontal_or(vbad)) {
+        i = 0; m = 0.;
+    }
+#endif//_WITHOUT_VCL
+    // the tail, or everything if there are special values
+    for (; i < n; i++) {
+        double p = a[i] * b[i];
+        if (std::isnan(p))
+            flags |= 1;
+        else if (std::isinf(p))
+            flags |= (p > 0.) ? 2 : 4;
+        else
+            m = max(m, abs(p));
+    }
+    return m;
+}
+
+// Sum of the n products a_i b_i (n at most FIXED_BLOCK) rounded to multiples
+// of 2^-(s+FIXED_FRACTION), where 2^s = s1*s2 brings the largest product
+// below 2^51. Each product is split in an integer part and a fraction with
+// the magic constant; the bits of the sums with the constant are added as
+// integers, and the constants are taken out at the end.
+static inline __int128 FixedSumBlock(int n, const double *a, const double *b, double s1, double s2) {
+    const double R = std::ldexp(1., FIXED_FRACTION);
+    uint64_t hi = 0, lo = 0;
+    int i = 0;
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    const simd::Vecd M(FIXED_MAGIC), vr(R), v1(s1), v2(s2);
+    simd::Vecq vhi(0), vlo(0);
+    for (; i + W <= n; i += W) {
+        simd::Vecd t = simd::Vecd().load(a+i) * simd::Vecd().load(b+i) * v1 * v2;
+        simd::Vecd u = t + M;
+        simd::Vecd f = (t - (u - M)) * vr;
+        vhi = vhi + simd::reinterpret_i(u);
+        vlo = vlo + simd::reinterpret_i(f + M);
+    }
+    int64_t lanes[2][W];
+    vhi.store(lanes[0]);
+    vlo.store(lanes[1]);
+    for (int l = 0; l < W; l++) {
+        hi += (uint64_t) lanes[0][l];
+        lo += (uint64_t) lanes[1][l];
+    }
+#endif//_WITHOUT_VCL
+    for (int j = i; j < n; j++) {
+        double t = a[j] * b[j] * s1 * s2;
+        double u = t + FIXED_MAGIC;
+        double f = (t - (u - FIXED_MAGIC)) * R;
+        hi += (uint64_t) FixedBits(u);
+        lo += (uint64_t) FixedBits(f + FIXED_MAGIC);
+    }
+    // both sums are below 2^61 in absolute value, wrapping around is harmless
+    hi -= (uint64_t) n * (uint64_t) FixedBits(FIXED_MAGIC);
+    lo -= (uint64_t) n * (uint64_t) FixedBits(FIXED_MAGIC);
+    return (__int128) (int64_t) hi * ((__int128) 1 << FIXED_FRACTION) + (int64_t) lo;
+}
+
+// z = fma(alpha, x, y) on n elements
+static inline void FixedAxpy(int n, double alpha, const double *x, const double *y, double *z) {
+    int i = 0;
+#ifndef _WITHOUT_VCL
+    const int W = simd::Vecd::size;
+    const simd::Vecd va(alpha);
+    for (; i + W <= n; i += W)
+        simd::mul_add(va, simd::Vecd().load(x+i), simd::Vecd().load(y+i)).store(z+i);
+#endif//_WITHOUT_VCL
+    for (; i < n; i++)
+        z[i] = std::fma(alpha, x[i], y[i]);
+}
+
+// First phase of K dots: scan holds FIXED_SCAN ints per dot. If alpha_x is
+// not NULL, z = fma(alpha, x, y) is computed first in every block (the
+// products are then the ones of b = z).
+template<int K>
+void FixedScan(int N, const double* const* a, const double* const* b, int* scan,
+               double alpha = 0., const double* alpha_x = NULL, const double* y = NULL, double* z = NULL) {
+    double m[K];
+    int flags[K];
+    for (int k = 0; k < K; k++) {
+        m[k] = 0.; flags[k] = 0;
+    }
+    int blocks = (N + FIXED_BLOCK - 1) / FIXED_BLOCK;
+    #pragma omp parallel for reduction(max: m[:K]) reduction(|: flags[:K]) if(N >= 2*OMP_GRAIN)
+    for (int blk = 0; blk < blocks; blk++) {
+        int s = blk * FIXED_BLOCK, n = std::min(FIXED_BLOCK, N - s);
+        if (alpha_x != NULL)
+            FixedAxpy(n, alpha, alpha_x+s, y+s, z+s);
+        for (int k = 0; k < K; k++)
+            m[k] = std::max(m[k], FixedScanBlock(n, a[k]+s, b[k]+s, flags[k]));
+    }
+    for (int k = 0; k < K; k++) {
+        scan[FIXED_SCAN*k]   = (m[k] > 0.) ? std::ilogb(m[k]) : (int) FIXED_EMPTY;
+        scan[FIXED_SCAN*k+1] = (flags[k] & 1) != 0;
+        scan[FIXED_SCAN*k+2] = (flags[k] & 2) != 0;
+        scan[FIXED_SCAN*k+3] = (flags[k] & 4) != 0;
+    }
+}
+
+// Second phase of K dots, with the scans merged over all the processes
+template<int K>
+void FixedDOT(int N, const double* const* a, const double* const* b, const int* scan, FixedSum* sum) {
+    double s1[K], s2[K];
+    __int128 total[K];
+    bool active = false;
+    for (int k = 0; k < K; k++) {
+        sum[k].e = FixedHeader(scan + FIXED_SCAN*k);
+        sum[k].lo = 0; sum[k].hi = 0;
+        total[k] = 0;
+        // two factors, so that each one stays in range
+        int s = 50 - (int) sum[k].e;
+        s1[k] = std::ldexp(1., s/2);
+        s2[k] = std::ldexp(1., s - s/2);
+        active = active || (sum[k].e != FIXED_EMPTY && sum[k].e < FIXED_NAN);
+    }
+    if (!active)
+        return;
+    int blocks = (N + FIXED_BLOCK - 1) / FIXED_BLOCK;
+    #pragma omp parallel if(N >= 2*OMP_GRAIN)
+    {
+        __int128 mine[K];
+        for (int k = 0; k < K; k++)
+            mine[k] = 0;
+        #pragma omp for
+        for (int blk = 0; blk < blocks; blk++) {
+            int s = blk * FIXED_BLOCK, n = std::min(FIXED_BLOCK, N - s);
+            for (int k = 0; k < K; k++)
+                if (sum[k].e != FIXED_EMPTY && sum[k].e < FIXED_NAN)
+                    mine[k] += FixedSumBlock(n, a[k]+s, b[k]+s, s1[k], s2[k]);
+        }
+        // integer sums, the order of the threads does not matter
+        #pragma omp critical
+        for (int k = 0; k < K; k++)
+            total[k] += mine[k];
+    }
+    for (int k = 0; k < K; k++) {
+        sum[k].lo = (uint64_t) total[k];
+        sum[k].hi = (int64_t) (total[k] >> 64);
+    }
+}
+///@endcond
+
+/*!@brief rounds a fixed-point sum to a double
+ *
+ * @ingroup highlevel
+ * @param sum sum filled by fixed_dot (and reduced by ReproAllReduce)
+ * @return the sum, correctly rounded from its fixed-point value
+*/
+static inline double FixedRound(const FixedSum *sum) {
+    switch (sum->e) {
+        case FIXED_EMPTY: return 0.;
+        case FIXED_NAN:   return NAN;
+        case FIXED_PINF:  return INFINITY;
+        case FIXED_NINF:  return -INFINITY;
+    }
+    __int128 v = (__int128) (((unsigned __int128) (uint64_t) sum->hi << 64) | sum->lo);
+    return std::ldexp((double) v, (int) sum->e - 50 - FIXED_FRACTION);
+}
+
+/*!@brief adds the fixed-point sum src to dst
+ *
+ * Both sums must use the same exponent, as the ones of a dot on several processes.
+ * @ingroup highlevel
+*/
+static inline void FixedMerge(FixedSum *dst, const FixedSum *src) {
+    uint64_t lo = dst->lo + src->lo;
+    dst->hi = (int64_t) ((uint64_t) dst->hi + (uint64_t) src->hi + (lo < dst->lo));
+    dst->lo = lo;
+}
+
+}//namespace cpu
+}//namespace exblas
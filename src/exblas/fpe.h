@@ -0,0 +1,205 @@
+/**
+ *  @file fpe.h
+ *  @brief Dot products with floating-point expansions only
+ *
+ *  Each thread keeps one floating-point expansion of FPE_SIZE doubles per dot,
+ *  as the first level of exdot, but without the superaccumulator behind it:
+ *  the terms carried out of the last one are rounded into it. The products
+ *  are split in two doubles with an FMA and added with 2Sum, which stops as
+ *  soon as the remainder is zero. The expansions of the threads (and of the
+ *  processes, see mpi_fpe.h) are merged in the same way, and the final
+ *  expansion is rounded with NearSum.
+ *
+ *  While every expansion holds its sum exactly, the result is the correctly
+ *  rounded dot, the same as exdot, whatever the order of the elements and the
+ *  number of threads and processes. When a sum needs more than FPE_SIZE terms
+ *  (values spread over more than about FPE_SIZE*53 bits that do not cancel),
+ *  the remainder is rounded into the last term and the result may depend on
+ *  the order of the additions; nothing tells it apart. Products below about
+ *  2^-969 lose the low part of their error term, and infinities and NaNs
+ *  give a NaN.
+ */
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "config.h"
+#include "nearsum.hpp"
+
+namespace exblas{
+namespace cpu{
+
+/**
+* @brief A sum kept as a floating-point expansion
+*
+* The sum is the exact sum of the FPE_SIZE terms, which are not sorted and may
+* overlap; unused terms are zero.
+* @ingroup highlevel
+*/
+typedef struct {
+    double a[FPE_SIZE]; //!< terms of the expansion
+} FpeSum;
+
+///@cond
+// Add x to the expansion a with 2Sum, from the first term on. The remainder
+// is zero as soon as a term absorbs x exactly; what is left after the last
+// but one term is rounded into the last one.
+static inline void FpeAdd(double *a, double x) {
+    for (int i = 0; i < FPE_SIZE-1; i++) {
+        // Knuth 2Sum
+        double s = a[i] + x, z = s - a[i];
+        x = (a[i] - (s - z)) + (x - z);
+        a[i] = s;
+        if (x == 0.)
+            return;
+    }
+    a[FPE_SIZE-1] += x;
+}
+
+// Add the product a*b, as its rounded value and its FMA error
+static inline void FpeAddProduct(double *sum, double a, double b) {
+    double p = a * b;
+    FpeAdd(sum, p);
+    FpeAdd(sum, std::fma(a, b, -p));
+}
+
+// Add the expansion src to dst, term by term
+static inline void FpeMerge(FpeSum *dst, const FpeSum *src) {
+    for (int i = 0; i < FPE_SIZE; i++)
+        if (src->a[i] != 0.)
+            FpeAdd(dst->a, src->a[i]);
+}
+
+// K dot products on one thread
+template<int K>
+void FpeDOT(int N, const double* const* a, const double* const* b, FpeSum* sum) {
+    for (int i = 0; i < N; i++)
+        for (int k = 0; k < K; k++)
+            FpeAddProduct(sum[k].a, a[k][i], b[k][i]);
+}
+
+// z = fma(alpha, x, y) and the K dots <w_k, z>, element by element. z may be
+// y and w_k may be z.
+template<int K>
+void FpeAXPYDOT(int N, double alpha, const double* x, const double* y, double* z, const double* const* w, FpeSum* sum) {
+    for (int i = 0; i < N; i++) {
+        z[i] = std::fma(alpha, x[i], y[i]);
+        for (int k = 0; k < K; k++)
+            FpeAddProduct(sum[k].a, w[k][i], z[i]);
+    }
+}
+
+// Split [0,N) among the OpenMP threads as BinnedSweep, and merge the
+// expansions of the threads in their order
+template<int K, class Sweep>
+void FpeSweep(int N, FpeSum* sum, Sweep sweep) {
+    for (int k = 0; k < K; k++)
+        std::fill(sum[k].a, sum[k].a + FPE_SIZE, 0.);
+#ifdef _OPENMP
+    int nthreads = omp_in_parallel() ? 1 : std::min(omp_get_max_threads(), N / OMP_GRAIN);
+    if (nthreads > 1) {
+        std::vector<FpeSum> partial(nthreads*K);
+        for (auto &p : partial)
+            std::fill(p.a, p.a + FPE_SIZE, 0.);
+        #pragma omp parallel num_threads(nthreads)
+        {
+            int t = omp_get_thread_num(), nt = omp_get_num_threads();
+            int blocks = (N + 7) / 8;
+            int begin = std::min(N, (int)((int64_t)blocks * t / nt) * 8);
+            int end   = std::min(N, (int)((int64_t)blocks * (t+1) / nt) * 8);
+            sweep(begin, end, &partial[t*K]);
+        }
+        for (int t = 0; t < nthreads; t++)
+            for (int k = 0; k < K; k++)
+                FpeMerge(&sum[k], &partial[t*K + k]);
+        return;
+    }
+#endif//_OPENMP
+    sweep(0, N, sum);
+}
+///@endcond
+
+/*!@brief rounds an expansion to a double
+ *
+ * @ingroup highlevel
+ * @param sum sum filled by fpe_dot (and reduced by ReproAllReduce)
+ * @return the sum of the terms, correctly rounded (NaN if one of them is not finite)
+*/
+static inline double FpeRound(const FpeSum *sum) {
+    double tmp[FPE_SIZE];
+    for (int i = 0; i < FPE_SIZE; i++) {
+        if (!std::isfinite(sum->a[i]))
+            return NAN;
+        tmp[i] = sum->a[i];
+    }
+    return NearSum(FPE_SIZE, tmp, 1);
+}
+
+/*!@brief several dot products with floating-point expansions
+ *
+ * Computes the K sums \f[ \sum_{i=0}^{N-1} x_{k,i} y_{k,i} \f] as expansions of
+ * \c exblas::FPE_SIZE terms. The result is exact and reproducible only within
+ * the limits given at the top of fpe.h. Threads are used as in exdot.
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @param size size N of the arrays to sum
+ * @param x1_ptr K first arrays
+ * @param x2_ptr K second arrays
+ * @param h_fpe pointer to at least \c K sums (contents are overwritten)
+*/
+template<int K>
+void fpe_dot(unsigned size, const double* const (&x1_ptr)[K], const double* const (&x2_ptr)[K], FpeSum* h_fpe) {
+    FpeSweep<K>((int)size, h_fpe, [&](int begin, int end, FpeSum* mine) {
+        const double *as[K], *bs[K];
+        for (int k = 0; k < K; k++) {
+            as[k] = x1_ptr[k] + begin;
+            bs[k] = x2_ptr[k] + begin;
+        }
+        FpeDOT<K>(end-begin, as, bs, mine);
+    });
+}
+
+/*!@brief dot product with a floating-point expansion
+ *
+ * @ingroup highlevel
+ * @param size size N of the arrays to sum
+ * @param x1_ptr first array
+ * @param x2_ptr second array
+ * @param h_fpe pointer to a sum (contents are overwritten)
+*/
+static inline void fpe_dot(unsigned size, const double* x1_ptr, const double* x2_ptr, FpeSum* h_fpe) {
+    const double* const x1[1] = {x1_ptr};
+    const double* const x2[1] = {x2_ptr};
+    fpe_dot<1>(size, x1, x2, h_fpe);
+}
+
+/*!@brief vector update followed by K dot products of the result with floating-point expansions, in one pass
+ *
+ * Computes \f$ z = y + \alpha x \f$ as exaxpy_dot and the sums of
+ * \f$ (w_k, z) \f$ as fpe_dot.
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @param size size N of the arrays
+ * @param alpha scalar of the update
+ * @param x array scaled by alpha
+ * @param y array added to alpha * x (may be z)
+ * @param z updated array (output)
+ * @param w K first operands of the dot products, any of them may be z
+ * @param h_fpe pointer to at least \c K sums (contents are overwritten)
+*/
+template<int K>
+void fpe_axpy_dot(unsigned size, double alpha, const double* x, const double* y, double* z, const double* const (&w)[K], FpeSum* h_fpe) {
+    FpeSweep<K>((int)size, h_fpe, [&](int begin, int end, FpeSum* mine) {
+        const double* ws[K];
+        for (int k = 0; k < K; k++)
+            ws[k] = w[k] + begin;
+        FpeAXPYDOT<K>(end-begin, alpha, x+begin, y+begin, z+begin, ws, mine);
+    });
+}
+
+}//namespace cpu
+}//namespace exblas
@@ -0,0 +1,631 @@
+/**
+ *  @file mpi_accumulate.h
+ *  @brief Reproducible reduction of superaccumulators over MPI processes
+ */
+#pragma once
+#include <mpi.h>
+#include <algorithm>
+#include <vector>
+
+#include "accumulate.h"
+
+namespace exblas {
+namespace cpu {
+
+///@cond
+// User-defined reduction: add normalized superaccumulators bin by bin and
+// propagate the carries right away, so that the partial results stay
+// normalized whatever the number of processes and the shape of the tree.
+static void SuperaccSum(void *invec, void *inoutvec, int *len, MPI_Datatype *dtype) {
+    int64_t *in = (int64_t *) invec, *inout = (int64_t *) inoutvec;
+
+    for (int k = 0; k < *len; k++) {
+        for (int i = 0; i < BIN_COUNT; i++)
+            inout[i] += in[i];
+        int imin = IMIN, imax = IMAX;
+        Normalize(inout, imin, imax);
+        in += BIN_COUNT; inout += BIN_COUNT;
+    }
+}
+
+// Contiguous MPI datatype holding a whole superaccumulator (BIN_COUNT words)
+static inline MPI_Datatype SuperaccType() {
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    if (type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(BIN_COUNT, MPI_INT64_T, &type);
+        MPI_Type_commit(&type);
+    }
+    return type;
+}
+
+static inline MPI_Op SuperaccOp() {
+    static MPI_Op op = MPI_OP_NULL;
+    if (op == MPI_OP_NULL)
+        MPI_Op_create(SuperaccSum, 1, &op);
+    return op;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Compact wire format
+////////////////////////////////////////////////////////////////////////////////
+// A record is one header word followed by WIN_COUNT words of the
+// superaccumulator, starting at word lo. The header holds lo, the highest
+// significant word hi of all the contributions merged so far, and an
+// overflow flag. The words below lo are zero and the top word of the window
+// is signed, so it absorbs the sign extension of negative values.
+// lo and hi only grow by min/max, so whether a record overflows does not
+// depend on the order of the merges and all processes agree on it.
+static constexpr int WIRE_COUNT = 1 + WIN_COUNT;
+
+static inline int64_t WireHeader(int lo, int hi, int overflow) {
+    return (int64_t) lo | ((int64_t) (hi + 1) << 8) | ((int64_t) overflow << 16);
+}
+
+static inline void WireSplit(int64_t header, int &lo, int &hi, int &overflow) {
+    lo = (int) (header & 0xff);
+    hi = (int) ((header >> 8) & 0xff) - 1;
+    overflow = (int) ((header >> 16) & 1);
+}
+
+// Significant words [lo, hi] of a normalized superaccumulator: the words
+// below lo are zero and the words above hi only carry the sign.
+// An empty superaccumulator gives lo = BIN_COUNT and hi = -1.
+static inline void SuperaccSpan(const int64_t *accumulator, int &lo, int &hi) {
+    for (lo = IMIN; lo <= IMAX && accumulator[lo] == 0; lo++) {
+    }
+    if (lo > IMAX) {
+        hi = -1;
+        return;
+    }
+    int64_t word = accumulator[IMAX];
+    for (hi = IMAX; hi > lo && (word == 0 || word == -1); hi--)
+        word = accumulator[hi-1] + word * (1ll << DIGITS);
+}
+
+// Fill the words of a record from a normalized superaccumulator. The words
+// above the window are folded into its top word (the accumulator is
+// modified but keeps its value).
+static inline void WireWords(int64_t *accumulator, int lo, int64_t *words) {
+    int top = std::min(lo + WIN_COUNT - 1, IMAX);
+    for (int i = IMAX; i > top; i--) {
+        accumulator[i-1] += accumulator[i] * (1ll << DIGITS);
+        accumulator[i] = 0;
+    }
+    for (int j = 0; j < WIN_COUNT; j++)
+        words[j] = (lo + j <= top) ? accumulator[lo + j] : 0;
+}
+
+static inline void WireEncode(int64_t *accumulator, int64_t *record) {
+    int lo, hi;
+    SuperaccSpan(accumulator, lo, hi);
+    int overflow = (hi >= lo) && (hi - lo + 2 > WIN_COUNT);
+    record[0] = WireHeader(lo, hi, overflow);
+    if (overflow || hi < lo)
+        std::fill(record + 1, record + WIRE_COUNT, 0);
+    else
+        WireWords(accumulator, lo, record + 1);
+}
+
+static inline void WireDecode(const int64_t *record, int64_t *accumulator) {
+    int lo, hi, overflow;
+    WireSplit(record[0], lo, hi, overflow);
+    std::fill(accumulator, accumulator + BIN_COUNT, 0);
+    for (int j = 0; j < WIN_COUNT && lo + j <= IMAX; j++)
+        accumulator[lo + j] = record[1 + j];
+}
+
+// User-defined reduction on records: realign both windows on a full
+// superaccumulator, add them, propagate the carries and cut the window again
+static void WireSum(void *invec, void *inoutvec, int *len, MPI_Datatype *dtype) {
+    int64_t *in = (int64_t *) invec, *inout = (int64_t *) inoutvec;
+    int64_t acc[BIN_COUNT], tmp[BIN_COUNT];
+
+    for (int k = 0; k < *len; k++) {
+        int lo1, hi1, of1, lo2, hi2, of2;
+        WireSplit(in[0], lo1, hi1, of1);
+        WireSplit(inout[0], lo2, hi2, of2);
+        int lo = std::min(lo1, lo2), hi = std::max(hi1, hi2);
+        // one word of headroom for the carry out of the top word
+        int overflow = of1 || of2 || ((hi >= lo) && (hi - lo + 2 > WIN_COUNT));
+        if (!overflow && hi >= lo) {
+            WireDecode(in, acc);
+            WireDecode(inout, tmp);
+            for (int i = 0; i < BIN_COUNT; i++)
+                acc[i] += tmp[i];
+            int imin = IMIN, imax = IMAX;
+            Normalize(acc, imin, imax);
+            WireWords(acc, lo, inout + 1);
+        }
+        inout[0] = WireHeader(lo, hi, overflow);
+        in += WIRE_COUNT; inout += WIRE_COUNT;
+    }
+}
+
+static inline MPI_Datatype WireType() {
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    if (type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(WIRE_COUNT, MPI_INT64_T, &type);
+        MPI_Type_commit(&type);
+    }
+    return type;
+}
+
+static inline MPI_Op WireOp() {
+    static MPI_Op op = MPI_OP_NULL;
+    if (op == MPI_OP_NULL)
+        MPI_Op_create(WireSum, 1, &op);
+    return op;
+}
+
+// Round the merged records into result. If any of them did not fit in its
+// window, all the processes see it and redo the reduction in full format.
+static inline void WireFinish(int num, int64_t *h_superacc, const int64_t *wire, double *result, MPI_Comm comm) {
+    int lo, hi, overflow = 0, flag;
+
+    for (int k = 0; k < num; k++) {
+        WireSplit(wire[k*WIRE_COUNT], lo, hi, flag);
+        overflow |= flag;
+    }
+    if (overflow) {
+        int imin = IMIN, imax = IMAX;
+        for (int k = 0; k < num; k++)
+            Normalize(&h_superacc[k*BIN_COUNT], imin, imax);
+        MPI_Allreduce(MPI_IN_PLACE, h_superacc, num, SuperaccType(), SuperaccOp(), comm);
+    } else {
+        for (int k = 0; k < num; k++)
+            WireDecode(&wire[k*WIRE_COUNT], &h_superacc[k*BIN_COUNT]);
+    }
+    for (int k = 0; k < num; k++)
+        result[k] = Round(&h_superacc[k*BIN_COUNT]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Node-aware reduction
+////////////////////////////////////////////////////////////////////////////////
+// The ranks of a node merge their superaccumulators through channels: shared
+// windows with one slot per rank, holding a sequence word and the
+// superaccumulators of the rank, and in the slot of the leader (node rank 0)
+// the sequence word and the rounded results of the last reduction. Every
+// rank counts the reductions started on a channel in the same order. A rank
+// copies its normalized superaccumulators in its slot and then stores the
+// sequence number in it, without waiting for the others; the leader adds
+// the slots in rank order once they all carry the current number, reduces
+// with the other leaders and publishes the results in the same way. A rank
+// writes its slot again only after it has read the results of the previous
+// reduction, which the leader publishes after it has read the slots, so no
+// barrier is needed. Persistent requests own a channel of their size; the
+// other reductions share one channel of the node, grown on demand.
+typedef struct {
+    MPI_Win win;                    // shared window of the channel
+    int cap;                        // number of superaccumulators of every slot
+    int64_t seq;                    // number of reductions started on the channel
+    std::vector<int64_t*> slot;     // of every rank: sequence word, then cap superaccumulators
+    int64_t *done;                  // sequence word of the results, in the slot of the leader
+    double *result;                 // cap results, after it
+} ReproChannel;
+
+typedef struct {
+    MPI_Comm node;                  // ranks sharing memory with this one
+    MPI_Comm leaders;               // rank 0 of every node (MPI_COMM_NULL elsewhere)
+    int rank, size;                 // rank in node and size of node
+    ReproChannel *shared;           // channel of the reductions that are not persistent
+    int shared_busy;                // a reduction is in progress on it
+} ReproNode;
+
+static inline ReproChannel *ChannelCreate(ReproNode *node, int cap) {
+    ReproChannel *ch = new ReproChannel;
+    int disp;
+    MPI_Aint bytes, words = 1 + (MPI_Aint) cap * BIN_COUNT + ((node->rank == 0) ? 1 + cap : 0);
+    int64_t *base;
+
+    ch->cap = cap;
+    ch->seq = 0;
+    MPI_Win_allocate_shared(words * sizeof(int64_t), sizeof(int64_t), MPI_INFO_NULL, node->node, &base, &ch->win);
+    ch->slot.resize(node->size);
+    for (int j = 0; j < node->size; j++)
+        MPI_Win_shared_query(ch->win, j, &bytes, &disp, &ch->slot[j]);
+    ch->done = ch->slot[0] + 1 + (MPI_Aint) cap * BIN_COUNT;
+    ch->result = (double *) (ch->done + 1);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, ch->win);
+    base[0] = 0;
+    if (node->rank == 0)
+        *(ch->done) = 0;
+    MPI_Win_sync(ch->win);
+    MPI_Barrier(node->node);
+    MPI_Win_sync(ch->win);
+    return ch;
+}
+
+// Collective on the node, as the creation
+static inline void ChannelFree(ReproChannel *ch) {
+    MPI_Win_unlock_all(ch->win);
+    MPI_Win_free(&ch->win);
+    delete ch;
+}
+
+// Store seq in a sequence word after the data it covers
+static inline void ChannelPublish(ReproChannel *ch, int64_t *word, int64_t seq) {
+    MPI_Win_sync(ch->win);
+    __atomic_store_n(word, seq, __ATOMIC_RELEASE);
+}
+
+// Whether a sequence word holds seq, the data it covers can then be read
+static inline int ChannelArrived(ReproChannel *ch, int64_t *word, int64_t seq) {
+    if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != seq)
+        return 0;
+    MPI_Win_sync(ch->win);
+    return 1;
+}
+
+static int NodeDelete(MPI_Comm comm, int keyval, void *attr, void *extra) {
+    ReproNode *node = (ReproNode *) attr;
+    ChannelFree(node->shared);
+    if (node->leaders != MPI_COMM_NULL)
+        MPI_Comm_free(&node->leaders);
+    MPI_Comm_free(&node->node);
+    delete node;
+    return MPI_SUCCESS;
+}
+
+static inline int NodeKeyval() {
+    static int keyval = MPI_KEYVAL_INVALID;
+    if (keyval == MPI_KEYVAL_INVALID)
+        MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, NodeDelete, &keyval, NULL);
+    return keyval;
+}
+
+// Node context attached to comm, or NULL if the node-aware reduction is not enabled
+static inline ReproNode *NodeGet(MPI_Comm comm) {
+    ReproNode *node;
+    int flag;
+    MPI_Comm_get_attr(comm, NodeKeyval(), &node, &flag);
+    return flag ? node : NULL;
+}
+
+// Channel of a reduction of num superaccumulators that is not persistent:
+// the shared one, grown if needed, or a new one if it is in use. All the
+// ranks of the node take the same decisions, in the same order.
+static inline ReproChannel *NodeTake(ReproNode *node, int num, int &owned) {
+    owned = node->shared_busy;
+    if (owned)
+        return ChannelCreate(node, num);
+    if (node->shared->cap < num) {
+        ChannelFree(node->shared);
+        node->shared = ChannelCreate(node, num);
+    }
+    node->shared_busy = 1;
+    return node->shared;
+}
+
+static inline void NodeRelease(ReproNode *node, ReproChannel *ch, int owned) {
+    if (owned)
+        ChannelFree(ch);
+    else
+        node->shared_busy = 0;
+}
+
+// Start a reduction on the channel: normalize the superaccumulators and,
+// outside of the leader, publish them in the slot of this rank
+static inline void NodePost(ReproNode *node, ReproChannel *ch, int num, int64_t *h_superacc) {
+    int imin = IMIN, imax = IMAX;
+
+    ch->seq++;
+    for (int k = 0; k < num; k++)
+        Normalize(&h_superacc[k*BIN_COUNT], imin, imax);
+    if (node->rank == 0)
+        return;
+    std::copy(h_superacc, h_superacc + num*BIN_COUNT, ch->slot[node->rank] + 1);
+    ChannelPublish(ch, ch->slot[node->rank], ch->seq);
+}
+
+// On the leader, add the slots of the node into h_superacc with plain
+// integer adds once they have all arrived (waiting for them if wait is set).
+// The words of normalized superaccumulators are below 2^DIGITS, so the
+// carries only need to be propagated every 2^KRX-1 slots. Returns whether
+// the slots were merged.
+static inline int NodeMerge(ReproNode *node, ReproChannel *ch, int num, int64_t *h_superacc, int wait) {
+    int imin = IMIN, imax = IMAX;
+
+    for (int j = 1; j < node->size; j++)
+        while (!ChannelArrived(ch, ch->slot[j], ch->seq))
+            if (!wait)
+                return 0;
+    for (int j = 1; j < node->size; j++) {
+        for (int i = 0; i < num*BIN_COUNT; i++)
+            h_superacc[i] += ch->slot[j][1+i];
+        if (j % ((1 << KRX) - 1) == 0 || j == node->size - 1)
+            for (int k = 0; k < num; k++)
+                Normalize(&h_superacc[k*BIN_COUNT], imin, imax);
+    }
+    return 1;
+}
+
+// Hand the results of the leader to the other ranks of the node; outside of
+// the leader, wait for them
+static inline void NodeScatter(ReproNode *node, ReproChannel *ch, int num, double *result) {
+    if (node->rank == 0) {
+        std::copy(result, result + num, ch->result);
+        ChannelPublish(ch, ch->done, ch->seq);
+        return;
+    }
+    while (!ChannelArrived(ch, ch->done, ch->seq)) {
+    }
+    std::copy(ch->result, ch->result + num, result);
+}
+///@endcond
+
+/**
+* @brief Enable the node-aware reduction of superaccumulators on a communicator
+*
+* The ranks of \c comm that share memory merge their superaccumulators in
+* shared windows, and only one rank per node takes part in the reduction
+* between nodes. ReproAllReduce and ReproAllReduceBegin/End on \c comm use it
+* from then on, for batches of any size. The results are bitwise identical
+* to the flat reduction. Collective on \c comm.
+*
+* @ingroup highlevel
+* @param comm communicator of the later reductions
+*/
+static inline void ReproNodeReductionEnable(MPI_Comm comm) {
+    if (NodeGet(comm) != NULL)
+        return;
+    ReproNode *node = new ReproNode;
+    int wrank;
+
+    MPI_Comm_rank(comm, &wrank);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, wrank, MPI_INFO_NULL, &node->node);
+    MPI_Comm_rank(node->node, &node->rank);
+    MPI_Comm_size(node->node, &node->size);
+    MPI_Comm_split(comm, (node->rank == 0) ? 0 : MPI_UNDEFINED, wrank, &node->leaders);
+    node->shared = ChannelCreate(node, 16);
+    node->shared_busy = 0;
+    MPI_Comm_set_attr(comm, NodeKeyval(), node);
+}
+
+/**
+* @brief Go back to the flat reduction on a communicator and free the shared windows
+*
+* Collective on \c comm, to be called before MPI_Finalize, once the
+* persistent requests on \c comm have been freed.
+* @ingroup highlevel
+* @param comm communicator given to ReproNodeReductionEnable
+*/
+static inline void ReproNodeReductionDisable(MPI_Comm comm) {
+    if (NodeGet(comm) != NULL)
+        MPI_Comm_delete_attr(comm, NodeKeyval());
+}
+
+/**
+* @brief Handle of a nonblocking reproducible allreduce
+*
+* @ingroup highlevel
+*/
+typedef struct {
+    int num;                    //!< number of superaccumulators being reduced
+    int64_t *h_superacc;        //!< buffer holding the superaccumulators
+    std::vector<int64_t> wire;  //!< compact records in flight
+    MPI_Comm comm;              //!< communicator of the reduction
+    MPI_Request req;            //!< request of the underlying MPI_Iallreduce
+    ReproNode *node;            //!< node context if the reduction is node-aware, NULL otherwise
+    ReproChannel *chan;         //!< channel of the node-aware reduction
+    int owned;                  //!< the channel belongs to the request (not to the node)
+    int merged;                 //!< on a leader, the slots of the node are merged and the reduction between leaders started
+    int persistent;             //!< set by ReproAllReduceInit, the request is reused by ReproAllReduceStart
+} ReproRequest;
+
+///@cond
+// Fill the fields of req; with the node-aware reduction, only the leaders
+// get a wire buffer and talk on the communicator of the leaders
+static inline void ReproRequestSetup(int num, int64_t *h_superacc, MPI_Comm comm, int persistent, ReproRequest *req) {
+    req->num = num; req->h_superacc = h_superacc; req->comm = comm;
+    req->node = NodeGet(comm);
+    req->req = MPI_REQUEST_NULL;
+    req->chan = NULL;
+    req->owned = 0;
+    req->persistent = persistent;
+    if (req->node != NULL) {
+        if (persistent) {
+            req->chan = ChannelCreate(req->node, num);
+            req->owned = 1;
+        } else {
+            req->chan = NodeTake(req->node, num, req->owned);
+        }
+        if (req->node->rank != 0)
+            return;
+        req->comm = req->node->leaders;
+    }
+    req->wire.resize(num * WIRE_COUNT);
+}
+
+// Pack the (merged) superaccumulators and start the reduction between the
+// processes, or between the leaders
+static inline void ReproWireStart(ReproRequest *req) {
+    int imin = IMIN, imax = IMAX;
+
+    req->merged = 1;
+    for (int k = 0; k < req->num; k++) {
+        Normalize(&(req->h_superacc[k*BIN_COUNT]), imin, imax);
+        WireEncode(&(req->h_superacc[k*BIN_COUNT]), &(req->wire[k*WIRE_COUNT]));
+    }
+#if MPI_VERSION >= 4
+    if (req->persistent) {
+        MPI_Start(&(req->req));
+        return;
+    }
+#endif
+    MPI_Iallreduce(MPI_IN_PLACE, &(req->wire[0]), req->num, WireType(), WireOp(), req->comm, &(req->req));
+}
+///@endcond
+
+/**
+* @brief Create a persistent reproducible allreduce of a batch of superaccumulators
+*
+* Everything that does not depend on the values (node channel, buffers and,
+* with MPI 4, the persistent MPI_Allreduce_init request) is set up once. Each
+* reduction is then ReproAllReduceStart followed by ReproAllReduceEnd, on the
+* contents of \c h_superacc at the time of the start. Collective on \c comm.
+*
+* @ingroup highlevel
+* @param num number of superaccumulators stored one after the other in \c h_superacc
+* @param h_superacc pointer to \c num*BIN_COUNT 64 bit integers, fixed for the life of the request
+* @param comm communicator over which the reduction is done
+* @param req handle to pass to ReproAllReduceStart, ReproAllReduceEnd and ReproAllReduceFree
+*/
+static inline void ReproAllReduceInit(int num, int64_t *h_superacc, MPI_Comm comm, ReproRequest *req) {
+    ReproRequestSetup(num, h_superacc, comm, 1, req);
+#if MPI_VERSION >= 4
+    if (req->node == NULL || req->node->rank == 0)
+        MPI_Allreduce_init(MPI_IN_PLACE, &(req->wire[0]), num, WireType(), WireOp(), req->comm, MPI_INFO_NULL, &(req->req));
+#endif
+}
+
+/**
+* @brief Start a reduction of a request created by ReproAllReduceInit
+*
+* The superaccumulators are normalized and packed in the compact format.
+* With the node-aware reduction, they are published in the channel of the
+* node without waiting for the other ranks; the leader merges them and
+* starts the reduction between the nodes as soon as they have all arrived,
+* here or in ReproAllReduceTest or ReproAllReduceEnd.
+* Without MPI 4 persistent collectives, an MPI_Iallreduce is started on
+* the arguments cached by ReproAllReduceInit.
+*
+* @ingroup highlevel
+* @param req handle of the reduction, completed by ReproAllReduceEnd
+*/
+static inline void ReproAllReduceStart(ReproRequest *req) {
+    req->merged = 0;
+    if (req->node != NULL) {
+        NodePost(req->node, req->chan, req->num, req->h_superacc);
+        if (req->node->rank != 0 || !NodeMerge(req->node, req->chan, req->num, req->h_superacc, 0))
+            return;
+    }
+    ReproWireStart(req);
+}
+
+/**
+* @brief Free a request created by ReproAllReduceInit
+*
+* With the node-aware reduction this frees the channel of the request, so it
+* is collective on the node.
+*
+* @ingroup highlevel
+* @param req handle of an inactive persistent reduction
+*/
+static inline void ReproAllReduceFree(ReproRequest *req) {
+    if (req->req != MPI_REQUEST_NULL)
+        MPI_Request_free(&(req->req));
+    if (req->chan != NULL && req->owned)
+        ChannelFree(req->chan);
+    req->chan = NULL;
+}
+
+/**
+* @brief Start a nonblocking reproducible allreduce of a batch of superaccumulators
+*
+* The superaccumulators are normalized, packed in the compact format and
+* handed to MPI_Iallreduce (with the node-aware reduction, as in
+* ReproAllReduceStart). The buffer must not be touched until
+* ReproAllReduceEnd has returned.
+*
+* @ingroup highlevel
+* @param num number of superaccumulators stored one after the other in \c h_superacc
+* @param h_superacc pointer to \c num*BIN_COUNT 64 bit integers (contents are overwritten)
+* @param comm communicator over which the reduction is done
+* @param req handle to pass to ReproAllReduceTest and ReproAllReduceEnd
+*/
+static inline void ReproAllReduceBegin(int num, int64_t *h_superacc, MPI_Comm comm, ReproRequest *req) {
+    ReproRequestSetup(num, h_superacc, comm, 0, req);
+    ReproAllReduceStart(req);
+}
+
+/**
+* @brief Check whether a nonblocking reproducible allreduce has finished
+*
+* On a leader of the node-aware reduction, this also merges the slots of
+* the node and starts the reduction between the nodes once they have all
+* arrived. The other ranks of a node are done once their leader has
+* published the results, in its ReproAllReduceEnd.
+*
+* @ingroup highlevel
+* @param req handle returned by ReproAllReduceBegin or started by ReproAllReduceStart
+* @return nonzero if ReproAllReduceEnd will not wait for the reduction
+*/
+static inline int ReproAllReduceTest(ReproRequest *req) {
+    int flag = 0;
+
+    if (req->node != NULL) {
+        if (req->node->rank != 0)
+            return ChannelArrived(req->chan, req->chan->done, req->chan->seq);
+        if (!req->merged) {
+            if (!NodeMerge(req->node, req->chan, req->num, req->h_superacc, 0))
+                return 0;
+            ReproWireStart(req);
+        }
+    }
+    MPI_Test(&(req->req), &flag, MPI_STATUS_IGNORE);
+    return flag;
+}
+
+/**
+* @brief Complete a nonblocking reproducible allreduce and round its results
+*
+* @ingroup highlevel
+* @param req handle returned by ReproAllReduceBegin or started by ReproAllReduceStart
+* @param result pointer to \c req->num doubles receiving the rounded sums
+*/
+static inline void ReproAllReduceEnd(ReproRequest *req, double *result) {
+    if (req->node == NULL || req->node->rank == 0) {
+        if (!req->merged) {
+            NodeMerge(req->node, req->chan, req->num, req->h_superacc, 1);
+            ReproWireStart(req);
+        }
+        MPI_Wait(&(req->req), MPI_STATUS_IGNORE);
+        WireFinish(req->num, req->h_superacc, &(req->wire[0]), result, req->comm);
+    }
+    if (req->node != NULL) {
+        NodeScatter(req->node, req->chan, req->num, result);
+        if (!req->persistent)
+            NodeRelease(req->node, req->chan, req->owned);
+    }
+}
+
+/**
+* @brief Reproducible allreduce of a batch of superaccumulators
+*
+* Every process normalizes its superaccumulators and keeps only the window
+* of words that are not zero (or sign extension). A single MPI_Allreduce
+* merges the windows with carry propagation, and every process rounds the
+* result locally. When the merged span does not fit in \c WIN_COUNT words the
+* reduction is repeated on the full superaccumulators. The result is bitwise
+* identical on all processes and independent of their number.
+* If ReproNodeReductionEnable was called on \c comm, the superaccumulators
+* are first merged inside every node.
+*
+* @ingroup highlevel
+* @param num number of superaccumulators stored one after the other in \c h_superacc
+* @param h_superacc pointer to \c num*BIN_COUNT 64 bit integers (contents are overwritten)
+* @param result pointer to \c num doubles receiving the rounded sums
+* @param comm communicator over which the reduction is done
+*/
+static inline void ReproAllReduce(int num, int64_t *h_superacc, double *result, MPI_Comm comm) {
+    if (NodeGet(comm) != NULL) {
+        ReproRequest req;
+        ReproAllReduceBegin(num, h_superacc, comm, &req);
+        ReproAllReduceEnd(&req, result);
+        return;
+    }
+
+    int imin = IMIN, imax = IMAX;
+    std::vector<int64_t> wire(num * WIRE_COUNT);
+
+    for (int k = 0; k < num; k++) {
+        Normalize(&h_superacc[k*BIN_COUNT], imin, imax);
+        WireEncode(&h_superacc[k*BIN_COUNT], &wire[k*WIRE_COUNT]);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &wire[0], num, WireType(), WireOp(), comm);
+    WireFinish(num, h_superacc, &wire[0], result, comm);
+}
+
+}//namespace cpu
+}//namespace exblas
@@ -0,0 +1,159 @@
+/**
+ *  @file mpi_binned.h
+ *  @brief Reproducible reduction of binned sums over MPI processes
+ *
+ *  Same interface as mpi_accumulate.h, for the binned sums of binned.h: the
+ *  functions take the sums as doubles and a BinnedRequest. Each reduction is
+ *  one MPI_Allreduce on \c exblas::BINNED_WORDS doubles per sum.
+ */
+#pragma once
+#include <mpi.h>
+
+#include "binned.h"
+
+namespace exblas {
+namespace cpu {
+
+///@cond
+// User-defined reduction: the merge of renormalized binned sums is exact and
+// gives a renormalized sum, so the result does not depend on the tree
+static void BinnedSum(void *invec, void *inoutvec, int *len, MPI_Datatype *dtype) {
+    double *in = (double *) invec, *inout = (double *) inoutvec;
+
+    for (int k = 0; k < *len; k++) {
+        BinnedMerge(inout, in);
+        in += BINNED_WORDS; inout += BINNED_WORDS;
+    }
+}
+
+// Contiguous MPI datatype holding a whole binned sum (BINNED_WORDS doubles)
+static inline MPI_Datatype BinnedType() {
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    if (type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(BINNED_WORDS, MPI_DOUBLE, &type);
+        MPI_Type_commit(&type);
+    }
+    return type;
+}
+
+static inline MPI_Op BinnedOp() {
+    static MPI_Op op = MPI_OP_NULL;
+    if (op == MPI_OP_NULL)
+        MPI_Op_create(BinnedSum, 1, &op);
+    return op;
+}
+
+static inline void BinnedFinish(int num, const double *h_binned, double *result) {
+    for (int k = 0; k < num; k++)
+        result[k] = BinnedRound(&h_binned[k*BINNED_WORDS]);
+}
+///@endcond
+
+/**
+* @brief Reproducible allreduce of a batch of binned sums
+*
+* The result is bitwise identical on all processes and independent of their
+* number. The node-aware reduction of mpi_accumulate.h is not used, the
+* messages are small enough.
+*
+* @ingroup highlevel
+* @param num number of binned sums stored one after the other in \c h_binned
+* @param h_binned pointer to \c num*BINNED_WORDS doubles, as filled by binned_dot (contents are overwritten)
+* @param result pointer to \c num doubles receiving the rounded sums
+* @param comm communicator over which the reduction is done
+*/
+static inline void ReproAllReduce(int num, double *h_binned, double *result, MPI_Comm comm) {
+    MPI_Allreduce(MPI_IN_PLACE, h_binned, num, BinnedType(), BinnedOp(), comm);
+    BinnedFinish(num, h_binned, result);
+}
+
+/**
+* @brief Handle of a nonblocking reproducible allreduce of binned sums
+*
+* @ingroup highlevel
+*/
+typedef struct {
+    int num;                    //!< number of binned sums being reduced
+    double *h_binned;           //!< buffer holding the binned sums, reduced in place
+    MPI_Comm comm;              //!< communicator of the reduction
+    MPI_Request req;            //!< request of the underlying MPI_Iallreduce
+    int persistent;             //!< set by ReproAllReduceInit, the request is reused by ReproAllReduceStart
+} BinnedRequest;
+
+/**
+* @brief Create a persistent reproducible allreduce of a batch of binned sums
+*
+* @ingroup highlevel
+* @param num number of binned sums stored one after the other in \c h_binned
+* @param h_binned pointer to \c num*BINNED_WORDS doubles, fixed for the life of the request
+* @param comm communicator over which the reduction is done
+* @param req handle to pass to ReproAllReduceStart, ReproAllReduceEnd and ReproAllReduceFree
+*/
+static inline void ReproAllReduceInit(int num, double *h_binned, MPI_Comm comm, BinnedRequest *req) {
+    req->num = num; req->h_binned = h_binned; req->comm = comm;
+    req->req = MPI_REQUEST_NULL;
+    req->persistent = 1;
+#if MPI_VERSION >= 4
+    MPI_Allreduce_init(MPI_IN_PLACE, h_binned, num, BinnedType(), BinnedOp(), comm, MPI_INFO_NULL, &(req->req));
+#endif
+}
+
+/**
+* @brief Start a reduction of a request created by ReproAllReduceInit
+*
+* @ingroup highlevel
+* @param req handle of the reduction, completed by ReproAllReduceEnd
+*/
+static inline void ReproAllReduceStart(BinnedRequest *req) {
+#if MPI_VERSION >= 4
+    if (req->persistent) {
+        MPI_Start(&(req->req));
+        return;
+    }
+#endif
+    MPI_Iallreduce(MPI_IN_PLACE, req->h_binned, req->num, BinnedType(), BinnedOp(), req->comm, &(req->req));
+}
+
+/**
+* @brief Free a request created by ReproAllReduceInit
+*
+* @ingroup highlevel
+* @param req handle of an inactive persistent reduction
+*/
+static inline void ReproAllReduceFree(BinnedRequest *req) {
+    if (req->req != MPI_REQUEST_NULL)
+        MPI_Request_free(&(req->req));
+}
+
+/**
+* @brief Start a nonblocking reproducible allreduce of a batch of binned sums
+*
+* The buffer must not be touched until ReproAllReduceEnd has returned.
+*
+* @ingroup highlevel
+* @param num number of binned sums stored one after the other in \c h_binned
+* @param h_binned pointer to \c num*BINNED_WORDS doubles (contents are overwritten)
+* @param comm communicator over which the reduction is done
+* @param req handle to pass to ReproAllReduceEnd
+*/
+static inline void ReproAllReduceBegin(int num, double *h_binned, MPI_Comm comm, BinnedRequest *req) {
+    req->num = num; req->h_binned = h_binned; req->comm = comm;
+    req->req = MPI_REQUEST_NULL;
+    req->persistent = 0;
+    ReproAllReduceStart(req);
+}
+
+/**
+* @brief Complete a nonblocking reproducible allreduce of binned sums and round its results
+*
+* @ingroup highlevel
+* @param req handle returned by ReproAllReduceBegin or started by ReproAllReduceStart
+* @param result pointer to \c req->num doubles receiving the rounded sums
+*/
+static inline void ReproAllReduceEnd(BinnedRequest *req, double *result) {
+    MPI_Wait(&(req->req), MPI_STATUS_IGNORE);
+    BinnedFinish(req->num, req->h_binned, result);
+}
+
+}//namespace cpu
+}//namespace exblas
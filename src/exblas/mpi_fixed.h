@@ -0,0 +1,218 @@
+/**
+ *  @file mpi_fixed.h
+ *  @brief Two-phase fixed-point dot products over MPI processes
+ *
+ *  fixed_dot agrees on the exponent of the largest product with a small
+ *  MPI_Allreduce(MAX) before summing the local products in fixed point.
+ *  The sums are then reduced with the same interface as mpi_accumulate.h,
+ *  one MPI_Allreduce on three words per dot.
+ */
+#pragma once
+#include <mpi.h>
+
+#include "fixed.h"
+
+namespace exblas {
+namespace cpu {
+
+/*!@brief several reproducible dot products in fixed point, over the processes of a communicator
+ *
+ * Computes the local parts of the K sums \f[ \sum_{i=0}^{N-1} x_{k,i} y_{k,i} \f]
+ * as FixedSum, relative to the largest product of all the processes (found
+ * with a blocking MPI_Allreduce on \c comm, so all of them must call it). The
+ * sums are complete after ReproAllReduce; the result is bitwise identical for
+ * any number of processes and threads, and within \c 2^(E-90) of the exact
+ * dot for each product, where \c 2^E bounds the largest one.
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @param size size N of the local arrays
+ * @param x1_ptr K first arrays
+ * @param x2_ptr K second arrays
+ * @param h_fixed pointer to at least \c K sums (contents are overwritten)
+ * @param comm communicator over which the sums will be reduced
+*/
+template<int K>
+void fixed_dot(unsigned size, const double* const (&x1_ptr)[K], const double* const (&x2_ptr)[K], FixedSum* h_fixed, MPI_Comm comm) {
+    int scan[FIXED_SCAN*K];
+    FixedScan<K>((int)size, x1_ptr, x2_ptr, scan);
+    MPI_Allreduce(MPI_IN_PLACE, scan, FIXED_SCAN*K, MPI_INT, MPI_MAX, comm);
+    FixedDOT<K>((int)size, x1_ptr, x2_ptr, scan, h_fixed);
+}
+
+/*!@brief reproducible dot product in fixed point, over the processes of a communicator
+ *
+ * @ingroup highlevel
+ * @param size size N of the local arrays
+ * @param x1_ptr first array
+ * @param x2_ptr second array
+ * @param h_fixed pointer to a sum (contents are overwritten)
+ * @param comm communicator over which the sum will be reduced
+*/
+static inline void fixed_dot(unsigned size, const double* x1_ptr, const double* x2_ptr, FixedSum* h_fixed, MPI_Comm comm) {
+    const double* const x1[1] = {x1_ptr};
+    const double* const x2[1] = {x2_ptr};
+    fixed_dot<1>(size, x1, x2, h_fixed, comm);
+}
+
+/*!@brief vector update followed by K reproducible dot products of the result in fixed point
+ *
+ * Computes \f$ z = y + \alpha x \f$ as exaxpy_dot, during the first phase of
+ * fixed_dot on \f$ (w_k, z) \f$. The second phase reads z again.
+ * @ingroup highlevel
+ * @tparam K number of dot products
+ * @param size size N of the local arrays
+ * @param alpha scalar of the update
+ * @param x array scaled by alpha
+ * @param y array added to alpha * x (may be z)
+ * @param z updated array (output)
+ * @param w K first operands of the dot products, any of them may be z
+ * @param h_fixed pointer to at least \c K sums (contents are overwritten)
+ * @param comm communicator over which the sums will be reduced
+*/
+template<int K>
+void fixed_axpy_dot(unsigned size, double alpha, const double* x, const double* y, double* z, const double* const (&w)[K], FixedSum* h_fixed, MPI_Comm comm) {
+    int scan[FIXED_SCAN*K];
+    const double* zs[K];
+    for (int k = 0; k < K; k++)
+        zs[k] = z;
+    FixedScan<K>((int)size, w, zs, scan, alpha, x, y, z);
+    MPI_Allreduce(MPI_IN_PLACE, scan, FIXED_SCAN*K, MPI_INT, MPI_MAX, comm);
+    FixedDOT<K>((int)size, w, zs, scan, h_fixed);
+}
+
+///@cond
+// User-defined reduction: 128 bit integer additions, the exponents are the same
+static void FixedSumOp(void *invec, void *inoutvec, int *len, MPI_Datatype *dtype) {
+    FixedSum *in = (FixedSum *) invec, *inout = (FixedSum *) inoutvec;
+
+    for (int k = 0; k < *len; k++)
+        FixedMerge(&inout[k], &in[k]);
+}
+
+// Contiguous MPI datatype holding a FixedSum
+static inline MPI_Datatype FixedType() {
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    if (type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(3, MPI_INT64_T, &type);
+        MPI_Type_commit(&type);
+    }
+    return type;
+}
+
+static inline MPI_Op FixedOp() {
+    static MPI_Op op = MPI_OP_NULL;
+    if (op == MPI_OP_NULL)
+        MPI_Op_create(FixedSumOp, 1, &op);
+    return op;
+}
+
+static inline void FixedFinish(int num, const FixedSum *h_fixed, double *result) {
+    for (int k = 0; k < num; k++)
+        result[k] = FixedRound(&h_fixed[k]);
+}
+///@endcond
+
+/**
+* @brief Reproducible allreduce of a batch of fixed-point sums
+*
+* @ingroup highlevel
+* @param num number of sums in \c h_fixed
+* @param h_fixed pointer to \c num sums, as filled by fixed_dot on the same communicator (contents are overwritten)
+* @param result pointer to \c num doubles receiving the rounded sums
+* @param comm communicator over which the reduction is done
+*/
+static inline void ReproAllReduce(int num, FixedSum *h_fixed, double *result, MPI_Comm comm) {
+    MPI_Allreduce(MPI_IN_PLACE, h_fixed, num, FixedType(), FixedOp(), comm);
+    FixedFinish(num, h_fixed, result);
+}
+
+/**
+* @brief Handle of a nonblocking reproducible allreduce of fixed-point sums
+*
+* @ingroup highlevel
+*/
+typedef struct {
+    int num;                    //!< number of sums being reduced
+    FixedSum *h_fixed;          //!< buffer holding the sums, reduced in place
+    MPI_Comm comm;              //!< communicator of the reduction
+    MPI_Request req;            //!< request of the underlying MPI_Iallreduce
+    int persistent;             //!< set by ReproAllReduceInit, the request is reused by ReproAllReduceStart
+} FixedRequest;
+
+/**
+* @brief Create a persistent reproducible allreduce of a batch of fixed-point sums
+*
+* @ingroup highlevel
+* @param num number of sums in \c h_fixed
+* @param h_fixed pointer to \c num sums, fixed for the life of the request
+* @param comm communicator over which the reduction is done
+* @param req handle to pass to ReproAllReduceStart, ReproAllReduceEnd and ReproAllReduceFree
+*/
+static inline void ReproAllReduceInit(int num, FixedSum *h_fixed, MPI_Comm comm, FixedRequest *req) {
+    req->num = num; req->h_fixed = h_fixed; req->comm = comm;
+    req->req = MPI_REQUEST_NULL;
+    req->persistent = 1;
+#if MPI_VERSION >= 4
+    MPI_Allreduce_init(MPI_IN_PLACE, h_fixed, num, FixedType(), FixedOp(), comm, MPI_INFO_NULL, &(req->req));
+#endif
+}
+
+/**
+* @brief Start a reduction of a request created by ReproAllReduceInit
+*
+* @ingroup highlevel
+* @param req handle of the reduction, completed by ReproAllReduceEnd
+*/
+static inline void ReproAllReduceStart(FixedRequest *req) {
+#if MPI_VERSION >= 4
+    if (req->persistent) {
+        MPI_Start(&(req->req));
+        return;
+    }
+#endif
+    MPI_Iallreduce(MPI_IN_PLACE, req->h_fixed, req->num, FixedType(), FixedOp(), req->comm, &(req->req));
+}
+
+/**
+* @brief Free a request created by ReproAllReduceInit
+*
+* @ingroup highlevel
+* @param req handle of an inactive persistent reduction
+*/
+static inline void ReproAllReduceFree(FixedRequest *req) {
+    if (req->req != MPI_REQUEST_NULL)
+        MPI_Request_free(&(req->req));
+}
+
+/**
+* @brief Start a nonblocking reproducible allreduce of a batch of fixed-point sums
+*
+* The buffer must not be touched until ReproAllReduceEnd has returned.
+*
+* @ingroup highlevel
+* @param num number of sums in \c h_fixed
+* @param h_fixed pointer to \c num sums (contents are overwritten)
+* @param comm communicator over which the reduction is done
+* @param req handle to pass to ReproAllReduceEnd
+*/
+static inline void ReproAllReduceBegin(int num, FixedSum *h_fixed, MPI_Comm comm, FixedRequest *req) {
+    req->num = num; req->h_fixed = h_fixed; req->comm = comm;
+    req->req = MPI_REQUEST_NULL;
+    req->persistent = 0;
+    ReproAllReduceStart(req);
+}
+
+/**
+* @brief Complete a nonblocking reproducible allreduce of fixed-point sums and round its results
+*
+* @ingroup highlevel
+* @param req handle returned by ReproAllReduceBegin or started by ReproAllReduceStart
+* @param result pointer to \c req->num doubles receiving the rounded sums
+*/
+static inline void ReproAllReduceEnd(FixedRequest *req, double *result) {
+    MPI_Wait(&(req->req), MPI_STATUS_IGNORE);
+    FixedFinish(req->num, req->h_fixed, result);
+}
+
+}//namespace cpu
+}//namespace exblas
@@ -0,0 +1,156 @@
+/**
+ *  @file mpi_fpe.h
+ *  @brief Reduction of floating-point expansions over MPI processes
+ *
+ *  Same interface as mpi_accumulate.h, for the expansions of fpe.h: the
+ *  functions take the sums as FpeSum and an FpeRequest. Each reduction is
+ *  one MPI_Allreduce on \c exblas::FPE_SIZE doubles per sum.
+ */
+#pragma once
+#include <mpi.h>
+
+#include "fpe.h"
+
+namespace exblas {
+namespace cpu {
+
+///@cond
+// User-defined reduction: the merge keeps the exact sum while the expansions
+// hold it, and the rounding only depends on that sum, not on the tree
+static void FpeSumOp(void *invec, void *inoutvec, int *len, MPI_Datatype *dtype) {
+    FpeSum *in = (FpeSum *) invec, *inout = (FpeSum *) inoutvec;
+
+    for (int k = 0; k < *len; k++)
+        FpeMerge(&inout[k], &in[k]);
+}
+
+// Contiguous MPI datatype holding an FpeSum
+static inline MPI_Datatype FpeType() {
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    if (type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(FPE_SIZE, MPI_DOUBLE, &type);
+        MPI_Type_commit(&type);
+    }
+    return type;
+}
+
+static inline MPI_Op FpeOp() {
+    static MPI_Op op = MPI_OP_NULL;
+    if (op == MPI_OP_NULL)
+        MPI_Op_create(FpeSumOp, 1, &op);
+    return op;
+}
+
+static inline void FpeFinish(int num, const FpeSum *h_fpe, double *result) {
+    for (int k = 0; k < num; k++)
+        result[k] = FpeRound(&h_fpe[k]);
+}
+///@endcond
+
+/**
+* @brief Allreduce of a batch of floating-point expansions
+*
+* The result is correctly rounded and bitwise identical on all processes and
+* for any number of them, within the limits given in fpe.h.
+*
+* @ingroup highlevel
+* @param num number of sums in \c h_fpe
+* @param h_fpe pointer to \c num sums, as filled by fpe_dot (contents are overwritten)
+* @param result pointer to \c num doubles receiving the rounded sums
+* @param comm communicator over which the reduction is done
+*/
+static inline void ReproAllReduce(int num, FpeSum *h_fpe, double *result, MPI_Comm comm) {
+    MPI_Allreduce(MPI_IN_PLACE, h_fpe, num, FpeType(), FpeOp(), comm);
+    FpeFinish(num, h_fpe, result);
+}
+
+/**
+* @brief Handle of a nonblocking allreduce of floating-point expansions
+*
+* @ingroup highlevel
+*/
+typedef struct {
+    int num;                    //!< number of sums being reduced
+    FpeSum *h_fpe;              //!< buffer holding the sums, reduced in place
+    MPI_Comm comm;              //!< communicator of the reduction
+    MPI_Request req;            //!< request of the underlying MPI_Iallreduce
+    int persistent;             //!< set by ReproAllReduceInit, the request is reused by ReproAllReduceStart
+} FpeRequest;
+
+/**
+* @brief Create a persistent allreduce of a batch of floating-point expansions
+*
+* @ingroup highlevel
+* @param num number of sums in \c h_fpe
+* @param h_fpe pointer to \c num sums, fixed for the life of the request
+* @param comm communicator over which the reduction is done
+* @param req handle to pass to ReproAllReduceStart, ReproAllReduceEnd and ReproAllReduceFree
+*/
+static inline void ReproAllReduceInit(int num, FpeSum *h_fpe, MPI_Comm comm, FpeRequest *req) {
+    req->num = num; req->h_fpe = h_fpe; req->comm = comm;
+    req->req = MPI_REQUEST_NULL;
+    req->persistent = 1;
+#if MPI_VERSION >= 4
+    MPI_Allreduce_init(MPI_IN_PLACE, h_fpe, num, FpeType(), FpeOp(), comm, MPI_INFO_NULL, &(req->req));
+#endif
+}
+
+/**
+* @brief Start a reduction of a request created by ReproAllReduceInit
+*
+* @ingroup highlevel
+* @param req handle of the reduction, completed by ReproAllReduceEnd
+*/
+static inline void ReproAllReduceStart(FpeRequest *req) {
+#if MPI_VERSION >= 4
+    if (req->persistent) {
+        MPI_Start(&(req->req));
+        return;
+    }
+#endif
+    MPI_Iallreduce(MPI_IN_PLACE, req->h_fpe, req->num, FpeType(), FpeOp(), req->comm, &(req->req));
+}
+
+/**
+* @brief Free a request created by ReproAllReduceInit
+*
+* @ingroup highlevel
+* @param req handle of an inactive persistent reduction
+*/
+static inline void ReproAllReduceFree(FpeRequest *req) {
+    if (req->req != MPI_REQUEST_NULL)
+        MPI_Request_free(&(req->req));
+}
+
+/**
+* @brief Start a nonblocking allreduce of a batch of floating-point expansions
+*
+* The buffer must not be touched until ReproAllReduceEnd has returned.
+*
+* @ingroup highlevel
+* @param num number of sums in \c h_fpe
+* @param h_fpe pointer to \c num sums (contents are overwritten)
+* @param comm communicator over which the reduction is done
+* @param req handle to pass to ReproAllReduceEnd
+*/
+static inline void ReproAllReduceBegin(int num, FpeSum *h_fpe, MPI_Comm comm, FpeRequest *req) {
+    req->num = num; req->h_fpe = h_fpe; req->comm = comm;
+    req->req = MPI_REQUEST_NULL;
+    req->persistent = 0;
+    ReproAllReduceStart(req);
+}
+
+/**
+* @brief Complete a nonblocking allreduce of floating-point expansions and round its results
+*
+* @ingroup highlevel
+* @param req handle returned by ReproAllReduceBegin or started by ReproAllReduceStart
+* @param result pointer to \c req->num doubles receiving the rounded sums
+*/
+static inline void ReproAllReduceEnd(FpeRequest *req, double *result) {
+    MPI_Wait(&(req->req), MPI_STATUS_IGNORE);
+    FpeFinish(req->num, req->h_fpe, result);
+}
+
+}//namespace cpu
+}//namespace exblas
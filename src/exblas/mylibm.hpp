@@ -137,21 +137,13 @@ static inline double OddRoundSumNonnegative(double th, double tl)
 #define LOCK_PREFIX
 #endif
 
-// signedcarry in {-1, 0, 1}
+// Add x to memref, return the old value and set of on signed overflow.
+// The superaccumulators are private to a thread unless THREADSAFE is set,
+// so a plain add is enough: no lock prefix, no asm barrier to the compiler.
 inline static int64_t xadd(int64_t & memref, int64_t x, unsigned char & of)
 {
 
-#if defined _MSC_VER && !TSAFE //non-atomic load-ADDC-store
-	int64_t y = memref;
-	memref = y + x;
-	int64_t x63 = (x >> 63) & 1;
-	int64_t y63 = (y >> 63) & 1;
-	int64_t r63 = (memref >> 63) & 1;
-	int64_t c62 = r63 ^ x63 ^ y63;
-	int64_t c63 = (x63 & y63) | (c62 & (x63 | y63));
-	of = c63 ^ c62;
-	return y;
-#else
+#if TSAFE && !defined _MSC_VER
     // OF and SF  -> carry=1
     // OF and !SF -> carry=-1
     // !OF        -> carry=0
@@ -166,21 +158,28 @@ inline static int64_t xadd(int64_t & memref, int64_t x, unsigned char & of)
      : "+m" (memref), "+r" (oldword), "=q" (of) : : "cc", "memory");
 #endif //ATT_SYNTAX
     return oldword;
-#endif //_MSC_VER
+#elif defined _MSC_VER //non-atomic load-ADDC-store
+	int64_t y = memref;
+	memref = y + x;
+	int64_t x63 = (x >> 63) & 1;
+	int64_t y63 = (y >> 63) & 1;
+	int64_t r63 = (memref >> 63) & 1;
+	int64_t c62 = r63 ^ x63 ^ y63;
+	int64_t c63 = (x63 & y63) | (c62 & (x63 | y63));
+	of = c63 ^ c62;
+	return y;
+#else
+    int64_t oldword = memref, sum;
+    of = __builtin_add_overflow(oldword, x, &sum);
+    memref = sum;
+    return oldword;
+#endif
 }
 
-#ifndef _WITHOUT_VCL
-inline static bool horizontal_or(vcl::Vec8d const & a) {
-    //return _mm512_movemask_pd(a) != 0;
-    vcl::Vec8db p = a != 0;
-    return vcl::horizontal_or( p);
-    //return !_mm512_testz_pd(p, p);
-}
-#else
+// the vector versions are in simd.h
 inline static bool horizontal_or( const double & a){
     return a != 0;
 }
-#endif//_WITHOUT_VCL
 
 }//namespace cpu
 }//namespace exblas
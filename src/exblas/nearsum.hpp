@@ -6,6 +6,7 @@
 // from "ACCURATE FLOATING-POINT SUMMATION" by S.M.RUMP, T.OGITA, S.OISHI (2005)
 // http://www.ti3.tu-harburg.de/paper/rump/RuOgOi06.pdf
 // =========================================
+#pragma once
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
@@ -64,6 +65,7 @@ double Sign (double v) {
 	return (v < 0) ? -1.:1.;
 }
 
+__inline__
 double NearSum (const int32_t n, double *vec, const int32_t ld) {
 	double tmp, res, res2, r, r2, mu, delta, delta2;
 	double eps = scalbn (1., -53);
@@ -0,0 +1,173 @@
+/**
+ *  @file simd.h
+ *  @brief Thin wrappers around AVX2 and AVX-512 double precision vectors
+ *
+ *  Provides the small subset of vector operations needed by the floating
+ *  point expansions and the binned sums: loads and stores (also partial),
+ *  arithmetic, fused multiply-add, lane tests and a few bit tricks. \c Vecd
+ *  is the widest vector available with the instruction set the code is
+ *  compiled for.
+ */
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <immintrin.h>
+
+namespace exblas {
+namespace simd {
+
+// Scalar versions, so that templates written for vectors also accept double
+inline double mul_add(double a, double b, double c) { return std::fma(a, b, c); }
+inline double mul_sub(double a, double b, double c) { return std::fma(a, b, -c); }
+inline double mul_sub_x(double a, double b, double c) { return std::fma(a, b, -c); }
+
+#if defined __AVX2__ && defined __FMA__
+///@brief mask of 4 lanes, as returned by comparisons of Vec4d
+struct Vec4db {
+    __m256d m;
+    Vec4db(__m256d x) : m(x) {}
+};
+inline bool horizontal_or(Vec4db const & a) { return !_mm256_testz_pd(a.m, a.m); }
+inline Vec4db operator&(Vec4db const & a, Vec4db const & b) { return _mm256_and_pd(a.m, b.m); }
+
+///@brief 4 doubles in an AVX register
+struct Vec4d {
+    static constexpr int size = 4;
+    __m256d v;
+    Vec4d() {}
+    Vec4d(double x) : v(_mm256_set1_pd(x)) {}
+    Vec4d(__m256d x) : v(x) {}
+    operator __m256d() const { return v; }
+    Vec4d & load(const double *p) { v = _mm256_loadu_pd(p); return *this; }
+    Vec4d & load_a(const double *p) { v = _mm256_load_pd(p); return *this; }
+    // lanes n..3 are set to zero
+    Vec4d & load_partial(int n, const double *p) {
+        __m256i lanes = _mm256_set_epi64x(3, 2, 1, 0);
+        __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), lanes);
+        v = _mm256_maskload_pd(p, mask);
+        return *this;
+    }
+    Vec4d & cutoff(int n) {
+        __m256i lanes = _mm256_set_epi64x(3, 2, 1, 0);
+        __m256d mask = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(n), lanes));
+        v = _mm256_and_pd(v, mask);
+        return *this;
+    }
+    void store(double *p) const { _mm256_storeu_pd(p, v); }
+    void store_a(double *p) const { _mm256_store_pd(p, v); }
+    // only lanes 0..n-1 are written
+    void store_partial(int n, double *p) const {
+        __m256i lanes = _mm256_set_epi64x(3, 2, 1, 0);
+        _mm256_maskstore_pd(p, _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), lanes), v);
+    }
+};
+inline Vec4d operator+(Vec4d const & a, Vec4d const & b) { return _mm256_add_pd(a, b); }
+inline Vec4d operator-(Vec4d const & a, Vec4d const & b) { return _mm256_sub_pd(a, b); }
+inline Vec4d operator*(Vec4d const & a, Vec4d const & b) { return _mm256_mul_pd(a, b); }
+inline Vec4d operator-(Vec4d const & a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+inline Vec4db operator<(Vec4d const & a, Vec4d const & b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+inline Vec4db operator!=(Vec4d const & a, Vec4d const & b) { return _mm256_cmp_pd(a, b, _CMP_NEQ_UQ); }
+inline Vec4d abs(Vec4d const & a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+inline Vec4d max(Vec4d const & a, Vec4d const & b) { return _mm256_max_pd(a, b); }
+// sets the last bit of the mantissa of every lane
+inline Vec4d set_low_bit(Vec4d const & a) { return _mm256_or_pd(a, _mm256_castsi256_pd(_mm256_set1_epi64x(1))); }
+inline Vec4d mul_add(Vec4d const & a, Vec4d const & b, Vec4d const & c) { return _mm256_fmadd_pd(a, b, c); }
+inline Vec4d mul_sub(Vec4d const & a, Vec4d const & b, Vec4d const & c) { return _mm256_fmsub_pd(a, b, c); }
+inline Vec4d mul_sub_x(Vec4d const & a, Vec4d const & b, Vec4d const & c) { return _mm256_fmsub_pd(a, b, c); }
+// true if any lane is not zero
+inline bool horizontal_or(Vec4d const & a) { return horizontal_or(a != Vec4d(0.)); }
+
+///@brief 4 64 bit integers in an AVX register
+struct Vec4q {
+    static constexpr int size = 4;
+    __m256i v;
+    Vec4q() {}
+    Vec4q(int64_t x) : v(_mm256_set1_epi64x(x)) {}
+    Vec4q(__m256i x) : v(x) {}
+    operator __m256i() const { return v; }
+    void store(int64_t *p) const { _mm256_storeu_si256((__m256i *) p, v); }
+};
+// wraps around on overflow
+inline Vec4q operator+(Vec4q const & a, Vec4q const & b) { return _mm256_add_epi64(a, b); }
+// the bits of the lanes of a, as integers
+inline Vec4q reinterpret_i(Vec4d const & a) { return _mm256_castpd_si256(a); }
+#endif//__AVX2__ && __FMA__
+
+#if defined __AVX512F__
+///@brief mask of 8 lanes, as returned by comparisons of Vec8d
+struct Vec8db {
+    __mmask8 m;
+    Vec8db(__mmask8 x) : m(x) {}
+};
+inline bool horizontal_or(Vec8db const & a) { return a.m != 0; }
+inline Vec8db operator&(Vec8db const & a, Vec8db const & b) { return (__mmask8) (a.m & b.m); }
+
+///@brief 8 doubles in an AVX-512 register
+struct Vec8d {
+    static constexpr int size = 8;
+    __m512d v;
+    Vec8d() {}
+    Vec8d(double x) : v(_mm512_set1_pd(x)) {}
+    Vec8d(__m512d x) : v(x) {}
+    operator __m512d() const { return v; }
+    Vec8d & load(const double *p) { v = _mm512_loadu_pd(p); return *this; }
+    Vec8d & load_a(const double *p) { v = _mm512_load_pd(p); return *this; }
+    // lanes n..7 are set to zero
+    Vec8d & load_partial(int n, const double *p) {
+        v = _mm512_maskz_loadu_pd((__mmask8) ((1u << n) - 1), p);
+        return *this;
+    }
+    Vec8d & cutoff(int n) {
+        v = _mm512_maskz_mov_pd((__mmask8) ((1u << n) - 1), v);
+        return *this;
+    }
+    void store(double *p) const { _mm512_storeu_pd(p, v); }
+    void store_a(double *p) const { _mm512_store_pd(p, v); }
+    // only lanes 0..n-1 are written
+    void store_partial(int n, double *p) const {
+        _mm512_mask_storeu_pd(p, (__mmask8) ((1u << n) - 1), v);
+    }
+};
+inline Vec8d operator+(Vec8d const & a, Vec8d const & b) { return _mm512_add_pd(a, b); }
+inline Vec8d operator-(Vec8d const & a, Vec8d const & b) { return _mm512_sub_pd(a, b); }
+inline Vec8d operator*(Vec8d const & a, Vec8d const & b) { return _mm512_mul_pd(a, b); }
+inline Vec8d operator-(Vec8d const & a) { return _mm512_sub_pd(_mm512_setzero_pd(), a); }
+inline Vec8db operator<(Vec8d const & a, Vec8d const & b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+inline Vec8db operator!=(Vec8d const & a, Vec8d const & b) { return _mm512_cmp_pd_mask(a, b, _CMP_NEQ_UQ); }
+inline Vec8d abs(Vec8d const & a) { return _mm512_abs_pd(a); }
+inline Vec8d max(Vec8d const & a, Vec8d const & b) { return _mm512_max_pd(a, b); }
+// sets the last bit of the mantissa of every lane
+inline Vec8d set_low_bit(Vec8d const & a) { return _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(a), _mm512_set1_epi64(1))); }
+inline Vec8d mul_add(Vec8d const & a, Vec8d const & b, Vec8d const & c) { return _mm512_fmadd_pd(a, b, c); }
+inline Vec8d mul_sub(Vec8d const & a, Vec8d const & b, Vec8d const & c) { return _mm512_fmsub_pd(a, b, c); }
+inline Vec8d mul_sub_x(Vec8d const & a, Vec8d const & b, Vec8d const & c) { return _mm512_fmsub_pd(a, b, c); }
+// true if any lane is not zero
+inline bool horizontal_or(Vec8d const & a) { return horizontal_or(a != Vec8d(0.)); }
+
+///@brief 8 64 bit integers in an AVX-512 register
+struct Vec8q {
+    static constexpr int size = 8;
+    __m512i v;
+    Vec8q() {}
+    Vec8q(int64_t x) : v(_mm512_set1_epi64(x)) {}
+    Vec8q(__m512i x) : v(x) {}
+    operator __m512i() const { return v; }
+    void store(int64_t *p) const { _mm512_storeu_si512(p, v); }
+};
+// wraps around on overflow
+inline Vec8q operator+(Vec8q const & a, Vec8q const & b) { return _mm512_add_epi64(a, b); }
+// the bits of the lanes of a, as integers
+inline Vec8q reinterpret_i(Vec8d const & a) { return _mm512_castpd_si512(a); }
+#endif//__AVX512F__
+
+// Widest vector of the target (the 8 wide one can be turned off with EXBLAS_NO_AVX512)
+#if defined __AVX512F__ && !defined EXBLAS_NO_AVX512
+typedef Vec8d Vecd;
+typedef Vec8q Vecq;
+#elif defined __AVX2__ && defined __FMA__
+typedef Vec4d Vecd;
+typedef Vec4q Vecq;
+#endif
+
+}//namespace simd
+}//namespace exblas